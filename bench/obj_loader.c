@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "array.h"
+#include "mesh.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Load throughput of load_mesh_obj_data in MB/s. Every file is loaded into an
+// empty mesh a number of times and the best time is kept. The checksum of the
+// vertices and faces shows the mesh did not change between two versions of
+// the loader. Without files, a synthetic OBJ with 400K v, vt and vn lines and
+// 800K faces with random v/vt/vn corners is written and loaded.
+//
+//   bench_obj_loader [-r runs] [file.obj...]
+///////////////////////////////////////////////////////////////////////////////
+#define SYNTHETIC_PATH "bench_obj_loader.obj"
+#define SYNTHETIC_ELEMENTS 400000
+#define SYNTHETIC_FACES 800000
+
+static double get_time(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// FNV-1a of the bytes
+static uint64_t get_checksum(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+static long get_file_size(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+// Numbers from a fixed linear congruential sequence, so every run writes
+// the same file
+static uint32_t next_random(uint32_t* state) {
+  *state = *state * 1664525u + 1013904223u;
+  return *state >> 8;
+}
+
+static float next_coordinate(uint32_t* state, float scale) {
+  return (next_random(state) / (float)(1 << 24) * 2.0f - 1.0f) * scale;
+}
+
+static int write_synthetic_file(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    return 0;
+  }
+
+  uint32_t state = 1;
+  for (int i = 0; i < SYNTHETIC_ELEMENTS; i++) {
+    fprintf(
+      file, "v %f %f %f\n",
+      next_coordinate(&state, 100), next_coordinate(&state, 100), next_coordinate(&state, 100)
+    );
+  }
+  for (int i = 0; i < SYNTHETIC_ELEMENTS; i++) {
+    fprintf(file, "vt %f %f\n", next_coordinate(&state, 1), next_coordinate(&state, 1));
+  }
+  for (int i = 0; i < SYNTHETIC_ELEMENTS; i++) {
+    fprintf(
+      file, "vn %f %f %f\n",
+      next_coordinate(&state, 1), next_coordinate(&state, 1), next_coordinate(&state, 1)
+    );
+  }
+  for (int i = 0; i < SYNTHETIC_FACES; i++) {
+    fprintf(file, "f");
+    for (int j = 0; j < 3; j++) {
+      fprintf(
+        file, " %u/%u/%u",
+        next_random(&state) % SYNTHETIC_ELEMENTS + 1,
+        next_random(&state) % SYNTHETIC_ELEMENTS + 1,
+        next_random(&state) % SYNTHETIC_ELEMENTS + 1
+      );
+    }
+    fprintf(file, "\n");
+  }
+  return fclose(file) == 0;
+}
+
+// Returns the best time of the runs, or a negative time if the file holds
+// no mesh
+static double time_load(const char* path, int runs, uint64_t* checksum) {
+  double best = 1e9;
+  for (int run = 0; run < runs; run++) {
+    mesh_t mesh;
+    memset(&mesh, 0, sizeof(mesh));
+
+    double start = get_time();
+    load_mesh_obj_data(path, &mesh);
+    double elapsed = get_time() - start;
+
+    best = elapsed < best ? elapsed : best;
+    if (run == 0) {
+      uint64_t hash = 0xCBF29CE484222325ULL;
+      hash = get_checksum(hash, mesh.vertices, array_length(mesh.vertices) * sizeof(vec3_t));
+      *checksum = get_checksum(hash, mesh.faces, array_length(mesh.faces) * sizeof(face_t));
+    }
+    int num_faces = array_length(mesh.faces);
+    array_free(mesh.faces);
+    array_free(mesh.vertices);
+    if (num_faces == 0) {
+      return -1;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  int runs = 5;
+  int first_file = 1;
+
+  if (argc > 2 && argv[1][0] == '-' && argv[1][1] == 'r') {
+    runs = atoi(argv[2]);
+    first_file = 3;
+  }
+  if (runs <= 0) {
+    fprintf(stderr, "Usage: %s [-r runs] [file.obj...]\n", argv[0]);
+    return 1;
+  }
+
+  const char* synthetic[] = { SYNTHETIC_PATH };
+  const char** files = (const char**)&argv[first_file];
+  int num_files = argc - first_file;
+  if (num_files == 0) {
+    if (!write_synthetic_file(SYNTHETIC_PATH)) {
+      fprintf(stderr, "Error writing %s. \n", SYNTHETIC_PATH);
+      return 1;
+    }
+    files = synthetic;
+    num_files = 1;
+  }
+
+  int failed = 0;
+  for (int i = 0; i < num_files; i++) {
+    uint64_t checksum = 0;
+    double best = time_load(files[i], runs, &checksum);
+    double megabytes = get_file_size(files[i]) / (1024.0 * 1024.0);
+
+    if (best < 0) {
+      printf("%-40s failed, no faces loaded\n", files[i]);
+      failed++;
+      continue;
+    }
+    printf(
+      "%-40s %7.1f MB %9.2f ms %8.1f MB/s  %016llx\n",
+      files[i], megabytes, best * 1e3, megabytes / best, (unsigned long long)checksum
+    );
+  }
+
+  if (files == synthetic) {
+    remove(SYNTHETIC_PATH);
+  }
+  printf("Best of %d runs\n", runs);
+  return failed > 0;
+}
@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "upng.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode time of a set of PNG files, which is mostly inflate and unfiltering.
+// Every file is decoded whole with upng_decode a number of times and the best
+// time is kept. The checksum of the decoded pixels shows the output did not
+// change between two versions of the decoder.
+//
+//   bench_png_decode [-r runs] file.png...
+///////////////////////////////////////////////////////////////////////////////
+static double get_time(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// FNV-1a of the bytes
+static uint64_t get_checksum(const unsigned char* data, unsigned size) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (unsigned i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+int main(int argc, char** argv) {
+  int runs = 5;
+  int first_file = 1;
+
+  if (argc > 2 && argv[1][0] == '-' && argv[1][1] == 'r') {
+    runs = atoi(argv[2]);
+    first_file = 3;
+  }
+  if (first_file >= argc || runs <= 0) {
+    fprintf(stderr, "Usage: %s [-r runs] file.png...\n", argv[0]);
+    return 1;
+  }
+
+  double total = 0;
+  int failed = 0;
+  for (int i = first_file; i < argc; i++) {
+    double best = 1e9;
+    uint64_t checksum = 0;
+    upng_error error = UPNG_EOK;
+
+    for (int run = 0; run < runs; run++) {
+      upng_t* png = upng_new_from_file(argv[i]);
+      if (png == NULL) {
+        error = UPNG_ENOMEM;
+        break;
+      }
+
+      double start = get_time();
+      error = upng_decode(png);
+      double elapsed = get_time() - start;
+
+      best = elapsed < best ? elapsed : best;
+      if (run == 0 && error == UPNG_EOK) {
+        checksum = get_checksum(upng_get_buffer(png), upng_get_size(png));
+      }
+      upng_free(png);
+      if (error != UPNG_EOK) {
+        break;
+      }
+    }
+
+    if (error != UPNG_EOK) {
+      printf("%-40s failed, upng error %d\n", argv[i], error);
+      failed++;
+      continue;
+    }
+    total += best;
+    printf("%-40s %9.2f ms  %016llx\n", argv[i], best * 1e3, (unsigned long long)checksum);
+  }
+
+  printf("Total %.2f ms for %d files, best of %d runs\n", total * 1e3, argc - first_file - failed, runs);
+  return failed > 0;
+}
@@ -0,0 +1,194 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "texture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Orientation sweep of texture sampling. A square of pixels is walked over
+// a large texture at one texel per pixel, rotated from 0 to 90 degrees.
+// Every texel address goes through a model of an L1 cache, an L2 cache and
+// a TLB, once laid out row by row and once in the 4x4 tiles of texture.c,
+// which gives miss rates that do not depend on the host. The same walk is
+// then timed through the real sampler.
+///////////////////////////////////////////////////////////////////////////////
+#define TEXTURE_SIZE 2048
+#define WALK_SIZE 1024
+
+#define LINE_SIZE_LOG2 6
+#define PAGE_SIZE_LOG2 12
+
+// A set associative cache with least recently used replacement
+typedef struct {
+  int num_sets;
+  int num_ways;
+  int line_size_log2;
+  uint64_t* tags;
+  uint32_t* ages;
+  uint32_t clock;
+  long misses;
+} cache_model_t;
+
+static void init_cache(cache_model_t* cache, int size, int num_ways, int line_size_log2) {
+  cache->num_ways = num_ways;
+  cache->num_sets = (size >> line_size_log2) / num_ways;
+  cache->line_size_log2 = line_size_log2;
+  cache->tags = (uint64_t*)calloc((size_t)cache->num_sets * num_ways, sizeof(uint64_t));
+  cache->ages = (uint32_t*)calloc((size_t)cache->num_sets * num_ways, sizeof(uint32_t));
+  cache->clock = 0;
+  cache->misses = 0;
+}
+
+static void free_cache(cache_model_t* cache) {
+  free(cache->tags);
+  free(cache->ages);
+}
+
+// Returns true on a hit, tags are stored plus one so zero is an empty way
+static bool access_cache(cache_model_t* cache, uint64_t address) {
+  uint64_t line = address >> cache->line_size_log2;
+  int set = (int)(line % (uint64_t)cache->num_sets);
+  uint64_t* tags = &cache->tags[set * cache->num_ways];
+  uint32_t* ages = &cache->ages[set * cache->num_ways];
+  int oldest = 0;
+
+  cache->clock++;
+  for (int way = 0; way < cache->num_ways; way++) {
+    if (tags[way] == line + 1) {
+      ages[way] = cache->clock;
+      return true;
+    }
+    if (ages[way] < ages[oldest]) {
+      oldest = way;
+    }
+  }
+  tags[oldest] = line + 1;
+  ages[oldest] = cache->clock;
+  cache->misses++;
+  return false;
+}
+
+// The index of a texel in a level stored row by row, or in tiles the way
+// texture.c stores them
+static uint64_t get_row_major_index(int x, int y) {
+  return (uint64_t)y * TEXTURE_SIZE + x;
+}
+
+static uint64_t get_tiled_index(int x, int y) {
+  int pitch = TEXTURE_SIZE * TEXTURE_TILE_SIZE;
+  return
+    (uint64_t)(y >> TEXTURE_TILE_SIZE_LOG2) * pitch +
+    ((y & (TEXTURE_TILE_SIZE - 1)) << TEXTURE_TILE_SIZE_LOG2) +
+    ((x >> TEXTURE_TILE_SIZE_LOG2) << (TEXTURE_TILE_SIZE_LOG2 * 2)) +
+    (x & (TEXTURE_TILE_SIZE - 1));
+}
+
+// Texture coordinates of the first pixel of a row of the walk and the step
+// from one pixel to the next, for a walk rotated by angle
+static void get_walk(float angle, int y, float* u, float* v, float* du, float* dv) {
+  float c = cosf(angle);
+  float s = sinf(angle);
+  *u = (-s * y) / TEXTURE_SIZE + 0.5f;
+  *v = (c * y) / TEXTURE_SIZE + 0.1f;
+  *du = c / TEXTURE_SIZE;
+  *dv = s / TEXTURE_SIZE;
+}
+
+static void simulate_walk(float angle, bool is_tiled) {
+  cache_model_t l1, l2, tlb;
+  init_cache(&l1, 32 << 10, 8, LINE_SIZE_LOG2);
+  init_cache(&l2, 1 << 20, 16, LINE_SIZE_LOG2);
+  init_cache(&tlb, 64 << PAGE_SIZE_LOG2, 64, PAGE_SIZE_LOG2);
+
+  for (int y = 0; y < WALK_SIZE; y++) {
+    float u, v, du, dv;
+    get_walk(angle, y, &u, &v, &du, &dv);
+    for (int x = 0; x < WALK_SIZE; x++) {
+      int tx = (int)floorf(u * TEXTURE_SIZE) & (TEXTURE_SIZE - 1);
+      int ty = (int)floorf(v * TEXTURE_SIZE) & (TEXTURE_SIZE - 1);
+      uint64_t address = (is_tiled ? get_tiled_index(tx, ty) : get_row_major_index(tx, ty)) * sizeof(uint32_t);
+      if (!access_cache(&l1, address)) {
+        access_cache(&l2, address);
+      }
+      access_cache(&tlb, address);
+      u += du;
+      v += dv;
+    }
+  }
+
+  double count = (double)WALK_SIZE * WALK_SIZE;
+  printf(
+    "  %5.0f%% %5.0f%% %5.0f%%",
+    100.0 * l1.misses / count, 100.0 * l2.misses / count, 100.0 * tlb.misses / count
+  );
+  free_cache(&l1);
+  free_cache(&l2);
+  free_cache(&tlb);
+}
+
+static double get_time(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Nanoseconds per sample of the walk through the real sampler, best of runs
+static double time_walk(const sampler_t* sampler, float angle, int runs, uint32_t* checksum) {
+  double best = 1e9;
+  for (int run = 0; run < runs; run++) {
+    uint32_t sum = 0;
+    double start = get_time();
+    for (int y = 0; y < WALK_SIZE; y++) {
+      float u, v, du, dv;
+      get_walk(angle, y, &u, &v, &du, &dv);
+      for (int x = 0; x < WALK_SIZE; x++) {
+        sum += sample_texture(sampler, u, v);
+        u += du;
+        v += dv;
+      }
+    }
+    double elapsed = get_time() - start;
+    best = elapsed < best ? elapsed : best;
+    *checksum = sum;
+  }
+  return best * 1e9 / ((double)WALK_SIZE * WALK_SIZE);
+}
+
+int main(int argc, char** argv) {
+  int runs = argc > 1 ? atoi(argv[1]) : 5;
+
+  printf("Simulated miss rates, 32 KB 8-way L1, 1 MB 16-way L2, 64-entry TLB\n");
+  printf("          row-major             tiled %dx%d\n", TEXTURE_TILE_SIZE, TEXTURE_TILE_SIZE);
+  printf("  angle     L1     L2    TLB     L1     L2    TLB\n");
+  for (int degrees = 0; degrees <= 90; degrees += 15) {
+    float angle = degrees * (float)M_PI / 180.0f;
+    printf("  %5d", degrees);
+    simulate_walk(angle, false);
+    simulate_walk(angle, true);
+    printf("\n");
+  }
+
+  uint32_t* pixels = (uint32_t*)malloc(sizeof(uint32_t) * TEXTURE_SIZE * TEXTURE_SIZE);
+  for (int i = 0; i < TEXTURE_SIZE * TEXTURE_SIZE; i++) {
+    pixels[i] = (uint32_t)i * 2654435761u;
+  }
+  texture_t* texture = create_texture(pixels, TEXTURE_SIZE, TEXTURE_SIZE);
+  free(pixels);
+
+  sampler_t sampler;
+  set_texture_filter(FILTER_NEAREST);
+  init_sampler(&sampler, texture, 0);
+
+  printf("\nNearest samples through the tiled texture, best of %d runs\n", runs);
+  for (int degrees = 0; degrees <= 90; degrees += 15) {
+    uint32_t checksum = 0;
+    double ns = time_walk(&sampler, degrees * (float)M_PI / 180.0f, runs, &checksum);
+    printf("  %5d  %6.2f ns per sample  (checksum %08x)\n", degrees, ns, checksum);
+  }
+
+  free_texture(texture);
+  return 0;
+}
@@ -7,11 +7,16 @@
 #define ARRAY_CAPACITY(array) (ARRAY_RAW_DATA(array)[0])
 #define ARRAY_OCCUPIED(array) (ARRAY_RAW_DATA(array)[1])
 
+// Add count items to the end of the array, a new array is NULL when it can
+// not be allocated
 void *array_hold(void *array, int count, int item_size) {
   if (array == NULL) {
     int raw_size = (sizeof(int) * 2) + (item_size * count);
 
     int *base = (int *)malloc(raw_size);
+    if (base == NULL) {
+      return NULL;
+    }
     base[0] = count;  // capacity
     base[1] = count;  // occupied
 
@@ -36,6 +41,24 @@ void *array_hold(void *array, int count, int item_size) {
   }
 }
 
+// Make room for count more items without adding them, so pushing them
+// never has to grow the array
+void *array_reserve(void *array, int count, int item_size) {
+  int occupied = array_length(array);
+
+  if (array != NULL && occupied + count <= ARRAY_CAPACITY(array)) {
+    return array;
+  }
+
+  int raw_size = sizeof(int) * 2 + item_size * (occupied + count);
+
+  int *base = (int *)realloc(array != NULL ? ARRAY_RAW_DATA(array) : NULL, raw_size);
+  base[0] = occupied + count;
+  base[1] = occupied;
+
+  return base + 2;
+}
+
 int array_length(void *array) {
   return (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
 }
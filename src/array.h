@@ -8,5 +8,6 @@
 
 int array_length(void *array);
 void *array_hold(void *array, int count, int item_size);
+void *array_reserve(void *array, int count, int item_size);
 
 void array_free(void *array);
\ No newline at end of file
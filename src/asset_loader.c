@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "asset_loader.h"
+#include "asset_registry.h"
+#include "mesh.h"
+#include "mesh_stream.h"
+#include "texture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Meshes are added to the scene right away, empty, and loaded by a pool of
+// worker threads through the asset registry. A mesh job first tries the
+// baked cache, which holds the geometry and the texture. Otherwise it queues
+// a texture job for the PNG file, so another worker decodes it while the OBJ
+// file is parsed.
+// Workers only fill in the requests, poll_asset_loader moves what they
+// loaded into the meshes on the main thread, between frames, so the
+// renderer never sees a mesh change under it.
+///////////////////////////////////////////////////////////////////////////////
+#define MAX_LOADER_THREADS 8
+
+enum LOAD_JOB {
+  JOB_MESH,
+  JOB_TEXTURE
+};
+
+typedef struct {
+  int type;
+  int mesh_index;
+} load_job_t;
+
+typedef struct {
+  char obj_filepath[1024];
+  char png_filepath[1024];
+  mesh_load_callback_t callback;
+  void* user_data;
+  int state;                    // state of the mesh in the scene
+  mesh_t loaded;                // what the workers loaded, not yet published
+  bool is_geometry_loaded;
+  bool is_geometry_failed;
+  bool is_texture_loaded;       // set with a NULL texture when it failed
+} load_request_t;
+
+static load_request_t requests[MAX_NUM_MESHES];
+static bool is_requested[MAX_NUM_MESHES];
+
+// Jobs are queued in a ring that always has room for every job of every mesh
+static load_job_t jobs[MAX_NUM_MESHES * 2];
+static int jobs_head = 0;
+static int num_queued_jobs = 0;
+static int num_running_jobs = 0;
+
+static SDL_mutex* loader_mutex = NULL;
+static SDL_cond* job_queued = NULL;
+static SDL_cond* job_finished = NULL;
+static SDL_Thread* threads[MAX_LOADER_THREADS];
+static int num_threads = 0;
+static bool is_closing = false;
+
+// Both called with the mutex locked
+static void queue_job(int type, int mesh_index) {
+  int slot = (jobs_head + num_queued_jobs) % (MAX_NUM_MESHES * 2);
+  jobs[slot].type = type;
+  jobs[slot].mesh_index = mesh_index;
+  num_queued_jobs++;
+  SDL_CondSignal(job_queued);
+}
+
+static load_job_t take_job(void) {
+  load_job_t job = jobs[jobs_head];
+  jobs_head = (jobs_head + 1) % (MAX_NUM_MESHES * 2);
+  num_queued_jobs--;
+  return job;
+}
+
+// Give back a texture that was loaded but never published, the texture of a
+// baked mesh goes back with its geometry
+static void free_loaded_texture(load_request_t* request) {
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+  mesh.texture = request->loaded.texture;
+  mesh.texture_asset = request->loaded.texture_asset;
+  release_mesh_assets(&mesh);
+  request->is_texture_loaded = false;
+}
+
+static void run_mesh_job(load_request_t* request) {
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+
+  bool is_baked = acquire_baked_mesh(request->obj_filepath, request->png_filepath, &mesh);
+  if (!is_baked) {
+    SDL_LockMutex(loader_mutex);
+    queue_job(JOB_TEXTURE, (int)(request - requests));
+    SDL_UnlockMutex(loader_mutex);
+
+    acquire_obj_mesh(request->obj_filepath, &mesh);
+  }
+
+  SDL_LockMutex(loader_mutex);
+  request->loaded.faces = mesh.faces;
+  request->loaded.vertices = mesh.vertices;
+  request->loaded.normals = mesh.normals;
+  request->loaded.bounds_min = mesh.bounds_min;
+  request->loaded.bounds_max = mesh.bounds_max;
+  request->loaded.clusters = mesh.clusters;
+  request->loaded.cache = mesh.cache;
+  request->loaded.geometry_asset = mesh.geometry_asset;
+  request->is_geometry_loaded = mesh.faces != NULL;
+  request->is_geometry_failed = mesh.faces == NULL;
+  if (is_baked) {
+    request->loaded.texture = mesh.texture;
+    request->is_texture_loaded = true;
+  }
+  SDL_UnlockMutex(loader_mutex);
+}
+
+static void run_texture_job(load_request_t* request, texture_loader_t* texture_loader) {
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+  if (texture_loader != NULL) {
+    acquire_png_texture(request->png_filepath, texture_loader, &mesh);
+  }
+
+  SDL_LockMutex(loader_mutex);
+  request->loaded.texture = mesh.texture;
+  request->loaded.texture_asset = mesh.texture_asset;
+  request->is_texture_loaded = true;
+  SDL_UnlockMutex(loader_mutex);
+}
+
+static int loader_thread_main(void* data) {
+  (void)data;
+
+  // Every worker decodes PNG files with its own decoder
+  texture_loader_t* texture_loader = create_texture_loader();
+
+  for (;;) {
+    SDL_LockMutex(loader_mutex);
+    while (num_queued_jobs == 0 && !is_closing) {
+      SDL_CondWait(job_queued, loader_mutex);
+    }
+    if (is_closing) {
+      SDL_UnlockMutex(loader_mutex);
+      break;
+    }
+    load_job_t job = take_job();
+    num_running_jobs++;
+    SDL_UnlockMutex(loader_mutex);
+
+    if (job.type == JOB_MESH) {
+      run_mesh_job(&requests[job.mesh_index]);
+    } else {
+      run_texture_job(&requests[job.mesh_index], texture_loader);
+    }
+
+    SDL_LockMutex(loader_mutex);
+    num_running_jobs--;
+    SDL_CondBroadcast(job_finished);
+    SDL_UnlockMutex(loader_mutex);
+  }
+
+  free_texture_loader(texture_loader);
+  return 0;
+}
+
+static void destroy_loader_locks(void) {
+  SDL_DestroyCond(job_queued);
+  SDL_DestroyCond(job_finished);
+  SDL_DestroyMutex(loader_mutex);
+  job_queued = NULL;
+  job_finished = NULL;
+  loader_mutex = NULL;
+}
+
+// Start the worker threads, one per core when thread_count is zero. On
+// failure nothing is left created, so the loader can be started again.
+bool init_asset_loader(int thread_count) {
+  if (thread_count <= 0) {
+    thread_count = SDL_GetCPUCount();
+  }
+  thread_count = thread_count < 2 ? 2 : thread_count > MAX_LOADER_THREADS ? MAX_LOADER_THREADS : thread_count;
+
+  memset(is_requested, 0, sizeof(is_requested));
+  jobs_head = num_queued_jobs = num_running_jobs = 0;
+  is_closing = false;
+
+  loader_mutex = SDL_CreateMutex();
+  job_queued = SDL_CreateCond();
+  job_finished = SDL_CreateCond();
+  if (loader_mutex == NULL || job_queued == NULL || job_finished == NULL) {
+    fprintf(stderr, "Error starting the asset loader: %s\n", SDL_GetError());
+    destroy_loader_locks();
+    return false;
+  }
+
+  for (num_threads = 0; num_threads < thread_count; num_threads++) {
+    threads[num_threads] = SDL_CreateThread(loader_thread_main, "asset_loader", NULL);
+    if (threads[num_threads] == NULL) {
+      break;
+    }
+  }
+  if (num_threads == 0) {
+    fprintf(stderr, "Error starting the asset loader threads: %s\n", SDL_GetError());
+    destroy_loader_locks();
+    return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Add a mesh to the scene and queue it to be loaded, returns its index, which
+// is the handle to poll its state with, or -1 when it cannot be added. The
+// mesh is drawn as its parts are published by poll_asset_loader.
+///////////////////////////////////////////////////////////////////////////////
+int load_mesh_async(
+  const char* obj_filepath,
+  const char* png_filepath,
+  vec3_t scale,
+  vec3_t translation,
+  vec3_t rotation,
+  mesh_load_callback_t callback,
+  void* user_data
+) {
+  if (num_threads == 0) {
+    return -1;
+  }
+
+  int mesh_index = add_mesh(scale, translation, rotation);
+  if (mesh_index < 0) {
+    return -1;
+  }
+
+  load_request_t* request = &requests[mesh_index];
+  memset(request, 0, sizeof(load_request_t));
+  snprintf(request->obj_filepath, sizeof(request->obj_filepath), "%s", obj_filepath);
+  snprintf(request->png_filepath, sizeof(request->png_filepath), "%s", png_filepath);
+  request->callback = callback;
+  request->user_data = user_data;
+  request->state = MESH_LOAD_PENDING;
+
+  SDL_LockMutex(loader_mutex);
+  is_requested[mesh_index] = true;
+  queue_job(JOB_MESH, mesh_index);
+  SDL_UnlockMutex(loader_mutex);
+
+  return mesh_index;
+}
+
+// Meshes that were not loaded asynchronously are always done
+int get_mesh_load_state(int mesh_index) {
+  if (mesh_index < 0 || mesh_index >= MAX_NUM_MESHES || !is_requested[mesh_index]) {
+    return MESH_LOAD_DONE;
+  }
+  return requests[mesh_index].state;
+}
+
+bool is_asset_loading(void) {
+  for (int i = 0; i < MAX_NUM_MESHES; i++) {
+    if (is_requested[i] && (requests[i].state == MESH_LOAD_PENDING || requests[i].state == MESH_LOAD_GEOMETRY)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Move whatever the workers finished loading into the meshes of the scene,
+// then call the callbacks of the meshes whose state changed. Returns how
+// many meshes changed, to be called on the main thread between frames.
+///////////////////////////////////////////////////////////////////////////////
+int poll_asset_loader(void) {
+  int changed[MAX_NUM_MESHES];
+  int num_changed = 0;
+
+  if (loader_mutex == NULL) {
+    return 0;
+  }
+
+  SDL_LockMutex(loader_mutex);
+  for (int i = 0; i < MAX_NUM_MESHES; i++) {
+    load_request_t* request = &requests[i];
+    mesh_t* mesh = get_mesh(i);
+    int state = request->state;
+
+    if (!is_requested[i]) {
+      continue;
+    }
+
+    if (request->is_geometry_loaded) {
+      mesh->faces = request->loaded.faces;
+      mesh->vertices = request->loaded.vertices;
+      mesh->normals = request->loaded.normals;
+      mesh->bounds_min = request->loaded.bounds_min;
+      mesh->bounds_max = request->loaded.bounds_max;
+      mesh->clusters = request->loaded.clusters;
+      mesh->cache = request->loaded.cache;
+      mesh->geometry_asset = request->loaded.geometry_asset;
+      request->is_geometry_loaded = false;
+      state = MESH_LOAD_GEOMETRY;
+      if (!open_mesh_stream(mesh)) {
+        release_mesh_assets(mesh);
+        state = MESH_LOAD_FAILED;
+      }
+    }
+    if (request->is_geometry_failed) {
+      request->is_geometry_failed = false;
+      state = MESH_LOAD_FAILED;
+    }
+
+    // The texture may arrive before the geometry, and is kept until then
+    if (request->is_texture_loaded && state == MESH_LOAD_GEOMETRY) {
+      mesh->texture = request->loaded.texture;
+      mesh->texture_asset = request->loaded.texture_asset;
+      request->is_texture_loaded = false;
+      state = MESH_LOAD_DONE;
+    }
+    if (state == MESH_LOAD_FAILED && request->is_texture_loaded) {
+      free_loaded_texture(request);
+    }
+
+    if (state != request->state) {
+      request->state = state;
+      changed[num_changed++] = i;
+    }
+  }
+  SDL_UnlockMutex(loader_mutex);
+
+  for (int i = 0; i < num_changed; i++) {
+    load_request_t* request = &requests[changed[i]];
+    if (request->callback != NULL) {
+      request->callback(changed[i], request->state, request->user_data);
+    }
+  }
+  return num_changed;
+}
+
+// Wait for every queued mesh to load, and publish them
+void finish_asset_loading(void) {
+  if (loader_mutex == NULL) {
+    return;
+  }
+
+  SDL_LockMutex(loader_mutex);
+  while (num_queued_jobs > 0 || num_running_jobs > 0) {
+    SDL_CondWait(job_finished, loader_mutex);
+  }
+  SDL_UnlockMutex(loader_mutex);
+
+  poll_asset_loader();
+}
+
+// Stop the workers once their current jobs are done, dropping the queued
+// jobs, and release whatever they loaded that was never published
+void destroy_asset_loader(void) {
+  if (loader_mutex == NULL) {
+    return;
+  }
+
+  SDL_LockMutex(loader_mutex);
+  is_closing = true;
+  SDL_CondBroadcast(job_queued);
+  SDL_UnlockMutex(loader_mutex);
+
+  for (int i = 0; i < num_threads; i++) {
+    SDL_WaitThread(threads[i], NULL);
+  }
+  num_threads = 0;
+
+  for (int i = 0; i < MAX_NUM_MESHES; i++) {
+    load_request_t* request = &requests[i];
+    if (!is_requested[i]) {
+      continue;
+    }
+    if (request->is_geometry_loaded) {
+      mesh_t mesh = request->loaded;
+      mesh.texture = NULL;
+      mesh.texture_asset = NULL;
+      release_mesh_assets(&mesh);
+    }
+    if (request->is_texture_loaded) {
+      free_loaded_texture(request);
+    }
+    is_requested[i] = false;
+  }
+
+  destroy_loader_locks();
+}
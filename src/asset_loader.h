@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "vector.h"
+
+// Progress of a mesh loaded in the background. Its geometry is drawn as soon
+// as it is loaded, untextured until the texture is loaded too.
+enum MESH_LOAD_STATE {
+  MESH_LOAD_PENDING,       // nothing is loaded yet
+  MESH_LOAD_GEOMETRY,      // the geometry is loaded, the texture is not
+  MESH_LOAD_DONE,          // both are loaded, or the texture failed to load
+  MESH_LOAD_FAILED         // the geometry failed to load
+};
+
+// Called on the main thread by poll_asset_loader whenever the load state of
+// a mesh changes
+typedef void (*mesh_load_callback_t)(int mesh_index, int state, void* user_data);
+
+bool init_asset_loader(int num_threads);
+void destroy_asset_loader(void);
+
+int load_mesh_async(
+  const char* obj_filepath,
+  const char* png_filepath,
+  vec3_t scale,
+  vec3_t translation,
+  vec3_t rotation,
+  mesh_load_callback_t callback,
+  void* user_data
+);
+
+int get_mesh_load_state(int mesh_index);
+bool is_asset_loading(void);
+
+int poll_asset_loader(void);
+void finish_asset_loading(void);
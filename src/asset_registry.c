@@ -0,0 +1,452 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "asset_registry.h"
+#include "array.h"
+#include "file_map.h"
+#include "mesh_cache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Every texture and mesh geometry is loaded once and shared by all the
+// meshes that use it. An asset is found by the paths of its files, and a
+// texture also by the checksum of its PNG file, so copies of an image under
+// other names are decoded once too. Meshes hold a reference to their assets
+// and release it when they are freed. Assets no mesh uses stay cached, so
+// loading them again is free, until the cache goes over its budget and the
+// least recently used ones are freed.
+///////////////////////////////////////////////////////////////////////////////
+#define DEFAULT_ASSET_CACHE_BUDGET ((size_t)256 << 20)
+#define MAX_ASSET_SOURCES 3
+
+enum ASSET_TYPE {
+  ASSET_TEXTURE,        // a decoded PNG file
+  ASSET_OBJ_MESH,       // the geometry of a parsed OBJ file
+  ASSET_BAKED_MESH      // the geometry and texture of a baked cache
+};
+
+// A file an asset was loaded from, with its size and time when it was
+// loaded, or a size of -1 when it did not exist
+typedef struct {
+  char filepath[1024];
+  int64_t size;
+  int64_t mtime;
+} asset_source_t;
+
+struct asset {
+  int type;
+  asset_source_t sources[MAX_ASSET_SOURCES];
+  int num_sources;
+  uint64_t checksum;    // of the PNG file of a texture
+  int references;
+  int last_used;        // when the last reference was released
+  bool is_loading;      // being loaded by another thread, wait for it
+  bool is_stale;        // its files changed, so it is not shared any more
+  size_t bytes;
+  mesh_t data;          // geometry and texture, owned by the asset
+  struct asset* next;
+};
+
+static struct asset* assets = NULL;
+static size_t cache_budget = DEFAULT_ASSET_CACHE_BUDGET;
+static int release_clock = 0;
+static asset_registry_stats_t stats;
+
+// Meshes and textures are loaded on the asset loader threads as well, the
+// lock is created by whichever thread gets to the registry first
+static SDL_SpinLock create_lock = 0;
+static SDL_mutex* registry_mutex = NULL;
+static SDL_cond* asset_loaded = NULL;
+
+static void lock_registry(void) {
+  SDL_AtomicLock(&create_lock);
+  if (registry_mutex == NULL) {
+    registry_mutex = SDL_CreateMutex();
+    asset_loaded = SDL_CreateCond();
+  }
+  SDL_AtomicUnlock(&create_lock);
+  SDL_LockMutex(registry_mutex);
+}
+
+static void unlock_registry(void) {
+  SDL_UnlockMutex(registry_mutex);
+}
+
+static void set_source(asset_source_t* source, const char* filepath) {
+  snprintf(source->filepath, sizeof(source->filepath), "%s", filepath);
+  if (!get_file_stamp(filepath, &source->size, &source->mtime)) {
+    source->size = -1;
+    source->mtime = 0;
+  }
+}
+
+static bool is_source_current(const asset_source_t* source) {
+  int64_t size = -1;
+  int64_t mtime = 0;
+  get_file_stamp(source->filepath, &size, &mtime);
+  return size == source->size && mtime == source->mtime;
+}
+
+static bool is_asset_current(const struct asset* asset) {
+  for (int i = 0; i < asset->num_sources; i++) {
+    if (!is_source_current(&asset->sources[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool has_sources(const struct asset* asset, int type, const char** filepaths, int num_filepaths) {
+  if (asset->type != type || asset->num_sources != num_filepaths) {
+    return false;
+  }
+  for (int i = 0; i < num_filepaths; i++) {
+    if (strcmp(asset->sources[i].filepath, filepaths[i]) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static size_t get_asset_size(const struct asset* asset) {
+  if (asset->type == ASSET_BAKED_MESH) {
+    return asset->data.cache.size;
+  }
+  if (asset->type == ASSET_TEXTURE) {
+    return asset->data.texture != NULL ? get_texture_pixel_count(asset->data.texture) * sizeof(uint32_t) : 0;
+  }
+  return
+    (size_t)array_length(asset->data.faces) * sizeof(face_t) +
+    (size_t)array_length(asset->data.vertices) * sizeof(vec3_t) +
+    (size_t)array_length(asset->data.normals) * sizeof(vec3_t);
+}
+
+// The functions below are called with the registry locked
+static void remove_asset(struct asset* asset) {
+  for (struct asset** link = &assets; *link != NULL; link = &(*link)->next) {
+    if (*link == asset) {
+      *link = asset->next;
+      break;
+    }
+  }
+  stats.num_assets--;
+  stats.total_bytes -= asset->bytes;
+  free_mesh(&asset->data);
+  free(asset);
+}
+
+// Free the least recently used assets no mesh holds until the cache fits
+// its budget. Stale assets can never be shared again, so they go first.
+static void trim_asset_cache(void) {
+  for (;;) {
+    struct asset* oldest = NULL;
+    for (struct asset* asset = assets; asset != NULL; asset = asset->next) {
+      if (asset->references > 0 || asset->is_loading) {
+        continue;
+      }
+      if (asset->is_stale) {
+        oldest = asset;
+        break;
+      }
+      if (oldest == NULL || asset->last_used < oldest->last_used) {
+        oldest = asset;
+      }
+    }
+    if (oldest == NULL || (!oldest->is_stale && stats.total_bytes <= cache_budget)) {
+      return;
+    }
+    remove_asset(oldest);
+    stats.evicted++;
+  }
+}
+
+size_t get_asset_cache_budget(void) {
+  return cache_budget;
+}
+
+// A smaller budget frees the cached assets that no longer fit right away
+void set_asset_cache_budget(size_t bytes) {
+  lock_registry();
+  cache_budget = bytes;
+  trim_asset_cache();
+  unlock_registry();
+}
+
+static void add_reference(struct asset* asset) {
+  if (asset->references++ == 0) {
+    stats.used_assets++;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find the asset of these files and take a reference to it, or add an empty
+// one for the caller to load, with is_loading set, when there is none. An
+// asset whose files changed since it was loaded is left to the meshes that
+// still hold it, and a new one is loaded.
+///////////////////////////////////////////////////////////////////////////////
+static struct asset* find_or_add_asset(int type, const char** filepaths, int num_filepaths, bool* is_found) {
+  for (;;) {
+    struct asset* found = NULL;
+    for (struct asset* asset = assets; asset != NULL; asset = asset->next) {
+      if (!asset->is_stale && has_sources(asset, type, filepaths, num_filepaths)) {
+        found = asset;
+        break;
+      }
+    }
+
+    if (found != NULL && found->is_loading) {
+      SDL_CondWait(asset_loaded, registry_mutex);
+      continue;
+    }
+    if (found != NULL && is_asset_current(found)) {
+      add_reference(found);
+      stats.shared++;
+      *is_found = true;
+      return found;
+    }
+    if (found != NULL) {
+      found->is_stale = true;
+      trim_asset_cache();
+    }
+    break;
+  }
+
+  struct asset* asset = (struct asset*)calloc(1, sizeof(struct asset));
+  if (asset == NULL) {
+    return NULL;
+  }
+  asset->type = type;
+  asset->num_sources = num_filepaths;
+  for (int i = 0; i < num_filepaths; i++) {
+    set_source(&asset->sources[i], filepaths[i]);
+  }
+  asset->is_loading = true;
+  add_reference(asset);
+  asset->next = assets;
+  assets = asset;
+  stats.num_assets++;
+  *is_found = false;
+  return asset;
+}
+
+// Publish an asset the caller loaded, or drop it when it failed to load
+static struct asset* finish_loading(struct asset* asset, bool is_loaded) {
+  asset->is_loading = false;
+  SDL_CondBroadcast(asset_loaded);
+
+  if (!is_loaded) {
+    stats.used_assets--;
+    remove_asset(asset);
+    return NULL;
+  }
+  asset->bytes = get_asset_size(asset);
+  stats.total_bytes += asset->bytes;
+  stats.loaded++;
+  trim_asset_cache();
+  return asset;
+}
+
+static void release_asset(struct asset* asset) {
+  if (asset == NULL) {
+    return;
+  }
+  lock_registry();
+  if (--asset->references == 0) {
+    stats.used_assets--;
+    asset->last_used = ++release_clock;
+    trim_asset_cache();
+  }
+  unlock_registry();
+}
+
+// Point a mesh at the geometry of an asset, which keeps owning it
+static void share_geometry(const struct asset* asset, mesh_t* mesh) {
+  mesh->faces = asset->data.faces;
+  mesh->vertices = asset->data.vertices;
+  mesh->normals = asset->data.normals;
+  mesh->bounds_min = asset->data.bounds_min;
+  mesh->bounds_max = asset->data.bounds_max;
+  mesh->clusters = asset->data.clusters;
+  mesh->cache = asset->data.cache;
+  mesh->geometry_asset = (struct asset*)asset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Share the geometry and texture of the baked cache of a mesh, false when
+// the mesh has no cache that is up to date
+///////////////////////////////////////////////////////////////////////////////
+bool acquire_baked_mesh(const char* obj_filepath, const char* png_filepath, mesh_t* mesh) {
+  char cache_filepath[1024];
+  get_mesh_cache_filepath(obj_filepath, cache_filepath, sizeof(cache_filepath));
+  const char* filepaths[] = { cache_filepath, obj_filepath, png_filepath };
+
+  bool is_found;
+  lock_registry();
+  struct asset* asset = find_or_add_asset(ASSET_BAKED_MESH, filepaths, 3, &is_found);
+  unlock_registry();
+  if (asset == NULL) {
+    return false;
+  }
+
+  if (!is_found) {
+    bool is_loaded = load_baked_mesh(cache_filepath, obj_filepath, png_filepath, &asset->data);
+    lock_registry();
+    asset = finish_loading(asset, is_loaded);
+    unlock_registry();
+    if (asset == NULL) {
+      return false;
+    }
+  }
+
+  share_geometry(asset, mesh);
+  mesh->texture = asset->data.texture;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Share the geometry of an OBJ file, parsing it if it is not loaded yet
+///////////////////////////////////////////////////////////////////////////////
+bool acquire_obj_mesh(const char* obj_filepath, mesh_t* mesh) {
+  const char* filepaths[] = { obj_filepath };
+
+  bool is_found;
+  lock_registry();
+  struct asset* asset = find_or_add_asset(ASSET_OBJ_MESH, filepaths, 1, &is_found);
+  unlock_registry();
+  if (asset == NULL) {
+    return false;
+  }
+
+  if (!is_found) {
+    load_mesh_obj_data(obj_filepath, &asset->data);
+    compute_mesh_normals_and_bounds(&asset->data);
+    lock_registry();
+    asset = finish_loading(asset, asset->data.faces != NULL);
+    unlock_registry();
+    if (asset == NULL) {
+      return false;
+    }
+  }
+
+  share_geometry(asset, mesh);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Share the texture of a PNG file, decoding it with the given loader, or the
+// default one when it is NULL, only if neither the file nor a file with the
+// same bytes is loaded yet
+///////////////////////////////////////////////////////////////////////////////
+bool acquire_png_texture(const char* png_filepath, texture_loader_t* loader, mesh_t* mesh) {
+  const char* filepaths[] = { png_filepath };
+
+  bool is_found;
+  lock_registry();
+  struct asset* asset = find_or_add_asset(ASSET_TEXTURE, filepaths, 1, &is_found);
+  unlock_registry();
+  if (asset == NULL) {
+    return false;
+  }
+
+  if (!is_found) {
+    file_map_t file;
+    if (map_file(png_filepath, &file)) {
+      asset->checksum = get_data_checksum(file.data, file.size);
+      unmap_file(&file);
+    }
+
+    struct asset* copy = NULL;
+    lock_registry();
+    for (struct asset* other = assets; other != NULL; other = other->next) {
+      if (
+        other != asset && other->type == ASSET_TEXTURE && !other->is_loading && !other->is_stale &&
+        other->checksum == asset->checksum && other->sources[0].size == asset->sources[0].size
+      ) {
+        copy = other;
+        break;
+      }
+    }
+    if (copy != NULL) {
+      add_reference(copy);
+      stats.shared++;
+      finish_loading(asset, false);
+    }
+    unlock_registry();
+
+    if (copy != NULL) {
+      asset = copy;
+    } else {
+      asset->data.texture = loader != NULL
+        ? load_png_texture_with(loader, png_filepath)
+        : load_png_texture(png_filepath);
+      lock_registry();
+      asset = finish_loading(asset, asset->data.texture != NULL);
+      unlock_registry();
+      if (asset == NULL) {
+        return false;
+      }
+    }
+  }
+
+  mesh->texture = asset->data.texture;
+  mesh->texture_asset = asset;
+  return true;
+}
+
+// Share the baked cache of a mesh when it is up to date, else its OBJ and
+// PNG files
+void acquire_mesh(const char* obj_filepath, const char* png_filepath, mesh_t* mesh) {
+  if (!acquire_baked_mesh(obj_filepath, png_filepath, mesh)) {
+    acquire_obj_mesh(obj_filepath, mesh);
+    acquire_png_texture(png_filepath, NULL, mesh);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Drop the references of a mesh to its assets, and clear what it shared
+// from them. Whatever the mesh does not share is left to the caller.
+///////////////////////////////////////////////////////////////////////////////
+void release_mesh_assets(mesh_t* mesh) {
+  if (mesh->geometry_asset != NULL) {
+    // The texture of a baked mesh belongs to its geometry
+    if (mesh->texture_asset == NULL && mesh->geometry_asset->type == ASSET_BAKED_MESH) {
+      mesh->texture = NULL;
+    }
+    release_asset(mesh->geometry_asset);
+    mesh->geometry_asset = NULL;
+    mesh->faces = NULL;
+    mesh->vertices = NULL;
+    mesh->normals = NULL;
+    mesh->clusters = NULL;
+    memset(&mesh->cache, 0, sizeof(mesh->cache));
+  }
+  if (mesh->texture_asset != NULL) {
+    release_asset(mesh->texture_asset);
+    mesh->texture_asset = NULL;
+    mesh->texture = NULL;
+  }
+}
+
+asset_registry_stats_t get_asset_registry_stats(void) {
+  asset_registry_stats_t result;
+  lock_registry();
+  result = stats;
+  result.budget_bytes = cache_budget;
+  unlock_registry();
+  return result;
+}
+
+// Free every asset, once no mesh and no loader thread uses them any more
+void destroy_asset_registry(void) {
+  while (assets != NULL) {
+    remove_asset(assets);
+  }
+  stats.used_assets = 0;
+
+  SDL_DestroyCond(asset_loaded);
+  SDL_DestroyMutex(registry_mutex);
+  asset_loaded = NULL;
+  registry_mutex = NULL;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mesh.h"
+#include "texture.h"
+
+typedef struct {
+  int num_assets;           // assets in memory, in use or cached
+  int used_assets;          // assets held by at least one mesh
+  size_t total_bytes;
+  size_t budget_bytes;
+  int loaded;               // assets loaded from their files
+  int shared;               // requests served by an asset already in memory
+  int evicted;              // cached assets freed to stay in the budget
+} asset_registry_stats_t;
+
+size_t get_asset_cache_budget(void);
+void set_asset_cache_budget(size_t bytes);
+
+bool acquire_baked_mesh(const char* obj_filepath, const char* png_filepath, mesh_t* mesh);
+bool acquire_obj_mesh(const char* obj_filepath, mesh_t* mesh);
+bool acquire_png_texture(const char* png_filepath, texture_loader_t* loader, mesh_t* mesh);
+void acquire_mesh(const char* obj_filepath, const char* png_filepath, mesh_t* mesh);
+void release_mesh_assets(mesh_t* mesh);
+
+asset_registry_stats_t get_asset_registry_stats(void);
+void destroy_asset_registry(void);
@@ -66,6 +66,21 @@ void init_frustum_planes(float fov_x, float fov_y, float z_near, float z_far) {
 	frustum_planes[FAR_FRUSTUM_PLANE].normal.z = -1;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// A sphere in camera space is in view unless it lies entirely on the outer
+// side of one of the frustum planes
+///////////////////////////////////////////////////////////////////////////////
+bool is_sphere_in_frustum(vec3_t center, float radius) {
+	for (int i = 0; i < NUM_PLANES; i++) {
+		vec3_t normal = frustum_planes[i].normal;
+		float distance = vec3_dot(vec3_sub(center, frustum_planes[i].point), normal) / vec3_length(&normal);
+		if (distance < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
 polygon_t create_polygon_from_triangle(
 	vec3_t v0, vec3_t v1, vec3_t v2,
 	tex2_t t0, tex2_t t1, tex2_t t2
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "vector.h"
 #include "triangle.h"
 
@@ -32,6 +34,8 @@ void init_frustum_planes(
     float z_near, float z_far
 );
 
+bool is_sphere_in_frustum(vec3_t center, float radius);
+
 polygon_t create_polygon_from_triangle(
     vec3_t v0, vec3_t v1, vec3_t v2,
     tex2_t t0, tex2_t t1, tex2_t t2
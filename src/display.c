@@ -1,21 +1,79 @@
 #include "display.h"
+#include "frame_sink.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <SDL2/SDL.h>
 
+// Number of streaming textures we rotate through, so the texture being
+// presented is never the one we are rasterizing into
+#define NUM_COLOR_BUFFER_TEXTURES 2
+
 static int window_width = 800;
 static int window_height = 600;
 
+// Size of the area that is rasterized, the top left corner of the window
+// sized buffers. It is smaller than the window when the render scale is
+// lowered, and the image is stretched over the whole window when presented.
+static int render_width = 800;
+static int render_height = 600;
+
 static float* z_buffer = NULL;
+
+// color_buffer points straight at the pixels of the locked streaming texture,
+// or at color_buffer_memory when the driver refuses to lock the texture.
+// The pitch is the number of pixels between two rows of the color_buffer.
 static uint32_t *color_buffer = NULL;
+static uint32_t *color_buffer_memory = NULL;
+static int color_buffer_pitch = 0;
+
+// Requested window size, zero means the size of the full screen display mode
+static int requested_window_width = 0;
+static int requested_window_height = 0;
+
+// Refresh rate of the display, and whether presents wait for its vblank
+static int refresh_rate = FPS;
+static bool is_vsync_requested = false;
+
+// In headless mode there is no SDL window. Finished frames are handed to the
+// frame callback and to the frame sink when one is open, in every mode.
+static bool is_headless = false;
+static frame_callback_t frame_callback = NULL;
+static void* frame_callback_data = NULL;
 
 static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
-static SDL_Texture *color_buffer_texture = NULL;
+static SDL_Texture *color_buffer_textures[NUM_COLOR_BUFFER_TEXTURES] = { NULL };
+static int color_buffer_texture_index = 0;
+static bool is_color_buffer_locked = false;
 
 static enum CULL_METHOD cull_method = CULL_BACKFACE;
 static enum RENDER_METHOD render_method = RENDER_WIRE_VERTEX;
+static enum PRESENT_METHOD present_method = PRESENT_STREAMING;
+static enum INTERLACE_METHOD interlace_method = INTERLACE_NONE;
+
+// Interlaced frames only rasterize the pixels of the current parity. The
+// others still hold the previous frame, which was drawn with the opposite
+// parity, and are reconstructed from it or from their rasterized neighbors.
+static int interlace_parity = 0;
+static enum INTERLACE_HISTORY interlace_history = HISTORY_MOVED;
+
+// Largest depth difference at which a pixel of the previous frame is still
+// considered part of the same surface as its rasterized neighbors
+#define INTERLACE_DEPTH_TOLERANCE 0.01f
+
+// Screen rectangle with exclusive x1 and y1, empty when x0 >= x1 or y0 >= y1
+typedef struct {
+  int x0, y0;
+  int x1, y1;
+} dirty_rect_t;
+
+// Area touched by the frame being drawn and by the previously presented one.
+// In PRESENT_DIRTY_RECT only their union is cleared, redrawn and uploaded.
+static dirty_rect_t dirty_rect = { 0, 0, 0, 0 };
+static dirty_rect_t previous_dirty_rect = { 0, 0, 0, 0 };
+static bool is_full_redraw = true;
 
 int get_window_width(void) {
   return window_width;
@@ -25,10 +83,87 @@ int get_window_height(void) {
   return window_height;
 }
 
+void set_window_size(int width, int height) {
+  requested_window_width = width;
+  requested_window_height = height;
+}
+
+int get_render_width(void) {
+  return render_width;
+}
+
+int get_render_height(void) {
+  return render_height;
+}
+
+// Rasterize at a fraction of the window resolution, from 0 to 1
+void set_render_scale(float scale) {
+  int width = (int)(window_width * scale + 0.5f);
+  int height = (int)(window_height * scale + 0.5f);
+
+  width = width < 1 ? 1 : (width > window_width ? window_width : width);
+  height = height < 1 ? 1 : (height > window_height ? window_height : height);
+
+  if (width != render_width || height != render_height) {
+    render_width = width;
+    render_height = height;
+    // Everything drawn so far is at the old scale
+    is_full_redraw = true;
+  }
+}
+
+int get_refresh_rate(void) {
+  return refresh_rate;
+}
+
+void set_vsync(bool enabled) {
+  is_vsync_requested = enabled;
+}
+
+// Switch waiting for the vblank on and off on a live renderer
+void set_vsync_active(bool active) {
+  if (renderer != NULL) {
+    SDL_RenderSetVSync(renderer, active ? 1 : 0);
+  }
+}
+
+void set_headless(bool headless) {
+  is_headless = headless;
+}
+
+bool is_display_headless(void) {
+  return is_headless;
+}
+
+void set_frame_callback(frame_callback_t callback, void* user_data) {
+  frame_callback = callback;
+  frame_callback_data = user_data;
+}
+
+int get_render_method(void) {
+  return render_method;
+}
+
+int get_cull_method(void) {
+  return cull_method;
+}
+
 void set_render_method(int method) {
   render_method = method;
 }
 
+void set_present_method(int method) {
+  present_method = method;
+}
+
+int get_interlace_method(void) {
+  return interlace_method;
+}
+
+void set_interlace_method(int method) {
+  interlace_method = method;
+}
+
 void set_cull_method(int method) {
   cull_method = method;
 }
@@ -64,8 +199,262 @@ bool should_render_vertex(void) {
  return render_method == RENDER_WIRE_VERTEX;
 }
 
+// Lock the current streaming texture so the rasterizer writes directly into it
+static bool lock_color_buffer(void) {
+  if (color_buffer_memory != NULL) {
+    color_buffer = color_buffer_memory;
+    color_buffer_pitch = window_width;
+    return true;
+  }
+
+  void* pixels = NULL;
+  int pitch = 0;
+
+  if (SDL_LockTexture(color_buffer_textures[color_buffer_texture_index], NULL, &pixels, &pitch) != 0) {
+    return false;
+  }
+
+  color_buffer = (uint32_t*)pixels;
+  color_buffer_pitch = pitch / (int)sizeof(uint32_t);
+  is_color_buffer_locked = true;
+
+  return true;
+}
+
+// Point the color buffer at the next frame, falling back to a system memory
+// buffer uploaded every frame if the streaming texture cannot be locked
+static bool acquire_color_buffer(void) {
+  if (lock_color_buffer()) {
+    return true;
+  }
+
+  color_buffer_memory = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
+
+  if (color_buffer_memory == NULL) {
+    fprintf(stderr, "Error allocating memory to color_buffer. \n");
+    return false;
+  }
+
+  return lock_color_buffer();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Dirty rectangle tracking
+///////////////////////////////////////////////////////////////////////////////
+static bool is_rect_empty(dirty_rect_t rect) {
+  return rect.x0 >= rect.x1 || rect.y0 >= rect.y1;
+}
+
+static dirty_rect_t union_rect(dirty_rect_t a, dirty_rect_t b) {
+  if (is_rect_empty(a)) return b;
+  if (is_rect_empty(b)) return a;
+
+  dirty_rect_t result = {
+    a.x0 < b.x0 ? a.x0 : b.x0,
+    a.y0 < b.y0 ? a.y0 : b.y0,
+    a.x1 > b.x1 ? a.x1 : b.x1,
+    a.y1 > b.y1 ? a.y1 : b.y1
+  };
+  return result;
+}
+
+// Mark the area from (x0,y0) to (x1,y1), both inclusive, as drawn this frame
+void mark_dirty_rect(int x0, int y0, int x1, int y1) {
+  dirty_rect_t rect = {
+    x0 < 0 ? 0 : x0,
+    y0 < 0 ? 0 : y0,
+    x1 >= render_width ? render_width : x1 + 1,
+    y1 >= render_height ? render_height : y1 + 1
+  };
+
+  if (!is_rect_empty(rect)) {
+    dirty_rect = union_rect(dirty_rect, rect);
+  }
+}
+
+// Force the next frame to clear, redraw and upload the whole screen
+void invalidate_color_buffer(void) {
+  is_full_redraw = true;
+}
+
+// The area of the color buffer that has to be cleared, redrawn and uploaded
+static dirty_rect_t get_redraw_rect(void) {
+  if (present_method != PRESENT_DIRTY_RECT || is_full_redraw) {
+    dirty_rect_t full_screen = { 0, 0, render_width, render_height };
+    return full_screen;
+  }
+  return union_rect(dirty_rect, previous_dirty_rect);
+}
+
+static void end_dirty_frame(void) {
+  previous_dirty_rect = dirty_rect;
+  dirty_rect.x0 = dirty_rect.y0 = dirty_rect.x1 = dirty_rect.y1 = 0;
+  is_full_redraw = false;
+
+  // The next frame rasterizes the pixels this one reconstructed
+  interlace_parity ^= 1;
+  interlace_history = HISTORY_MOVED;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Interlaced rendering: each frame rasterizes half of the pixels, either a
+// checkerboard or every other scanline, alternating between the two halves
+///////////////////////////////////////////////////////////////////////////////
+// Without a previous frame to reconstruct from, every pixel is rasterized
+static enum INTERLACE_METHOD get_frame_interlace_method(void) {
+  return is_full_redraw ? INTERLACE_NONE : interlace_method;
+}
+
+bool is_row_rasterized(int y) {
+  return get_frame_interlace_method() != INTERLACE_SCANLINE || ((y + interlace_parity) & 1) == 0;
+}
+
+// First pixel at or after x on row y that is rasterized in this frame
+int get_first_rasterized_x(int x, int y) {
+  if (get_frame_interlace_method() == INTERLACE_CHECKERBOARD && ((x + y + interlace_parity) & 1) != 0) {
+    return x + 1;
+  }
+  return x;
+}
+
+// Distance between two rasterized pixels of the same row
+int get_rasterized_x_step(void) {
+  return get_frame_interlace_method() == INTERLACE_CHECKERBOARD ? 2 : 1;
+}
+
+// Tell how the frame being drawn differs from the previous one
+void set_interlace_history(int history) {
+  interlace_history = history;
+}
+
+// Average of each 8 bit channel of two colors, without unpacking them
+static uint32_t average_color(uint32_t a, uint32_t b) {
+  return (a & b) + (((a ^ b) & 0xFEFEFEFE) >> 1);
+}
+
+static int clamp_int(int value, int min, int max) {
+  return value < min ? min : (value > max ? max : value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fill in the pixels that were not rasterized this frame. The previous frame
+// is kept where its depth matches the rasterized neighbors, so still parts of
+// the image keep their full resolution. Elsewhere the neighbors are averaged.
+///////////////////////////////////////////////////////////////////////////////
+static void reconstruct_interlaced_frame(void) {
+  // Nothing was skipped, or the skipped pixels already show exactly this scene
+  if (get_frame_interlace_method() == INTERLACE_NONE || interlace_history == HISTORY_STILL) {
+    return;
+  }
+
+  // Outside of the area drawn by this and the previous frame there is only the
+  // background, which the skipped pixels already show
+  dirty_rect_t rect = union_rect(dirty_rect, previous_dirty_rect);
+
+  bool is_checkerboard = interlace_method == INTERLACE_CHECKERBOARD;
+  int x_step = get_rasterized_x_step();
+
+  for (int y = rect.y0; y < rect.y1; y++) {
+    if (!is_checkerboard && is_row_rasterized(y)) {
+      continue;
+    }
+
+    int y_above = clamp_int(y - 1, 0, render_height - 1);
+    int y_below = clamp_int(y + 1, 0, render_height - 1);
+
+    uint32_t* row = &color_buffer[color_buffer_pitch * y];
+    uint32_t* row_above = &color_buffer[color_buffer_pitch * y_above];
+    uint32_t* row_below = &color_buffer[color_buffer_pitch * y_below];
+    float* z_row = &z_buffer[window_width * y];
+    float* z_row_above = &z_buffer[window_width * y_above];
+    float* z_row_below = &z_buffer[window_width * y_below];
+
+    // Start at the first pixel that was skipped on this row
+    int x_start = rect.x0;
+    if (is_checkerboard && get_first_rasterized_x(rect.x0, y) == rect.x0) {
+      x_start++;
+    }
+
+    for (int x = x_start; x < rect.x1; x += x_step) {
+      // Checkerboard pixels also have rasterized neighbors on their own row
+      int x_left = x;
+      int x_right = x;
+      if (is_checkerboard) {
+        x_left = x > 0 ? x - 1 : clamp_int(x + 1, 0, render_width - 1);
+        x_right = x < render_width - 1 ? x + 1 : clamp_int(x - 1, 0, render_width - 1);
+      }
+
+      float z = z_row[x];
+      float z_above = z_row_above[x];
+      float z_below = z_row_below[x];
+      float z_left = z_row[x_left];
+      float z_right = z_row[x_right];
+
+      if (interlace_history == HISTORY_VIEW_CHANGED) {
+        // The background is drawn in screen space and does not move
+        if (z == 1.0f && z_above == 1.0f && z_below == 1.0f && z_left == 1.0f && z_right == 1.0f) {
+          continue;
+        }
+      } else {
+        float z_min = z_above < z_below ? z_above : z_below;
+        float z_max = z_above > z_below ? z_above : z_below;
+        if (is_checkerboard) {
+          float z_min_row = z_left < z_right ? z_left : z_right;
+          float z_max_row = z_left > z_right ? z_left : z_right;
+          z_min = z_min < z_min_row ? z_min : z_min_row;
+          z_max = z_max > z_max_row ? z_max : z_max_row;
+        }
+
+        // Same surface as the neighbors, keep the pixel of the previous frame
+        if (z >= z_min - INTERLACE_DEPTH_TOLERANCE && z <= z_max + INTERLACE_DEPTH_TOLERANCE) {
+          continue;
+        }
+      }
+
+      uint32_t color = average_color(row_above[x], row_below[x]);
+      if (is_checkerboard) {
+        color = average_color(color, average_color(row[x_left], row[x_right]));
+      }
+      row[x] = color;
+    }
+  }
+}
+
+// Initialize the buffers for offscreen rendering without any SDL video
+static bool initialize_headless(void) {
+  // Only the timer and event subsystems are needed, video is never touched
+  if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) != 0) {
+    fprintf(stderr, "Error initializing SDL.\n");
+    return false;
+  }
+
+  if (requested_window_width > 0 && requested_window_height > 0) {
+    window_width = requested_window_width;
+    window_height = requested_window_height;
+  }
+
+  z_buffer = (float*)malloc(sizeof(float) * window_width * window_height);
+  color_buffer_memory = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
+
+  if (z_buffer == NULL || color_buffer_memory == NULL) {
+    fprintf(stderr, "Error allocating memory to color_buffer and z_buffer. \n");
+    return false;
+  }
+
+  color_buffer = color_buffer_memory;
+  color_buffer_pitch = window_width;
+  render_width = window_width;
+  render_height = window_height;
+
+  return true;
+}
+
 // Initialize SDL Window and Renderer
 bool initialize_window(void) {
+  if (is_headless) {
+    return initialize_headless();
+  }
+
   int is_SDL_initialized = SDL_Init(SDL_INIT_EVERYTHING);
 
   if (is_SDL_initialized != 0) {
@@ -73,23 +462,33 @@ bool initialize_window(void) {
     return false;
   }
 
-  // Use SDL to query what is the fullscreen max. width and height
+  bool is_fullscreen = requested_window_width <= 0 || requested_window_height <= 0;
+
+  // Use SDL to query what is the fullscreen max. width, height and refresh rate
   SDL_DisplayMode display_mode;
   SDL_GetCurrentDisplayMode(0, &display_mode);
 
-  int full_screen_window_width = display_mode.w;
-  int full_screen_window_height = display_mode.h;
+  if (display_mode.refresh_rate > 0) {
+    refresh_rate = display_mode.refresh_rate;
+  }
 
-  window_width = display_mode.w;
-  window_height = display_mode.h;
+  if (is_fullscreen) {
+    window_width = display_mode.w;
+    window_height = display_mode.h;
+  } else {
+    window_width = requested_window_width;
+    window_height = requested_window_height;
+  }
+  render_width = window_width;
+  render_height = window_height;
 
-  // Create a SDL Window at center of the screen with 800 x 600 resolution with
-  // always shown on top all application.
+  // Create a SDL Window at center of the screen, borderless when it covers
+  // the whole display
   window = SDL_CreateWindow(
     "Tiny3D",
     SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-    full_screen_window_width, full_screen_window_height,
-    SDL_WINDOW_BORDERLESS
+    window_width, window_height,
+    is_fullscreen ? SDL_WINDOW_BORDERLESS : 0
   );
 
   if (window == NULL) {
@@ -97,58 +496,111 @@ bool initialize_window(void) {
     return false;
   }
 
-  // Create a SDL Renderer to show inside of SDL Window with default options.
-  renderer = SDL_CreateRenderer(window, -1, 0);
+  // Create a SDL Renderer to show inside of SDL Window, optionally presenting
+  // in sync with the vertical blank of the display
+  renderer = SDL_CreateRenderer(window, -1, is_vsync_requested ? SDL_RENDERER_PRESENTVSYNC : 0);
 
   if (renderer == NULL) {
     fprintf(stderr, "Error creating SDL Renderer. \n");
     return false;
   }
 
-  SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
+  if (is_fullscreen) {
+    SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
+  }
 
-  // Allocate the required memory in bytes to hold the color buffer and z buffer.
-  color_buffer = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
+  // Allocate the required memory in bytes to hold the z buffer.
   z_buffer = (float*)malloc(sizeof(float) * window_width * window_height);
 
-  if (color_buffer == NULL) {
-    fprintf(stderr, "Error allocating memory to color_buffer. \n");
+  if (z_buffer == NULL) {
+    fprintf(stderr, "Error allocating memory to z_buffer. \n");
     return false;
   }
 
-  // Creating a SDL texture that is used to display the color
-  color_buffer_texture = SDL_CreateTexture(
-    renderer,
-    SDL_PIXELFORMAT_RGBA32,
-    SDL_TEXTUREACCESS_STREAMING,
-    window_width, window_height
-  );
-  
-  return true;
+  // Filter the color buffer when a lowered render scale stretches it
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+
+  // Creating the SDL streaming textures that the color buffer is rasterized into,
+  // the colors are 0xAARRGGBB values just like the color constants in the code
+  for (int i = 0; i < NUM_COLOR_BUFFER_TEXTURES; i++) {
+    color_buffer_textures[i] = SDL_CreateTexture(
+      renderer,
+      SDL_PIXELFORMAT_ARGB8888,
+      SDL_TEXTUREACCESS_STREAMING,
+      window_width, window_height
+    );
+
+    if (color_buffer_textures[i] == NULL) {
+      fprintf(stderr, "Error creating SDL Texture. \n");
+      return false;
+    }
+  }
+
+  // Dirty rectangles and interlacing need a color buffer that keeps its pixels
+  // between frames
+  if (present_method == PRESENT_DIRTY_RECT || interlace_method != INTERLACE_NONE) {
+    color_buffer_memory = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
+
+    if (color_buffer_memory == NULL) {
+      fprintf(stderr, "Error allocating memory to color_buffer. \n");
+      return false;
+    }
+  }
+
+  return acquire_color_buffer();
 }
 
 void destroy_window(void) {
+  if (is_color_buffer_locked) {
+    SDL_UnlockTexture(color_buffer_textures[color_buffer_texture_index]);
+    is_color_buffer_locked = false;
+  }
+
+  for (int i = 0; i < NUM_COLOR_BUFFER_TEXTURES; i++) {
+    if (color_buffer_textures[i] != NULL) {
+      SDL_DestroyTexture(color_buffer_textures[i]);
+    }
+  }
+
   free(z_buffer);
-  free(color_buffer);
-  SDL_DestroyRenderer(renderer);
-  SDL_DestroyWindow(window);
+  free(color_buffer_memory);
+
+  if (renderer != NULL) {
+    SDL_DestroyRenderer(renderer);
+  }
+  if (window != NULL) {
+    SDL_DestroyWindow(window);
+  }
   SDL_Quit();
 }
 
 void draw_grid(void) {
-  for (int y = 0; y < window_height; y++) {
-    for (int x = 0; x < window_width; x++) {
+  for (int y = 0; y < render_height; y++) {
+    for (int x = 0; x < render_width; x++) {
       if (x % 20 == 0 || y % 20 == 0) {
-        color_buffer[(window_width * y) + x] = 0xFF333333;
+        color_buffer[(color_buffer_pitch * y) + x] = 0xFF333333;
       }
     }
   }
 }
 
 void draw_dots(void) {
-  for (int y = 0; y < window_height; y = y + 20) {
-    for (int x = 0; x < window_width; x = x + 20) {
-      color_buffer[(window_width * y) + x] = 0xFF333333;
+  dirty_rect_t rect = get_redraw_rect();
+
+  // Start at the first multiple of 20 inside the redraw area
+  int y_start = (rect.y0 + 19) / 20 * 20;
+  int x_start = (rect.x0 + 19) / 20 * 20;
+
+  for (int y = y_start; y < rect.y1; y = y + 20) {
+    if (!is_row_rasterized(y)) {
+      continue;
+    }
+    for (int x = x_start; x < rect.x1; x = x + 20) {
+      // Skipped pixels keep the dot from the previous frame, overwriting them
+      // would also put the dot in front of the triangles drawn there
+      if (get_first_rasterized_x(x, y) == x) {
+        color_buffer[(color_buffer_pitch * y) + x] = 0xFF333333;
+      }
     }
   }
 }
@@ -173,8 +625,8 @@ void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
 }
 
 void draw_pixel(int x, int y, uint32_t color) {
-  if (x >= 0 && y >= 0 && x < window_width && y < window_height) {
-    color_buffer[(window_width * y) + x] = color;
+  if (x >= 0 && y >= 0 && x < render_width && y < render_height) {
+    color_buffer[(color_buffer_pitch * y) + x] = color;
   }
 }
 
@@ -188,38 +640,110 @@ void draw_rect(int x, int y, int width, int height, uint32_t color) {
   }
 }
 
-void render_color_buffer(void) {
-  SDL_UpdateTexture(
-    color_buffer_texture,
-    NULL,
-    color_buffer,
-    (int)(sizeof(uint32_t) * window_width)
-  );
-  SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
+// Hand the finished frame to the callback and queue it on the frame sink
+static void output_frame(void) {
+  if (frame_callback != NULL) {
+    frame_callback(color_buffer, render_width, render_height, color_buffer_pitch, frame_callback_data);
+  }
+
+  if (is_frame_sink_open()) {
+    submit_frame(color_buffer, color_buffer_pitch);
+  }
+}
+
+bool render_color_buffer(void) {
+  reconstruct_interlaced_frame();
+  output_frame();
+
+  if (is_headless) {
+    end_dirty_frame();
+    return true;
+  }
+
+  SDL_Texture* texture = color_buffer_textures[color_buffer_texture_index];
+
+  if (is_color_buffer_locked) {
+    // The pixels were rasterized in place, unlocking hands them to the driver
+    SDL_UnlockTexture(texture);
+    is_color_buffer_locked = false;
+  } else {
+    // Only upload the area that changed since the previous frame
+    dirty_rect_t rect = get_redraw_rect();
+
+    if (!is_rect_empty(rect)) {
+      SDL_Rect update_rect = { rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0 };
+      SDL_UpdateTexture(
+        texture,
+        &update_rect,
+        &color_buffer_memory[(window_width * rect.y0) + rect.x0],
+        (int)(sizeof(uint32_t) * window_width)
+      );
+    }
+  }
+
+  end_dirty_frame();
+
+  // Stretch the rasterized area over the whole window
+  SDL_Rect source_rect = { 0, 0, render_width, render_height };
+  SDL_RenderCopy(renderer, texture, &source_rect, NULL);
   SDL_RenderPresent(renderer);
+
+  // Rotate to the next texture, so the driver can keep reading the presented
+  // one while we rasterize the next frame without waiting for it. Partial
+  // updates rely on the texture keeping its pixels, so they stay on one.
+  if (present_method != PRESENT_DIRTY_RECT) {
+    color_buffer_texture_index = (color_buffer_texture_index + 1) % NUM_COLOR_BUFFER_TEXTURES;
+  }
+
+  // Without a buffer for the next frame there is nothing left to draw into
+  if (!acquire_color_buffer()) {
+    color_buffer = NULL;
+    return false;
+  }
+  return true;
 }
 
 float get_zbuffer_at(int x, int y) {
-  if (x >= 0 && y >= 0 && x < window_width && y < window_height) {
+  if (x >= 0 && y >= 0 && x < render_width && y < render_height) {
     return z_buffer[(window_width * y) + x];
   }
   return 1.0;
 }
 
 void set_zbuffer_at(int x, int y, float v) {
-  if (x >= 0 && y >= 0 && x < window_width && y < window_height) {
+  if (x >= 0 && y >= 0 && x < render_width && y < render_height) {
     z_buffer[(window_width * y) + x] = v;
   }
 }
 
+// Only the pixels rasterized this frame are cleared, interlaced rendering
+// needs the others to reconstruct them
 void clear_color_buffer(uint32_t color) {
-  for (int i = 0; i < window_width * window_height; i++) {
-      color_buffer[i] = color;
+  dirty_rect_t rect = get_redraw_rect();
+  int x_step = get_rasterized_x_step();
+
+  for (int y = rect.y0; y < rect.y1; y++) {
+    if (!is_row_rasterized(y)) {
+      continue;
+    }
+    uint32_t* row = &color_buffer[color_buffer_pitch * y];
+    for (int x = get_first_rasterized_x(rect.x0, y); x < rect.x1; x += x_step) {
+      row[x] = color;
+    }
   }
 }
 
 void clear_z_buffer(void) {
-  for (int i = 0; i < window_width * window_height; i++) {
-      z_buffer[i] = 1.0;
+  dirty_rect_t rect = get_redraw_rect();
+  int x_step = get_rasterized_x_step();
+
+  for (int y = rect.y0; y < rect.y1; y++) {
+    if (!is_row_rasterized(y)) {
+      continue;
+    }
+    float* row = &z_buffer[window_width * y];
+    for (int x = get_first_rasterized_x(rect.x0, y); x < rect.x1; x += x_step) {
+      row[x] = 1.0;
+    }
   }
 }
\ No newline at end of file
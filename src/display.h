@@ -4,9 +4,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "frame.h"
+
 #define FPS 60
-// FRAME_TARGET_TIME defines minimum interval wait period between two frames in millisecond
-#define FRAME_TARGET_TIME (1000 / FPS)
 
 enum CULL_METHOD {
   CULL_NONE,
@@ -22,14 +22,51 @@ enum RENDER_METHOD {
   RENDERED_TEXTURED_WIRE,
 };
 
+enum PRESENT_METHOD {
+  PRESENT_STREAMING,
+  PRESENT_DIRTY_RECT
+};
+
+enum INTERLACE_METHOD {
+  INTERLACE_NONE,
+  INTERLACE_CHECKERBOARD,
+  INTERLACE_SCANLINE
+};
+
+// How much of the previous frame interlaced rendering can reuse
+enum INTERLACE_HISTORY {
+  HISTORY_STILL,         // same scene, every pixel is reused
+  HISTORY_MOVED,         // objects moved, pixels at a matching depth are reused
+  HISTORY_VIEW_CHANGED   // new view, only the background is reused
+};
+
 bool initialize_window(void);
 void destroy_window(void);
 
 int get_window_width(void);
 int get_window_height(void);
 
+void set_window_size(int width, int height);
+
+int get_render_width(void);
+int get_render_height(void);
+void set_render_scale(float scale);
+
+int get_refresh_rate(void);
+void set_vsync(bool enabled);
+void set_vsync_active(bool active);
+
+void set_headless(bool headless);
+bool is_display_headless(void);
+void set_frame_callback(frame_callback_t callback, void* user_data);
+
+int get_render_method(void);
+int get_cull_method(void);
 void set_cull_method(int method);
 void set_render_method(int method);
+void set_present_method(int method);
+int get_interlace_method(void);
+void set_interlace_method(int method);
 
 bool is_back_culling(void);
 
@@ -44,7 +81,15 @@ void draw_pixel(int x, int y, uint32_t color);
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
 void draw_rect(int x, int y, int width, int height, uint32_t color);
 
-void render_color_buffer(void);
+bool render_color_buffer(void);
+
+void mark_dirty_rect(int x0, int y0, int x1, int y1);
+void invalidate_color_buffer(void);
+
+bool is_row_rasterized(int y);
+int get_first_rasterized_x(int x, int y);
+int get_rasterized_x_step(void);
+void set_interlace_history(int history);
 
 float get_zbuffer_at(int x, int y);
 void set_zbuffer_at(int x, int y, float v);
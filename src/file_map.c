@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "file_map.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Assets are mapped instead of read into a heap buffer, so the loaders parse
+// the page cache directly and every asset is held in memory once. Loaders
+// read their files front to back once, which the sequential hint tells the
+// kernel so it reads ahead and drops pages behind the parser.
+///////////////////////////////////////////////////////////////////////////////
+static bool read_file(const char* filepath, file_map_t* map) {
+  FILE* file = fopen(filepath, "rb");
+  if (file == NULL) {
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+
+  unsigned char* data = size > 0 ? malloc((size_t)size) : NULL;
+  if (size < 0 || (size > 0 && data == NULL) || fread(data, 1, (size_t)size, file) != (size_t)size) {
+    free(data);
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  map->data = data;
+  map->size = (size_t)size;
+  map->is_mapped = false;
+  return true;
+}
+
+static bool map_file_with_advice(const char* filepath, file_map_t* map, bool is_sequential) {
+  map->data = NULL;
+  map->size = 0;
+  map->is_mapped = false;
+
+#ifdef HAS_MMAP
+  int fd = open(filepath, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  // Empty files cannot be mapped, and special files have no size to map
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return read_file(filepath, map);
+  }
+
+  void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return read_file(filepath, map);
+  }
+  madvise(data, (size_t)st.st_size, is_sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+  map->data = data;
+  map->size = (size_t)st.st_size;
+  map->is_mapped = true;
+  return true;
+#else
+  return read_file(filepath, map);
+#endif
+}
+
+bool map_file(const char* filepath, file_map_t* map) {
+  return map_file_with_advice(filepath, map, true);
+}
+
+// Files that stay mapped while parts of them are used in any order, such as
+// baked assets, are not read ahead, their users prefetch what they need
+bool map_file_random(const char* filepath, file_map_t* map) {
+  return map_file_with_advice(filepath, map, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Page parts of a mapping in ahead of use, or drop them when they are not
+// needed for a while. Dropped pages are read again from the file the next
+// time they are touched. Only whole pages inside the range are dropped, so
+// neighbouring data sharing a page is never released. Both do nothing for
+// files read into the heap.
+///////////////////////////////////////////////////////////////////////////////
+void prefetch_file_range(const file_map_t* map, size_t offset, size_t size) {
+#ifdef HAS_MMAP
+  if (map->is_mapped && size > 0) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page_size - 1);
+    madvise((void*)(map->data + start), offset + size - start, MADV_WILLNEED);
+  }
+#endif
+}
+
+void release_file_range(const file_map_t* map, size_t offset, size_t size) {
+#ifdef HAS_MMAP
+  if (map->is_mapped) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = (offset + page_size - 1) & ~(page_size - 1);
+    size_t end = (offset + size) & ~(page_size - 1);
+    if (end > start) {
+      madvise((void*)(map->data + start), end - start, MADV_DONTNEED);
+    }
+  }
+#endif
+}
+
+void unmap_file(file_map_t* map) {
+#ifdef HAS_MMAP
+  if (map->is_mapped) {
+    munmap((void*)map->data, map->size);
+  } else {
+    free((void*)map->data);
+  }
+#else
+  free((void*)map->data);
+#endif
+  map->data = NULL;
+  map->size = 0;
+  map->is_mapped = false;
+}
+
+// Size and modification time of a file, to tell when it changed
+bool get_file_stamp(const char* filepath, int64_t* size, int64_t* mtime) {
+  struct stat st;
+  if (stat(filepath, &st) != 0) {
+    return false;
+  }
+  *size = (int64_t)st.st_size;
+  *mtime = (int64_t)st.st_mtime;
+  return true;
+}
+
+// FNV-1a over 64 bit words, folding the high bits down after every word
+uint64_t get_data_checksum(const unsigned char* data, size_t size) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  size_t i = 0;
+
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, &data[i], sizeof(word));
+    hash = (hash ^ word) * 0x100000001B3ULL;
+    hash ^= hash >> 32;
+  }
+  if (i < size) {
+    uint64_t word = 0;
+    memcpy(&word, &data[i], size - i);
+    hash = (hash ^ word) * 0x100000001B3ULL;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
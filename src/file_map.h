@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A read-only view of a whole file. On POSIX systems the file is mapped
+// into memory, elsewhere it is read into a heap buffer. The bytes are not
+// null terminated.
+typedef struct {
+  const unsigned char* data;
+  size_t size;
+  bool is_mapped;   // true when data is a mapping rather than a heap copy
+} file_map_t;
+
+bool map_file(const char* filepath, file_map_t* map);
+bool map_file_random(const char* filepath, file_map_t* map);
+void prefetch_file_range(const file_map_t* map, size_t offset, size_t size);
+void release_file_range(const file_map_t* map, size_t offset, size_t size);
+void unmap_file(file_map_t* map);
+
+bool get_file_stamp(const char* filepath, int64_t* size, int64_t* mtime);
+uint64_t get_data_checksum(const unsigned char* data, size_t size);
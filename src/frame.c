@@ -0,0 +1,214 @@
+#include <string.h>
+
+#include "frame.h"
+
+// Largest payload of a single stored (uncompressed) deflate block
+#define MAX_STORED_BLOCK_SIZE 65535
+
+int parse_frame_format(const char* name) {
+  if (strcmp(name, "raw") == 0) return FRAME_FORMAT_RAW;
+  if (strcmp(name, "ppm") == 0) return FRAME_FORMAT_PPM;
+  if (strcmp(name, "png") == 0) return FRAME_FORMAT_PNG;
+  return -1;
+}
+
+const char* get_frame_format_extension(int format) {
+  switch (format) {
+    case FRAME_FORMAT_PPM: return "ppm";
+    case FRAME_FORMAT_PNG: return "png";
+    default: return "raw";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unpack a row of color buffer pixels into tightly packed RGB or RGBA bytes
+///////////////////////////////////////////////////////////////////////////////
+static void unpack_frame_row(uint8_t* out, const uint32_t* row, int width, bool with_alpha) {
+  // The color buffer holds 0xAARRGGBB values, whatever the byte order of the host
+  for (int x = 0; x < width; x++) {
+    uint32_t color = row[x];
+    *out++ = (uint8_t)(color >> 16);
+    *out++ = (uint8_t)(color >> 8);
+    *out++ = (uint8_t)color;
+    if (with_alpha) {
+      *out++ = (uint8_t)(color >> 24);
+    }
+  }
+}
+
+// The PNG rows are the largest, with a filter byte in front of RGBA pixels
+size_t get_frame_row_size(int width) {
+  return 1 + (size_t)width * 4;
+}
+
+static bool write_frame_raw(FILE* file, const uint32_t* pixels, int width, int height, int pitch, uint8_t* row) {
+  bool ok = true;
+
+  // Raw frames are R, G, B, A bytes
+  for (int y = 0; ok && y < height; y++) {
+    unpack_frame_row(row, &pixels[pitch * y], width, true);
+    ok = fwrite(row, 4, width, file) == (size_t)width;
+  }
+
+  return ok;
+}
+
+static bool write_frame_ppm(FILE* file, const uint32_t* pixels, int width, int height, int pitch, uint8_t* row) {
+  bool ok = fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+
+  for (int y = 0; ok && y < height; y++) {
+    unpack_frame_row(row, &pixels[pitch * y], width, false);
+    ok = fwrite(row, 3, width, file) == (size_t)width;
+  }
+
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Minimal PNG encoder writing the image as stored (uncompressed) deflate blocks
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+  FILE* file;
+  uint32_t crc;
+  uint32_t adler_a;
+  uint32_t adler_b;
+  int block_left;     // bytes left in the current stored deflate block
+  long data_left;     // bytes left in the whole zlib payload
+  bool ok;
+} png_writer_t;
+
+static uint32_t crc_table[256];
+static bool is_crc_table_ready = false;
+
+static void init_crc_table(void) {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    crc_table[n] = c;
+  }
+  is_crc_table_ready = true;
+}
+
+static void png_write_bytes(png_writer_t* writer, const uint8_t* bytes, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    writer->crc = crc_table[(writer->crc ^ bytes[i]) & 0xFF] ^ (writer->crc >> 8);
+  }
+  if (writer->ok && fwrite(bytes, 1, count, writer->file) != count) {
+    writer->ok = false;
+  }
+}
+
+static void png_write_u32(png_writer_t* writer, uint32_t value) {
+  uint8_t bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+  png_write_bytes(writer, bytes, 4);
+}
+
+static void png_begin_chunk(png_writer_t* writer, const char* type, uint32_t length) {
+  png_write_u32(writer, length);
+  writer->crc = 0xFFFFFFFFu;
+  png_write_bytes(writer, (const uint8_t*)type, 4);
+}
+
+static void png_end_chunk(png_writer_t* writer) {
+  png_write_u32(writer, writer->crc ^ 0xFFFFFFFFu);
+}
+
+// Append image bytes to the zlib stream, opening a new stored block as needed
+static void png_write_image_data(png_writer_t* writer, const uint8_t* bytes, size_t count) {
+  while (count > 0) {
+    if (writer->block_left == 0) {
+      int block_size = writer->data_left > MAX_STORED_BLOCK_SIZE ? MAX_STORED_BLOCK_SIZE : (int)writer->data_left;
+      uint8_t header[5] = {
+        writer->data_left == block_size ? 1 : 0,
+        block_size & 0xFF, (block_size >> 8) & 0xFF,
+        ~block_size & 0xFF, (~block_size >> 8) & 0xFF
+      };
+      png_write_bytes(writer, header, 5);
+      writer->block_left = block_size;
+    }
+
+    size_t size = count < (size_t)writer->block_left ? count : (size_t)writer->block_left;
+
+    for (size_t i = 0; i < size; i++) {
+      writer->adler_a = (writer->adler_a + bytes[i]) % 65521;
+      writer->adler_b = (writer->adler_b + writer->adler_a) % 65521;
+    }
+    png_write_bytes(writer, bytes, size);
+
+    writer->block_left -= (int)size;
+    writer->data_left -= (long)size;
+    bytes += size;
+    count -= size;
+  }
+}
+
+static bool write_frame_png(FILE* file, const uint32_t* pixels, int width, int height, int pitch, uint8_t* row) {
+  static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+  if (!is_crc_table_ready) {
+    init_crc_table();
+  }
+
+  // Each scanline is prefixed with the filter type byte (0 = none)
+  long scanline_size = 1 + (long)width * 4;
+  long data_size = scanline_size * height;
+  long num_blocks = (data_size + MAX_STORED_BLOCK_SIZE - 1) / MAX_STORED_BLOCK_SIZE;
+  long zlib_size = 2 + data_size + num_blocks * 5 + 4;
+
+  png_writer_t writer = { .file = file, .adler_a = 1, .data_left = data_size, .ok = true };
+
+  png_write_bytes(&writer, signature, sizeof(signature));
+
+  // IHDR: 8 bits per channel, color type 6 (RGBA), no interlacing
+  uint8_t ihdr_tail[5] = { 8, 6, 0, 0, 0 };
+  png_begin_chunk(&writer, "IHDR", 13);
+  png_write_u32(&writer, width);
+  png_write_u32(&writer, height);
+  png_write_bytes(&writer, ihdr_tail, 5);
+  png_end_chunk(&writer);
+
+  uint8_t zlib_header[2] = { 0x78, 0x01 };
+  png_begin_chunk(&writer, "IDAT", (uint32_t)zlib_size);
+  png_write_bytes(&writer, zlib_header, 2);
+
+  for (int y = 0; y < height; y++) {
+    row[0] = 0;
+    unpack_frame_row(&row[1], &pixels[pitch * y], width, true);
+    png_write_image_data(&writer, row, scanline_size);
+  }
+
+  png_write_u32(&writer, (writer.adler_b << 16) | writer.adler_a);
+  png_end_chunk(&writer);
+
+  png_begin_chunk(&writer, "IEND", 0);
+  png_end_chunk(&writer);
+
+  return writer.ok;
+}
+
+bool write_frame(FILE* file, int format, const uint32_t* pixels, int width, int height, int pitch, uint8_t* row) {
+  switch (format) {
+    case FRAME_FORMAT_PPM: return write_frame_ppm(file, pixels, width, height, pitch, row);
+    case FRAME_FORMAT_PNG: return write_frame_png(file, pixels, width, height, pitch, row);
+    default: return write_frame_raw(file, pixels, width, height, pitch, row);
+  }
+}
+
+bool write_frame_file(
+  const char* filepath, int format, const uint32_t* pixels, int width, int height, int pitch, uint8_t* row
+) {
+  FILE* file = fopen(filepath, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening frame output file %s. \n", filepath);
+    return false;
+  }
+
+  bool ok = write_frame(file, format, pixels, width, height, pitch, row);
+
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+  return ok;
+}
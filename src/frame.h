@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+enum FRAME_FORMAT {
+  FRAME_FORMAT_RAW,
+  FRAME_FORMAT_PPM,
+  FRAME_FORMAT_PNG
+};
+
+// Callback used to hand a finished frame to the application instead of a file
+typedef void (*frame_callback_t)(
+  const uint32_t* pixels,
+  int width, int height, int pitch,
+  void* user_data
+);
+
+int parse_frame_format(const char* name);
+const char* get_frame_format_extension(int format);
+
+// The writers unpack one row at a time into a scratch buffer of the caller,
+// of get_frame_row_size bytes, so writing a frame allocates nothing
+size_t get_frame_row_size(int width);
+
+bool write_frame(FILE* file, int format, const uint32_t* pixels, int width, int height, int pitch, uint8_t* row);
+bool write_frame_file(
+  const char* filepath, int format, const uint32_t* pixels, int width, int height, int pitch, uint8_t* row
+);
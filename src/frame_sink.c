@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "frame_sink.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Frames are copied into a bounded ring of preallocated buffers and written
+// by a background thread, so the render loop never waits on disk I/O.
+// There is a single producer (the render loop) and a single consumer (the
+// writer thread): the producer owns the slot at ring_tail while the ring is
+// not full, the writer owns the slot at ring_head while it is not empty.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+  uint32_t* pixels;
+  int frame_index;
+} frame_slot_t;
+
+static frame_slot_t* ring = NULL;
+static uint8_t* frame_row = NULL;     // scratch row of the writer thread
+static int ring_size = 0;
+static int ring_head = 0;
+static int ring_tail = 0;
+static int ring_count = 0;
+
+static SDL_mutex* ring_mutex = NULL;
+static SDL_cond* ring_not_empty = NULL;
+static SDL_cond* ring_not_full = NULL;
+static SDL_Thread* writer_thread = NULL;
+static bool is_closing = false;
+
+static int frame_width = 0;
+static int frame_height = 0;
+static int frame_policy = FRAME_SINK_BLOCK;
+
+// Image sequences are written as <output>_<frame>.<ext>, streams write every
+// frame back to back into one file, stdout ("-") or a pipe ("|command")
+static const char* frame_output = NULL;
+static int frame_format = FRAME_FORMAT_RAW;
+static FILE* stream_file = NULL;
+static bool is_stream_pipe = false;
+
+static frame_sink_stats_t stats;
+
+static bool write_slot(frame_slot_t* slot) {
+  if (stream_file != NULL) {
+    return write_frame(stream_file, frame_format, slot->pixels, frame_width, frame_height, frame_width, frame_row);
+  }
+
+  char filepath[1024];
+  snprintf(
+    filepath, sizeof(filepath), "%s_%06d.%s",
+    frame_output, slot->frame_index, get_frame_format_extension(frame_format)
+  );
+  return write_frame_file(filepath, frame_format, slot->pixels, frame_width, frame_height, frame_width, frame_row);
+}
+
+static int frame_writer_main(void* data) {
+  (void)data;
+
+  for (;;) {
+    SDL_LockMutex(ring_mutex);
+    while (ring_count == 0 && !is_closing) {
+      SDL_CondWait(ring_not_empty, ring_mutex);
+    }
+    if (ring_count == 0) {
+      // Closing and every submitted frame has been written
+      SDL_UnlockMutex(ring_mutex);
+      break;
+    }
+    frame_slot_t* slot = &ring[ring_head];
+    SDL_UnlockMutex(ring_mutex);
+
+    bool ok = write_slot(slot);
+
+    SDL_LockMutex(ring_mutex);
+    if (ok) {
+      stats.written++;
+    } else {
+      stats.failed++;
+    }
+    ring_head = (ring_head + 1) % ring_size;
+    ring_count--;
+    SDL_CondSignal(ring_not_full);
+    SDL_UnlockMutex(ring_mutex);
+  }
+  return 0;
+}
+
+static bool open_frame_stream(const char* output) {
+  if (strcmp(output, "-") == 0) {
+    stream_file = stdout;
+  } else if (output[0] == '|') {
+    stream_file = popen(output + 1, "w");
+    is_stream_pipe = true;
+  } else {
+    stream_file = fopen(output, "wb");
+  }
+
+  if (stream_file == NULL) {
+    fprintf(stderr, "Error opening frame stream %s. \n", output);
+    return false;
+  }
+  return true;
+}
+
+// Everything is created before the writer thread is started last, and a
+// failure releases whatever was created so far through destroy_frame_sink
+bool init_frame_sink(
+  const char* output, int format, bool is_stream,
+  int width, int height,
+  int num_buffers, int policy
+) {
+  frame_output = output;
+  frame_format = format;
+  frame_width = width;
+  frame_height = height;
+  frame_policy = policy;
+  memset(&stats, 0, sizeof(stats));
+
+  ring_head = ring_tail = ring_count = 0;
+  is_closing = false;
+
+  ring_mutex = SDL_CreateMutex();
+  ring_not_empty = SDL_CreateCond();
+  ring_not_full = SDL_CreateCond();
+  if (ring_mutex == NULL || ring_not_empty == NULL || ring_not_full == NULL) {
+    fprintf(stderr, "Error starting the frame writer thread: %s\n", SDL_GetError());
+    destroy_frame_sink();
+    return false;
+  }
+
+  if (is_stream && !open_frame_stream(output)) {
+    destroy_frame_sink();
+    return false;
+  }
+
+  // All frame buffers, and the row the writer encodes from, are allocated up
+  // front and reused for every frame
+  frame_row = (uint8_t*)malloc(get_frame_row_size(width));
+  ring_size = num_buffers > 0 ? num_buffers : DEFAULT_FRAME_SINK_BUFFERS;
+  ring = (frame_slot_t*)calloc(ring_size, sizeof(frame_slot_t));
+  for (int i = 0; ring != NULL && i < ring_size; i++) {
+    ring[i].pixels = (uint32_t*)malloc(sizeof(uint32_t) * width * height);
+    if (ring[i].pixels == NULL) {
+      break;
+    }
+  }
+  if (frame_row == NULL || ring == NULL || ring[ring_size - 1].pixels == NULL) {
+    fprintf(stderr, "Error allocating memory to the frame sink. \n");
+    destroy_frame_sink();
+    return false;
+  }
+
+  writer_thread = SDL_CreateThread(frame_writer_main, "frame_writer", NULL);
+  if (writer_thread == NULL) {
+    fprintf(stderr, "Error starting the frame writer thread: %s\n", SDL_GetError());
+    destroy_frame_sink();
+    return false;
+  }
+
+  return true;
+}
+
+bool is_frame_sink_open(void) {
+  return writer_thread != NULL;
+}
+
+bool submit_frame(const uint32_t* pixels, int pitch) {
+  if (writer_thread == NULL) {
+    return false;
+  }
+
+  SDL_LockMutex(ring_mutex);
+  int frame_index = stats.submitted++;
+
+  if (ring_count == ring_size && frame_policy == FRAME_SINK_DROP) {
+    stats.dropped++;
+    SDL_UnlockMutex(ring_mutex);
+    return false;
+  }
+
+  while (ring_count == ring_size) {
+    SDL_CondWait(ring_not_full, ring_mutex);
+  }
+  frame_slot_t* slot = &ring[ring_tail];
+  SDL_UnlockMutex(ring_mutex);
+
+  // The slot at the tail belongs to us until it is published below
+  for (int y = 0; y < frame_height; y++) {
+    memcpy(&slot->pixels[frame_width * y], &pixels[pitch * y], sizeof(uint32_t) * frame_width);
+  }
+  slot->frame_index = frame_index;
+
+  SDL_LockMutex(ring_mutex);
+  ring_tail = (ring_tail + 1) % ring_size;
+  ring_count++;
+  SDL_CondSignal(ring_not_empty);
+  SDL_UnlockMutex(ring_mutex);
+
+  return true;
+}
+
+frame_sink_stats_t get_frame_sink_stats(void) {
+  frame_sink_stats_t result;
+
+  if (ring_mutex == NULL) {
+    return stats;
+  }
+
+  SDL_LockMutex(ring_mutex);
+  result = stats;
+  SDL_UnlockMutex(ring_mutex);
+  return result;
+}
+
+// Write every pending frame, then stop the writer thread and release the ring
+void destroy_frame_sink(void) {
+  if (writer_thread != NULL) {
+    SDL_LockMutex(ring_mutex);
+    is_closing = true;
+    SDL_CondSignal(ring_not_empty);
+    SDL_UnlockMutex(ring_mutex);
+
+    SDL_WaitThread(writer_thread, NULL);
+    writer_thread = NULL;
+  }
+
+  if (stream_file != NULL) {
+    if (is_stream_pipe) {
+      pclose(stream_file);
+    } else if (stream_file != stdout) {
+      fclose(stream_file);
+    } else {
+      fflush(stream_file);
+    }
+    stream_file = NULL;
+    is_stream_pipe = false;
+  }
+
+  for (int i = 0; ring != NULL && i < ring_size; i++) {
+    free(ring[i].pixels);
+  }
+  free(ring);
+  ring = NULL;
+  ring_size = 0;
+  free(frame_row);
+  frame_row = NULL;
+
+  SDL_DestroyCond(ring_not_empty);
+  SDL_DestroyCond(ring_not_full);
+  SDL_DestroyMutex(ring_mutex);
+  ring_not_empty = ring_not_full = NULL;
+  ring_mutex = NULL;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "frame.h"
+
+#define DEFAULT_FRAME_SINK_BUFFERS 4
+
+// What submit_frame does when every buffer of the ring is waiting to be written
+enum FRAME_SINK_POLICY {
+  FRAME_SINK_BLOCK,
+  FRAME_SINK_DROP
+};
+
+typedef struct {
+  int submitted;   // frames handed to submit_frame
+  int written;     // frames encoded and written by the writer thread
+  int dropped;     // frames discarded because the ring was full
+  int failed;      // frames the writer thread could not write
+} frame_sink_stats_t;
+
+bool init_frame_sink(
+  const char* output, int format, bool is_stream,
+  int width, int height,
+  int num_buffers, int policy
+);
+void destroy_frame_sink(void);
+
+bool is_frame_sink_open(void);
+bool submit_frame(const uint32_t* pixels, int pitch);
+
+frame_sink_stats_t get_frame_sink_stats(void);
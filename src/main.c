@@ -1,19 +1,28 @@
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <SDL2/SDL.h>
 
 #include "array.h"
+#include "asset_loader.h"
+#include "asset_registry.h"
 #include "display.h"
+#include "frame_sink.h"
 #include "camera.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_stream.h"
 #include "clipping.h"
 #include "matrix.h"
 #include "vector.h"
 #include "texture.h"
 #include "triangle.h"
 #include "light.h"
+#include "pacing.h"
+#include "resolution.h"
 #include "upng.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -21,8 +30,84 @@
 ///////////////////////////////////////////////////////////////////////////////
 bool is_paused = true;
 bool is_running = false;
+bool is_vsync_enabled = false;
 float delta_time = 0;
-int previous_time_frame = 0;
+
+// Lowest fraction of the window resolution to rasterize at when frames take
+// too long, zero when the render resolution is fixed
+float min_render_scale = 0;
+
+// Number of frames to render before exiting, zero means run until quit
+int max_frames = 0;
+int rendered_frames = 0;
+
+// Where rendered frames are written, NULL when frames are not captured
+const char* frame_output = NULL;
+bool is_frame_output_stream = false;
+int frame_output_format = FRAME_FORMAT_PPM;
+int frame_sink_policy = FRAME_SINK_BLOCK;
+int frame_sink_buffers = DEFAULT_FRAME_SINK_BUFFERS;
+
+///////////////////////////////////////////////////////////////////////////////
+// Meshes of the scene. Each is loaded from the baked cache next to its OBJ
+// file when that is up to date, and --bake writes the caches and exits.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+  char* obj_filepath;
+  char* png_filepath;
+  vec3_t scale;
+  vec3_t translation;
+  vec3_t rotation;
+} scene_mesh_t;
+
+scene_mesh_t scene_meshes[] = {
+  { "../assets/drone.obj", "../assets/drone.png", { 1, 1, 1 }, { -3, 0, +8 }, { 0, 0, 0 } },
+  { "../assets/efa.obj", "../assets/efa.png", { 1, 1, 1 }, { +3, 0, +8 }, { 0, 0, 0 } }
+};
+#define NUM_SCENE_MESHES (int)(sizeof(scene_meshes) / sizeof(scene_meshes[0]))
+
+bool is_baking = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// The simulation advances in fixed steps, and frames are drawn interpolating
+// the mesh transforms between the last two steps
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+  vec3_t scale;
+  vec3_t rotation;
+  vec3_t translation;
+} mesh_transform_t;
+
+mesh_transform_t previous_mesh_transforms[MAX_NUM_MESHES];
+double simulation_time = 0;
+float interpolation_factor = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Idle frame elimination: when nothing that affects the image has changed,
+// the frame is skipped, the window keeps showing the last presented image and
+// the loop blocks waiting for input instead of polling
+///////////////////////////////////////////////////////////////////////////////
+#define IDLE_WAIT_TIMEOUT 250
+
+typedef struct {
+  vec3_t camera_position;
+  float camera_yaw;
+  float camera_pitch;
+  vec3_t light_direction;
+  int render_method;
+  int cull_method;
+  int num_meshes;
+  vec3_t mesh_transforms[MAX_NUM_MESHES][3];
+  int mesh_load_states[MAX_NUM_MESHES];
+} scene_snapshot_t;
+
+scene_snapshot_t rendered_scene;
+bool is_idle_frame = false;
+bool is_redraw_requested = true;
+
+// Interlaced frames only rasterize half of the pixels, so after the scene
+// stops changing one more frame is needed to complete the image
+bool is_interlaced_image_incomplete = false;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Declaration of our global transformation matrices
@@ -38,6 +123,33 @@ mat4_t view_matrix;
 triangle_t triangles_to_render[MAX_TRIANGLE_PER_MESH];
 int num_triangles_to_render = 0;
 
+///////////////////////////////////////////////////////////////////////////////
+// Remember the mesh transforms before the simulation advances
+///////////////////////////////////////////////////////////////////////////////
+void save_previous_mesh_transforms(void) {
+  for (int i = 0; i < get_num_meshes(); i++) {
+    mesh_t* mesh = get_mesh(i);
+    previous_mesh_transforms[i].scale = mesh->scale;
+    previous_mesh_transforms[i].rotation = mesh->rotation;
+    previous_mesh_transforms[i].translation = mesh->translation;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Return a copy of the mesh with its transform blended between the previous
+// and the current simulation step
+///////////////////////////////////////////////////////////////////////////////
+mesh_t get_interpolated_mesh(int i) {
+  mesh_t mesh = *get_mesh(i);
+  mesh_transform_t previous = previous_mesh_transforms[i];
+
+  mesh.scale = vec3_lerp(previous.scale, mesh.scale, interpolation_factor);
+  mesh.rotation = vec3_lerp(previous.rotation, mesh.rotation, interpolation_factor);
+  mesh.translation = vec3_lerp(previous.translation, mesh.translation, interpolation_factor);
+
+  return mesh;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Setup function to initialize variables and game objects
 ///////////////////////////////////////////////////////////////////////////////
@@ -63,128 +175,160 @@ bool setup(void) {
   // Initialize frustum planes with a point and a normal
   init_frustum_planes(fov_x, fov_y, znear, zfar);
 
-  // Loads mesh entities
-  load_mesh("../assets/drone.obj", "../assets/drone.png", vec3_new(1, 1, 1), vec3_new(-3, 0, +8), vec3_new(0, 0, 0));
-  load_mesh("../assets/efa.obj", "../assets/efa.png", vec3_new(1, 1, 1), vec3_new(+3, 0, +8), vec3_new(0, 0, 0));  
+  // Loads mesh entities in the background, they show up as they are loaded
+  if (!init_asset_loader(0)) {
+    return false;
+  }
+  for (int i = 0; i < NUM_SCENE_MESHES; i++) {
+    load_mesh_async(
+      scene_meshes[i].obj_filepath, scene_meshes[i].png_filepath,
+      scene_meshes[i].scale, scene_meshes[i].translation, scene_meshes[i].rotation,
+      NULL, NULL
+    );
+  }
+
+  // Offscreen frames must not depend on how fast the meshes load
+  if (is_display_headless()) {
+    finish_asset_loading();
+  }
+
+  // Nothing has moved yet, so the previous simulation step matches the current one
+  save_previous_mesh_transforms();
 
   return true;
 }
 
-void process_input(void) {
-  SDL_Event event;
+void process_event(SDL_Event event) {
+  switch (event.type) {
+    case SDL_QUIT:
+      is_running = false;
+      break;
 
-  while(SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
+    case SDL_WINDOWEVENT:
+      // The window may have lost its contents, so present a fresh frame
+      is_redraw_requested = true;
+      break;
+
+    case SDL_KEYDOWN:
+      if (event.key.keysym.sym == SDLK_ESCAPE) {
         is_running = false;
         break;
+      }
 
-      case SDL_KEYDOWN:
-        if (event.key.keysym.sym == SDLK_ESCAPE) {
-          is_running = false;
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_SPACE) {
+        is_paused = !is_paused;
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_SPACE) {
-          is_paused = !is_paused;
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_w) {
+        camera_rotate_pitch(-3.0 * delta_time);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_w) {
-          camera_rotate_pitch(-3.0 * delta_time);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_s) {
+        camera_rotate_pitch(+3.0 * delta_time);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_s) {
-          camera_rotate_pitch(+3.0 * delta_time);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_a) {
+        camera_rotate_yaw(-1.0 * delta_time);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_a) {
-          camera_rotate_yaw(-1.0 * delta_time);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_d) {
+        camera_rotate_yaw(+1.0 * delta_time);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_d) {
-          camera_rotate_yaw(+1.0 * delta_time);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_UP) {
+        update_camera_forward_velocity(
+          vec3_mul(
+            get_camera_direction(), 
+            5 * delta_time
+          )
+        );
+        update_camera_position(
+          vec3_add(
+            get_camera_position(),
+            get_camera_forward_velocity()
+          )
+        );
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_UP) {
-          update_camera_forward_velocity(
-            vec3_mul(
-              get_camera_direction(), 
-              5 * delta_time
-            )
-          );
-          update_camera_position(
-            vec3_add(
-              get_camera_position(),
-              get_camera_forward_velocity()
-            )
-          );
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_DOWN) {
+        update_camera_forward_velocity(
+          vec3_mul(
+            get_camera_direction(), 
+            5.0 * delta_time
+          )
+        );
+        update_camera_position(
+          vec3_sub(
+            get_camera_position(),
+            get_camera_forward_velocity()
+          )
+        );
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_DOWN) {
-          update_camera_forward_velocity(
-            vec3_mul(
-              get_camera_direction(), 
-              5.0 * delta_time
-            )
-          );
-          update_camera_position(
-            vec3_sub(
-              get_camera_position(),
-              get_camera_forward_velocity()
-            )
-          );
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_1) {
+        set_render_method(RENDER_WIRE_VERTEX);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_1) {
-          set_render_method(RENDER_WIRE_VERTEX);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_2) {
+        set_render_method(RENDER_WIRE);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_2) {
-          set_render_method(RENDER_WIRE);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_3) {
+        set_render_method(RENDER_FILL_TRIANGLE);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_3) {
-          set_render_method(RENDER_FILL_TRIANGLE);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_4) {
+        set_render_method(RENDER_FILL_TRIANGLE_WIRE);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_4) {
-          set_render_method(RENDER_FILL_TRIANGLE_WIRE);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_5) {
+        set_render_method(RENDER_TEXTURED);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_5) {
-          set_render_method(RENDER_TEXTURED);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_6) {
+        set_render_method(RENDERED_TEXTURED_WIRE);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_6) {
-          set_render_method(RENDERED_TEXTURED_WIRE);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_c) {
+        set_cull_method(CULL_BACKFACE);
+        break;
+      }
 
-        if (event.key.keysym.sym == SDLK_c) {
-          set_cull_method(CULL_BACKFACE);
-          break;
-        }
+      if (event.key.keysym.sym == SDLK_x) {
+        set_cull_method(CULL_NONE);
+        break;
+      }
+      
+    break;
+  }
+}
 
-        if (event.key.keysym.sym == SDLK_x) {
-          set_cull_method(CULL_NONE);
-          break;
-        }
-        
-      break;
+void process_input(void) {
+  SDL_Event event;
+
+  // Nothing changed in the last frame, so sleep until something happens
+  if (is_idle_frame) {
+    if (SDL_WaitEventTimeout(&event, IDLE_WAIT_TIMEOUT)) {
+      process_event(event);
     }
   }
+
+  while(SDL_PollEvent(&event)) {
+    process_event(event);
+  }
 }
 
 void process_graphics_pipeline_stages(mesh_t* mesh) {
@@ -200,180 +344,372 @@ void process_graphics_pipeline_stages(mesh_t* mesh) {
   mat4_t rotation_y_matrix = mat4_make_rotation_y(mesh->rotation.y);
   mat4_t rotation_z_matrix = mat4_make_rotation_z(mesh->rotation.z);
 
-  // Loop all triangle faces of our mesh
-  int num_faces = array_length(mesh->faces);
+  // Meshes baked into clusters only process the clusters in view, which is
+  // also what pages in the clusters of a streamed mesh
+  mat4_t model_matrix = mat4_mul_mat4(
+    translation_matrix,
+    mat4_mul_mat4(rotation_x_matrix, mat4_mul_mat4(rotation_y_matrix, mat4_mul_mat4(rotation_z_matrix, scale_matrix)))
+  );
+  mat4_t model_view_matrix = mat4_mul_mat4(view_matrix, model_matrix);
+  float max_scale = fmaxf(fabsf(mesh->scale.x), fmaxf(fabsf(mesh->scale.y), fabsf(mesh->scale.z)));
+
+  // Face normals are computed in model space when the mesh is loaded. They
+  // go to camera space through the inverse transpose of the model view
+  // matrix, which is [V]*[R]*[S]^-1, negated when the scale mirrors the mesh
+  // since that also turns the faces around
+  float mirror = mesh->scale.x * mesh->scale.y * mesh->scale.z < 0 ? -1 : 1;
+  mat4_t normal_matrix = mat4_mul_mat4(
+    view_matrix,
+    mat4_mul_mat4(
+      rotation_x_matrix,
+      mat4_mul_mat4(
+        rotation_y_matrix,
+        mat4_mul_mat4(
+          rotation_z_matrix,
+          mat4_make_scale(mirror / mesh->scale.x, mirror / mesh->scale.y, mirror / mesh->scale.z)
+        )
+      )
+    )
+  );
+
+  int num_clusters = mesh->clusters != NULL ? array_length(mesh->clusters) : 1;
+
+  for (int c = 0; c < num_clusters; c++) {
+    int first_face = 0;
+    int end_face = array_length(mesh->faces);
+
+    if (mesh->clusters != NULL) {
+      const mesh_cluster_t* cluster = &mesh->clusters[c];
+      vec3_t center = vec3_from_vec4(mat4_mul_vec4(model_view_matrix, vec4_from_vec3(cluster->center)));
+      if (!is_sphere_in_frustum(center, cluster->radius * max_scale)) {
+        continue;
+      }
+      if (!use_mesh_cluster(mesh, c, vec3_length(&center))) {
+        continue;
+      }
+      first_face = cluster->first_face;
+      end_face = first_face + cluster->num_faces;
+    }
 
-  for (int i = 0; i < num_faces; i++) {
-    face_t mesh_face = mesh->faces[i];
+    // Loop all triangle faces of the cluster
+    for (int i = first_face; i < end_face; i++) {
+      face_t mesh_face = mesh->faces[i];
 
-    vec3_t face_vertices[3];
-    face_vertices[0] = mesh->vertices[mesh_face.a];
-    face_vertices[1] = mesh->vertices[mesh_face.b];
-    face_vertices[2] = mesh->vertices[mesh_face.c];
+      vec3_t face_vertices[3];
+      face_vertices[0] = mesh->vertices[mesh_face.a];
+      face_vertices[1] = mesh->vertices[mesh_face.b];
+      face_vertices[2] = mesh->vertices[mesh_face.c];
 
-    vec4_t transformed_vertices[3];
+      vec4_t transformed_vertices[3];
 
-    // Loop all three vertices of this current face and apply transformations
-    for (int j = 0; j < 3; j++) {
-      vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
+      // Loop all three vertices of this current face and apply transformations
+      for (int j = 0; j < 3; j++) {
+        vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
 
-      // Create a World Matrix combining scale, rotation, and translation matrices
-      world_matrix = mat4_identity();
+        // Create a World Matrix combining scale, rotation, and translation matrices
+        world_matrix = mat4_identity();
 
-      // Order matters: First scale, then rotate, then translate. [T]*[R]*[S]*v
-      world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-      world_matrix = mat4_mul_mat4(rotation_z_matrix, world_matrix);
-      world_matrix = mat4_mul_mat4(rotation_y_matrix, world_matrix);
-      world_matrix = mat4_mul_mat4(rotation_x_matrix, world_matrix);
-      world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+        // Order matters: First scale, then rotate, then translate. [T]*[R]*[S]*v
+        world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
+        world_matrix = mat4_mul_mat4(rotation_z_matrix, world_matrix);
+        world_matrix = mat4_mul_mat4(rotation_y_matrix, world_matrix);
+        world_matrix = mat4_mul_mat4(rotation_x_matrix, world_matrix);
+        world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
 
-      // Multiply the world matrix by the original vector
-      transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
+        // Multiply the world matrix by the original vector
+        transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
 
-      // Multiply the view matrix by the vector to transform the scene to camera space
-      transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
+        // Multiply the view matrix by the vector to transform the scene to camera space
+        transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
 
-      // Save transformed vertex in the array of transformed vertices
-      transformed_vertices[j] = transformed_vertex;
-    }
+        // Save transformed vertex in the array of transformed vertices
+        transformed_vertices[j] = transformed_vertex;
+      }
 
-    // Check backface culling
-    vec3_t triangle_normal = get_triangle_normal(transformed_vertices);
+      // Check backface culling
+      vec4_t face_normal = vec4_from_vec3(mesh->normals[i]);
+      face_normal.w = 0;
+      vec3_t triangle_normal = vec3_from_vec4(mat4_mul_vec4(normal_matrix, face_normal));
+      vec3_normalize(&triangle_normal);
 
-    // Bypass the triangle that are looking away from camera
-    if (is_back_culling()) {
-      // Find the vector between a point in the triangle and the camera origin
-      vec3_t origin = vec3_new(0, 0, 0);
-      vec3_t camera_ray = vec3_sub(origin, vec3_from_vec4(transformed_vertices[0]));
+      // Bypass the triangle that are looking away from camera
+      if (is_back_culling()) {
+        // Find the vector between a point in the triangle and the camera origin
+        vec3_t origin = vec3_new(0, 0, 0);
+        vec3_t camera_ray = vec3_sub(origin, vec3_from_vec4(transformed_vertices[0]));
 
-      // Calculate how aligned the camera ray is with the face normal (using dot product)
-      float dot_normal_camera = vec3_dot(triangle_normal, camera_ray);
+        // Calculate how aligned the camera ray is with the face normal (using dot product)
+        float dot_normal_camera = vec3_dot(triangle_normal, camera_ray);
 
-      if (dot_normal_camera < 0) {
-        continue;
+        if (dot_normal_camera < 0) {
+          continue;
+        }
       }
-    }
 
-    // Create a polygon from the original transformed triangle to be clipped
-    polygon_t polygon = create_polygon_from_triangle(
-      vec3_from_vec4(transformed_vertices[0]),
-      vec3_from_vec4(transformed_vertices[1]),
-      vec3_from_vec4(transformed_vertices[2]),
-      mesh_face.a_uv,
-      mesh_face.b_uv,
-      mesh_face.c_uv
-    );
+      // Create a polygon from the original transformed triangle to be clipped
+      polygon_t polygon = create_polygon_from_triangle(
+        vec3_from_vec4(transformed_vertices[0]),
+        vec3_from_vec4(transformed_vertices[1]),
+        vec3_from_vec4(transformed_vertices[2]),
+        mesh_face.a_uv,
+        mesh_face.b_uv,
+        mesh_face.c_uv
+      );
 
-    // Clip the polygon and returns a new polygon with potential new vertices
-    clip_polygon(&polygon);
+      // Clip the polygon and returns a new polygon with potential new vertices
+      clip_polygon(&polygon);
 
-    // Break the clipped polygon apart back into individual triangles
-    triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLE]; 
-    int num_triangles_after_clipping = 0;
+      // Break the clipped polygon apart back into individual triangles
+      triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLE]; 
+      int num_triangles_after_clipping = 0;
 
-    triangle_from_polygon(&polygon, triangles_after_clipping, &num_triangles_after_clipping);
+      triangle_from_polygon(&polygon, triangles_after_clipping, &num_triangles_after_clipping);
     
-    // Loop all the assembled triangles after clipping
-    for (int t = 0; t < num_triangles_after_clipping; t++) {
-      triangle_t triangle_after_clipping = triangles_after_clipping[t];
+      // Loop all the assembled triangles after clipping
+      for (int t = 0; t < num_triangles_after_clipping; t++) {
+        triangle_t triangle_after_clipping = triangles_after_clipping[t];
 
-      // Projection
-      triangle_t triangle_to_render;
+        // Projection
+        triangle_t triangle_to_render;
 
-      // Loop all three vertices transformed vertices of the triangle and 2D projection
-      for (int j = 0; j < 3; j++) {
-        // Project the current vertex
-        vec4_t projected_vertex = mat4_mul_vec4_project(proj_matrix, triangle_after_clipping.points[j]);
+        // Loop all three vertices transformed vertices of the triangle and 2D projection
+        for (int j = 0; j < 3; j++) {
+          // Project the current vertex
+          vec4_t projected_vertex = mat4_mul_vec4_project(proj_matrix, triangle_after_clipping.points[j]);
 
-        int window_width = get_window_width();
-        int window_height = get_window_height();
+          int render_width = get_render_width();
+          int render_height = get_render_height();
   
-        // Scale the vertex into view
-        projected_vertex.x *= (window_width / 2.0);
-        projected_vertex.y *= (window_height/ 2.0);
+          // Scale the vertex into view
+          projected_vertex.x *= (render_width / 2.0);
+          projected_vertex.y *= (render_height/ 2.0);
 
-        // Invert the y values to account for flipped screen y coordinate
-        projected_vertex.y *= -1;
+          // Invert the y values to account for flipped screen y coordinate
+          projected_vertex.y *= -1;
 
-        // Translate the vertex to the middle of the screen
-        projected_vertex.x += (window_width / 2.0);
-        projected_vertex.y += (window_height / 2.0);
+          // Translate the vertex to the middle of the screen
+          projected_vertex.x += (render_width / 2.0);
+          projected_vertex.y += (render_height / 2.0);
 
-        triangle_to_render.points[j].x = projected_vertex.x;
-        triangle_to_render.points[j].y = projected_vertex.y;
-        triangle_to_render.points[j].z = projected_vertex.z;
-        triangle_to_render.points[j].w = projected_vertex.w;
-      }
+          triangle_to_render.points[j].x = projected_vertex.x;
+          triangle_to_render.points[j].y = projected_vertex.y;
+          triangle_to_render.points[j].z = projected_vertex.z;
+          triangle_to_render.points[j].w = projected_vertex.w;
+        }
 
-      triangle_to_render.texture = mesh->texture;
+        triangle_to_render.texture = mesh->texture;
 
-      triangle_to_render.tex_coords[0].u = triangle_after_clipping.tex_coords[0].u;
-      triangle_to_render.tex_coords[0].v = triangle_after_clipping.tex_coords[0].v;
+        triangle_to_render.tex_coords[0].u = triangle_after_clipping.tex_coords[0].u;
+        triangle_to_render.tex_coords[0].v = triangle_after_clipping.tex_coords[0].v;
 
-      triangle_to_render.tex_coords[1].u = triangle_after_clipping.tex_coords[1].u;
-      triangle_to_render.tex_coords[1].v = triangle_after_clipping.tex_coords[1].v;
+        triangle_to_render.tex_coords[1].u = triangle_after_clipping.tex_coords[1].u;
+        triangle_to_render.tex_coords[1].v = triangle_after_clipping.tex_coords[1].v;
 
-      triangle_to_render.tex_coords[2].u = triangle_after_clipping.tex_coords[2].u;
-      triangle_to_render.tex_coords[2].v = triangle_after_clipping.tex_coords[2].v;
+        triangle_to_render.tex_coords[2].u = triangle_after_clipping.tex_coords[2].u;
+        triangle_to_render.tex_coords[2].v = triangle_after_clipping.tex_coords[2].v;
 
-      // Apply flat shading
-      float light_intensity_factor = -vec3_dot(triangle_normal, get_light_direction());
-      uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
-      triangle_to_render.color = triangle_color;
+        // Apply flat shading
+        float light_intensity_factor = -vec3_dot(triangle_normal, get_light_direction());
+        uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
+        triangle_to_render.color = triangle_color;
 
-      // Save the projected triangle in the array of triangle to render
-      if (num_triangles_to_render < MAX_TRIANGLE_PER_MESH) {
-        triangles_to_render[num_triangles_to_render] = triangle_to_render;
-        num_triangles_to_render++;
+        // Save the projected triangle in the array of triangle to render
+        if (num_triangles_to_render < MAX_TRIANGLE_PER_MESH) {
+          triangles_to_render[num_triangles_to_render] = triangle_to_render;
+          num_triangles_to_render++;
+        }
       }
-    }
-  } 
+    } 
+  }
 }
 
-void update(void) {
-  // Wait some time until the reach the target frame time in milliseconds
-  int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks64() - previous_time_frame);
+///////////////////////////////////////////////////////////////////////////////
+// Compare everything that affects the rendered image with the last frame
+///////////////////////////////////////////////////////////////////////////////
+bool has_scene_changed(void) {
+  scene_snapshot_t scene;
+
+  // Clear the padding too, so snapshots can be compared byte by byte
+  memset(&scene, 0, sizeof(scene));
+
+  scene.camera_position = get_camera_position();
+  scene.camera_yaw = get_camera_yaw();
+  scene.camera_pitch = get_camera_pitch();
+  scene.light_direction = get_light_direction();
+  scene.render_method = get_render_method();
+  scene.cull_method = get_cull_method();
+  scene.num_meshes = get_num_meshes();
+
+  // Compare the interpolated transforms, since those are what gets drawn
+  for (int i = 0; i < scene.num_meshes; i++) {
+    mesh_t mesh = get_interpolated_mesh(i);
+    scene.mesh_transforms[i][0] = mesh.scale;
+    scene.mesh_transforms[i][1] = mesh.rotation;
+    scene.mesh_transforms[i][2] = mesh.translation;
+    scene.mesh_load_states[i] = get_mesh_load_state(i);
+  }
 
-  // Only delay execution if we are running too fast
-  if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
-    SDL_Delay(time_to_wait);
+  if (memcmp(&scene, &rendered_scene, sizeof(scene)) == 0) {
+    return false;
   }
 
-  // Get a delta time factor converted to seconds to be used to update our game objects
-  delta_time = (SDL_GetTicks64() - previous_time_frame) / 1000.0;
+  // Moving the camera or changing how triangles are shaded changes every pixel,
+  // so interlaced rendering can not reuse the pixels of the previous frame
+  bool has_view_changed =
+    memcmp(&scene.camera_position, &rendered_scene.camera_position, sizeof(vec3_t)) != 0 ||
+    scene.camera_yaw != rendered_scene.camera_yaw ||
+    scene.camera_pitch != rendered_scene.camera_pitch ||
+    scene.render_method != rendered_scene.render_method;
 
-  previous_time_frame = SDL_GetTicks64();
+  if (has_view_changed) {
+    set_interlace_history(HISTORY_VIEW_CHANGED);
+  }
 
-  // Reset the total triangles number for next render
-  num_triangles_to_render = 0;
+  rendered_scene = scene;
+  return true;
+}
 
-  // Loop all the meshes of our scene
+///////////////////////////////////////////////////////////////////////////////
+// Frames can only be skipped when they are shown in a window and not captured
+///////////////////////////////////////////////////////////////////////////////
+bool can_skip_frames(void) {
+  return !is_display_headless() && frame_output == NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Advance the simulation by one fixed time step
+///////////////////////////////////////////////////////////////////////////////
+void simulate(float time_step) {
+  save_previous_mesh_transforms();
+
+  // Loop all the meshes of our scene and animate them
   for (int mesh_index = 0; mesh_index < get_num_meshes(); mesh_index++) {
     mesh_t* mesh = get_mesh(mesh_index);
 
     if (is_paused == false) {
-      mesh->rotation.x += 0.0 * delta_time;
-      mesh->rotation.y += 0.0 * delta_time;
-      mesh->rotation.z += 0.0 * delta_time;
+      mesh->rotation.x += 0.0 * time_step;
+      mesh->rotation.y += 0.0 * time_step;
+      mesh->rotation.z += 0.0 * time_step;
 
-      mesh->scale.x += 0.0 * delta_time;
-      mesh->scale.y += 0.0 * delta_time;
-      mesh->scale.z += 0.0 * delta_time;
+      mesh->scale.x += 0.0 * time_step;
+      mesh->scale.y += 0.0 * time_step;
+      mesh->scale.z += 0.0 * time_step;
 
-      mesh->translation.x += 0.0 * delta_time;
-      mesh->translation.y += 0.0 * delta_time;
-      mesh->translation.z += 0.0 * delta_time;
+      mesh->translation.x += 0.0 * time_step;
+      mesh->translation.y += 0.0 * time_step;
+      mesh->translation.z += 0.0 * time_step;
     }
+  }
+}
+
+void update(void) {
+  double frame_time;
+
+  if (is_display_headless()) {
+    // Offscreen frames are rendered as fast as possible with a fixed time step,
+    // so the output sequence does not depend on how fast the machine is
+    frame_time = FIXED_TIME_STEP;
+  } else if (is_idle_frame) {
+    // Time spent waiting for input must not turn into a huge time step
+    reset_frame_pacing();
+    frame_time = FIXED_TIME_STEP;
+  } else {
+    // Wait until the next frame is due, using the high resolution timer
+    frame_time = wait_for_next_frame();
+  }
+
+  // Delta time in seconds used to scale the input handling
+  delta_time = frame_time;
+
+  // Add the meshes and textures loaded since the last frame to the scene
+  poll_asset_loader();
+
+  // Run as many fixed simulation steps as fit in the elapsed time, and keep
+  // the remainder to interpolate the drawn transforms between two steps
+  simulation_time += frame_time;
+  while (simulation_time >= FIXED_TIME_STEP) {
+    simulate(FIXED_TIME_STEP);
+    simulation_time -= FIXED_TIME_STEP;
+  }
+  interpolation_factor = simulation_time / FIXED_TIME_STEP;
+
+  // Skip the whole frame if it would look exactly like the last one
+  bool has_changed = has_scene_changed();
+
+  // The previous frame shows exactly this scene, so all of it can be reused
+  if (!has_changed) {
+    set_interlace_history(HISTORY_STILL);
+  }
+
+  // A still image has all the time it needs, so draw it once more at the
+  // full resolution before going idle
+  if (!has_changed && restore_full_resolution()) {
+    has_changed = true;
+  }
+
+  // Rasterize the other half of an interlaced image of a still scene
+  bool is_completing_frame = !has_changed && is_interlaced_image_incomplete;
+  if (is_completing_frame) {
+    has_changed = true;
+  }
+  is_interlaced_image_incomplete =
+    has_changed && !is_completing_frame && get_interlace_method() != INTERLACE_NONE;
+  is_idle_frame = can_skip_frames() && !has_changed && !is_redraw_requested && !is_asset_loading();
+  is_redraw_requested = false;
+
+  if (is_idle_frame) {
+    return;
+  }
+
+  // Reset the total triangles number for next render
+  num_triangles_to_render = 0;
 
-    // Process graphics pipeline stages for each mesh
-    process_graphics_pipeline_stages(mesh);
+  begin_mesh_stream_frame();
+  for (int mesh_index = 0; mesh_index < get_num_meshes(); mesh_index++) {
+    // Process graphics pipeline stages for each mesh at its interpolated transform
+    mesh_t mesh = get_interpolated_mesh(mesh_index);
+    process_graphics_pipeline_stages(&mesh);
   }
+
+  // Drop the clusters out of view once the streamed geometry exceeds its budget
+  trim_mesh_streams();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Mark the screen area covered by a projected triangle as changed
+///////////////////////////////////////////////////////////////////////////////
+void mark_triangle_dirty_rect(triangle_t* triangle) {
+  float min_x = triangle->points[0].x;
+  float min_y = triangle->points[0].y;
+  float max_x = triangle->points[0].x;
+  float max_y = triangle->points[0].y;
+
+  for (int j = 1; j < 3; j++) {
+    min_x = fminf(min_x, triangle->points[j].x);
+    min_y = fminf(min_y, triangle->points[j].y);
+    max_x = fmaxf(max_x, triangle->points[j].x);
+    max_y = fmaxf(max_y, triangle->points[j].y);
+  }
+
+  // Grow the box by the half size of the rectangles drawn around the vertices
+  mark_dirty_rect(floorf(min_x) - 3, floorf(min_y) - 3, ceilf(max_x) + 3, ceilf(max_y) + 3);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Render function to draw objects on the display
 ///////////////////////////////////////////////////////////////////////////////
 void render(void) {
+  // Keep presenting the last image, nothing would be different
+  if (is_idle_frame) {
+    return;
+  }
+
+  // Mark what this frame draws first, so clearing and uploading the color
+  // buffer can be limited to the area that changed since the last frame
+  for (int i = 0; i < num_triangles_to_render; i++) {
+    mark_triangle_dirty_rect(&triangles_to_render[i]);
+  }
+
   // Clear all the arrays to get ready for the next frame
   clear_color_buffer(0xFF000000);
   clear_z_buffer();
@@ -393,7 +729,15 @@ void render(void) {
       );
     }
 
-    if (should_render_textured_triangle()) {
+    // Meshes whose texture is still loading are drawn with flat colors
+    if (should_render_textured_triangle() && triangle.texture == NULL) {
+      draw_filled_triangle(
+        triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w,
+        triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w,
+        triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w,
+        triangle.color
+      );
+    } else if (should_render_textured_triangle()) {
       draw_textured_triangle(
         triangle.points[0].x, triangle.points[0].y, triangle.points[0].z,
         triangle.points[0].w, triangle.tex_coords[0].u, triangle.tex_coords[0].v,
@@ -433,24 +777,295 @@ void render(void) {
     }
   }
 
-  render_color_buffer();
+  // Time spent drawing this frame, before presenting waits for the display
+  double work_time = get_frame_elapsed_time();
+
+  if (!render_color_buffer()) {
+    fprintf(stderr, "Error acquiring the color buffer for the next frame. \n");
+    is_running = false;
+    return;
+  }
+
+  // Adapt the resolution of the next frame to how long this one took
+  update_dynamic_resolution(work_time);
+
+  rendered_frames++;
+  if (max_frames > 0 && rendered_frames >= max_frames) {
+    is_running = false;
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Free the memory that was dynamically allocated by the program
 ///////////////////////////////////////////////////////////////////////////////
 void free_resources(void) {
+    if (is_frame_sink_open()) {
+      // Wait for the writer thread to flush the queued frames before reporting
+      destroy_frame_sink();
+      frame_sink_stats_t stats = get_frame_sink_stats();
+      fprintf(
+        stderr, "Frames submitted: %d, written: %d, dropped: %d, failed: %d\n",
+        stats.submitted, stats.written, stats.dropped, stats.failed
+      );
+    }
+    mesh_stream_stats_t mesh_stats = get_mesh_stream_stats();
+    if (mesh_stats.streamed_meshes > 0) {
+      fprintf(
+        stderr, "Mesh clusters resident: %d of %d, %.1f of %.1f MiB, paged in: %d, evicted: %d\n",
+        mesh_stats.resident_clusters, mesh_stats.total_clusters,
+        mesh_stats.resident_bytes / 1048576.0, mesh_stats.budget_bytes / 1048576.0,
+        mesh_stats.paged_in, mesh_stats.evicted
+      );
+    }
+    asset_registry_stats_t asset_stats = get_asset_registry_stats();
+    if (asset_stats.shared > 0) {
+      fprintf(
+        stderr, "Assets loaded: %d, shared: %d, in memory: %.1f MiB, cache budget: %.1f MiB, evicted: %d\n",
+        asset_stats.loaded, asset_stats.shared, asset_stats.total_bytes / 1048576.0,
+        asset_stats.budget_bytes / 1048576.0, asset_stats.evicted
+      );
+    }
+    // Stop loading before the meshes being loaded into are freed
+    destroy_asset_loader();
     free_meshes();
+    destroy_asset_registry();
+    destroy_texture_loader();
     destroy_window();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Parse the command line options
+///////////////////////////////////////////////////////////////////////////////
+void print_usage(const char* program) {
+  fprintf(
+    stderr,
+    "Usage: %s [options]\n"
+    "  --width <pixels>      window or offscreen width\n"
+    "  --height <pixels>     window or offscreen height\n"
+    "  --headless            render offscreen without creating a SDL window\n"
+    "  --vsync               present in sync with the display refresh\n"
+    "  --dirty-rects         only clear, redraw and upload the changed screen area\n"
+    "  --bake                write the baked cache of every mesh and exit\n"
+    "  --interlace <mode>    rasterize half of the pixels per frame: checkerboard\n"
+    "                        or scanline\n"
+    "  --texture-filter <f>  nearest, mipmap, bilinear or trilinear\n"
+    "  --texture-wrap <w>    repeat, clamp or mirror\n"
+    "  --shading-rate <n>    texture samples per 1, 2 or 4 pixels along each side,\n"
+    "                        or auto to pick it per triangle\n"
+    "  --min-scale <scale>   lower the render resolution down to this fraction\n"
+    "                        of the window when frames take too long\n"
+    "  --mesh-budget <MiB>   memory for the geometry of baked meshes, larger ones\n"
+    "                        page their clusters in view in and out\n"
+    "  --asset-cache <MiB>   memory for textures and meshes no mesh uses anymore,\n"
+    "                        kept in case they are loaded again\n"
+    "  --frames <count>      number of frames to render before exiting\n"
+    "  --output <prefix>     write frames to <prefix>_<frame>.<format>\n"
+    "  --stream <path>       write all frames into one file, - or |command\n"
+    "  --format <format>     frame file format: raw, ppm or png\n"
+    "  --sink-policy <mode>  block or drop frames when the writer falls behind\n"
+    "  --sink-buffers <n>    number of frames queued for the writer thread\n",
+    program
+  );
+}
+
+bool parse_arguments(int argc, char *argv[]) {
+  int width = 0;
+  int height = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "--headless") == 0) {
+      set_headless(true);
+      continue;
+    }
+
+    if (strcmp(arg, "--vsync") == 0) {
+      is_vsync_enabled = true;
+      set_vsync(true);
+      continue;
+    }
+
+    if (strcmp(arg, "--dirty-rects") == 0) {
+      set_present_method(PRESENT_DIRTY_RECT);
+      continue;
+    }
+
+    if (strcmp(arg, "--bake") == 0) {
+      is_baking = true;
+      continue;
+    }
+
+    // All remaining options take a value
+    if (value == NULL) {
+      print_usage(argv[0]);
+      return false;
+    }
+    i++;
+
+    if (strcmp(arg, "--width") == 0) {
+      width = atoi(value);
+    } else if (strcmp(arg, "--height") == 0) {
+      height = atoi(value);
+    } else if (strcmp(arg, "--interlace") == 0) {
+      if (strcmp(value, "checkerboard") == 0) {
+        set_interlace_method(INTERLACE_CHECKERBOARD);
+      } else if (strcmp(value, "scanline") == 0) {
+        set_interlace_method(INTERLACE_SCANLINE);
+      } else {
+        fprintf(stderr, "Unknown interlace mode %s.\n", value);
+        return false;
+      }
+    } else if (strcmp(arg, "--texture-filter") == 0) {
+      if (strcmp(value, "nearest") == 0) {
+        set_texture_filter(FILTER_NEAREST);
+      } else if (strcmp(value, "mipmap") == 0) {
+        set_texture_filter(FILTER_NEAREST_MIPMAP);
+      } else if (strcmp(value, "bilinear") == 0) {
+        set_texture_filter(FILTER_BILINEAR);
+      } else if (strcmp(value, "trilinear") == 0) {
+        set_texture_filter(FILTER_TRILINEAR);
+      } else {
+        fprintf(stderr, "Unknown texture filter %s.\n", value);
+        return false;
+      }
+    } else if (strcmp(arg, "--texture-wrap") == 0) {
+      if (strcmp(value, "repeat") == 0) {
+        set_texture_wrap(WRAP_REPEAT);
+      } else if (strcmp(value, "clamp") == 0) {
+        set_texture_wrap(WRAP_CLAMP);
+      } else if (strcmp(value, "mirror") == 0) {
+        set_texture_wrap(WRAP_MIRROR);
+      } else {
+        fprintf(stderr, "Unknown texture wrap mode %s.\n", value);
+        return false;
+      }
+    } else if (strcmp(arg, "--shading-rate") == 0) {
+      if (strcmp(value, "auto") == 0) {
+        set_shading_rate(SHADING_RATE_AUTO);
+      } else if (strcmp(value, "1") == 0 || strcmp(value, "2") == 0 || strcmp(value, "4") == 0) {
+        set_shading_rate(atoi(value));
+      } else {
+        fprintf(stderr, "Unknown shading rate %s.\n", value);
+        return false;
+      }
+    } else if (strcmp(arg, "--min-scale") == 0) {
+      min_render_scale = atof(value);
+      if (min_render_scale <= 0 || min_render_scale > 1) {
+        fprintf(stderr, "Render scale %s is not between 0 and 1.\n", value);
+        return false;
+      }
+    } else if (strcmp(arg, "--mesh-budget") == 0) {
+      int budget_mib = atoi(value);
+      if (budget_mib <= 0) {
+        fprintf(stderr, "Mesh memory budget %s is not a positive number of MiB.\n", value);
+        return false;
+      }
+      set_mesh_memory_budget((size_t)budget_mib << 20);
+    } else if (strcmp(arg, "--asset-cache") == 0) {
+      int budget_mib = atoi(value);
+      if (budget_mib < 0 || (budget_mib == 0 && strcmp(value, "0") != 0)) {
+        fprintf(stderr, "Asset cache budget %s is not a number of MiB.\n", value);
+        return false;
+      }
+      set_asset_cache_budget((size_t)budget_mib << 20);
+    } else if (strcmp(arg, "--frames") == 0) {
+      max_frames = atoi(value);
+    } else if (strcmp(arg, "--output") == 0) {
+      frame_output = value;
+      is_frame_output_stream = false;
+    } else if (strcmp(arg, "--stream") == 0) {
+      frame_output = value;
+      is_frame_output_stream = true;
+    } else if (strcmp(arg, "--format") == 0) {
+      frame_output_format = parse_frame_format(value);
+      if (frame_output_format < 0) {
+        fprintf(stderr, "Unknown frame format %s.\n", value);
+        return false;
+      }
+    } else if (strcmp(arg, "--sink-policy") == 0) {
+      if (strcmp(value, "block") == 0) {
+        frame_sink_policy = FRAME_SINK_BLOCK;
+      } else if (strcmp(value, "drop") == 0) {
+        frame_sink_policy = FRAME_SINK_DROP;
+      } else {
+        fprintf(stderr, "Unknown frame sink policy %s.\n", value);
+        return false;
+      }
+    } else if (strcmp(arg, "--sink-buffers") == 0) {
+      frame_sink_buffers = atoi(value);
+    } else {
+      print_usage(argv[0]);
+      return false;
+    }
+  }
+
+  if (width < 0 || height < 0 || max_frames < 0 || frame_sink_buffers <= 0) {
+    print_usage(argv[0]);
+    return false;
+  }
+
+  set_window_size(width, height);
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bake every mesh of the scene into its cache
+///////////////////////////////////////////////////////////////////////////////
+bool bake_scene_meshes(void) {
+  bool is_baked = true;
+
+  for (int i = 0; i < NUM_SCENE_MESHES; i++) {
+    char cache_filepath[1024];
+    get_mesh_cache_filepath(scene_meshes[i].obj_filepath, cache_filepath, sizeof(cache_filepath));
+
+    if (bake_mesh(scene_meshes[i].obj_filepath, scene_meshes[i].png_filepath, cache_filepath)) {
+      fprintf(stderr, "Baked %s\n", cache_filepath);
+    } else {
+      is_baked = false;
+    }
+  }
+  destroy_texture_loader();
+
+  return is_baked;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Main function
 ///////////////////////////////////////////////////////////////////////////////
 int main(int argc, char *argv[]) {
+  if (!parse_arguments(argc, argv)) {
+    return 1;
+  }
+
+  if (is_baking) {
+    return bake_scene_meshes() ? 0 : 1;
+  }
+
   is_running = initialize_window();
 
-  setup();
+  // Pace frames to the display refresh when locked to vsync, else to FPS
+  double frame_period = is_vsync_enabled ? 1.0 / get_refresh_rate() : 1.0 / FPS;
+  init_frame_pacing(frame_period, is_vsync_enabled && !is_display_headless());
+
+  // Captured frames always keep the full resolution
+  if (min_render_scale > 0 && can_skip_frames()) {
+    init_dynamic_resolution(min_render_scale, frame_period);
+  }
+
+  // Captured frames are encoded and written by the frame sink writer thread
+  if (is_running && frame_output != NULL) {
+    is_running = init_frame_sink(
+      frame_output, frame_output_format, is_frame_output_stream,
+      get_window_width(), get_window_height(),
+      frame_sink_buffers, frame_sink_policy
+    );
+  }
+
+  // Setup fails when the asset loader can not be started
+  is_running = setup() && is_running;
 
   while (is_running) {
     process_input();
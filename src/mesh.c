@@ -1,11 +1,17 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <SDL2/SDL.h>
 
 #include "mesh.h"
 #include "array.h"
+#include "asset_registry.h"
+#include "file_map.h"
+#include "mesh_stream.h"
 #include "triangle.h"
 
-#define MAX_NUM_MESHES 10
 static mesh_t meshes[MAX_NUM_MESHES];
 static int mesh_count = 0;
 
@@ -17,88 +23,595 @@ mesh_t* get_mesh(int i) {
   return &meshes[i];
 }
 
+// Add a mesh with no geometry or texture yet, returns its index or -1 when
+// there is no room for another mesh
+int add_mesh(vec3_t scale, vec3_t translation, vec3_t rotation) {
+  if (mesh_count >= MAX_NUM_MESHES) {
+    fprintf(stderr, "Error adding a mesh, at most %d meshes are supported. \n", MAX_NUM_MESHES);
+    return -1;
+  }
+
+  memset(&meshes[mesh_count], 0, sizeof(mesh_t));
+  meshes[mesh_count].scale = scale;
+  meshes[mesh_count].rotation = rotation;
+  meshes[mesh_count].translation = translation;
+  return mesh_count++;
+}
+
+// Add a mesh to the scene, sharing the geometry and texture of its files with
+// the meshes that already use them
 void load_mesh(
   char* obj_filepath, char* png_filepath,
   vec3_t scale, vec3_t translation, vec3_t rotation
 ) {
-  load_mesh_obj_data(obj_filepath, &meshes[mesh_count]);
-  load_mesh_png_data(png_filepath, &meshes[mesh_count]);
-  meshes[mesh_count].scale = scale;
-  meshes[mesh_count].rotation = rotation;
-  meshes[mesh_count].translation = translation;
-  mesh_count++;
+  int index = add_mesh(scale, translation, rotation);
+  if (index < 0) {
+    return;
+  }
+
+  acquire_mesh(obj_filepath, png_filepath, &meshes[index]);
+  if (!open_mesh_stream(&meshes[index])) {
+    release_mesh_assets(&meshes[index]);
+  }
 }
 
-void load_mesh_obj_data(char *obj_filepath, mesh_t* mesh) {
-  FILE *file;
-  file = fopen(obj_filepath, "r");
+///////////////////////////////////////////////////////////////////////////////
+// OBJ files are parsed by hand straight out of the mapped file. Unlike
+// sscanf this reads each number once, never copies a line, and does not
+// depend on the locale.
+///////////////////////////////////////////////////////////////////////////////
+static const double powers_of_ten[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-  char line[1024];
+static inline bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
 
-  tex2_t* texcoords = NULL;
+static const char* skip_spaces(const char* cursor, const char* end) {
+  while (cursor < end && (*cursor == ' ' || *cursor == '\t')) {
+    cursor++;
+  }
+  return cursor;
+}
 
-  while (fgets(line, 512, file)) {
+static const char* skip_line(const char* cursor, const char* end) {
+  const char* line_end = memchr(cursor, '\n', (size_t)(end - cursor));
+  return line_end != NULL ? line_end + 1 : end;
+}
 
-    // Vertex information
-    if (strncmp(line, "v ", 2) == 0) {
-      vec3_t vertex;
-      sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-      array_push(mesh->vertices, vertex);
+// Parse a decimal number with an optional fraction and exponent, returning
+// the cursor past it, or NULL when there is no number at the cursor. Up to
+// 19 significant digits are kept, and numbers of up to 15 digits with small
+// exponents come out exactly as strtof would round them.
+static const char* parse_float(const char* cursor, const char* end, float* value) {
+  bool is_negative = false;
+  if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+    is_negative = *cursor == '-';
+    cursor++;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool has_digits = false;
+
+  for (; cursor < end && is_digit(*cursor); cursor++) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (uint64_t)(*cursor - '0');
+      digits += mantissa != 0;
+    } else {
+      exponent++;
+    }
+    has_digits = true;
+  }
+  if (cursor < end && *cursor == '.') {
+    for (cursor++; cursor < end && is_digit(*cursor); cursor++) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (uint64_t)(*cursor - '0');
+        digits += mantissa != 0;
+        exponent--;
+      }
+      has_digits = true;
     }
+  }
+  if (!has_digits) {
+    return NULL;
+  }
 
-    // Texture coordinate information
-    if (strncmp(line, "vt ", 3) == 0) {
-      tex2_t texcoord;
-      sscanf(line, "vt %f %f", &texcoord.u, &texcoord.v);
-      array_push(texcoords, texcoord);
+  // The exponent only counts when it has digits
+  if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+    const char* exponent_cursor = cursor + 1;
+    bool is_exponent_negative = false;
+    if (exponent_cursor < end && (*exponent_cursor == '-' || *exponent_cursor == '+')) {
+      is_exponent_negative = *exponent_cursor == '-';
+      exponent_cursor++;
     }
+    if (exponent_cursor < end && is_digit(*exponent_cursor)) {
+      int exponent_value = 0;
+      for (; exponent_cursor < end && is_digit(*exponent_cursor); exponent_cursor++) {
+        if (exponent_value < 10000) {
+          exponent_value = exponent_value * 10 + (*exponent_cursor - '0');
+        }
+      }
+      exponent += is_exponent_negative ? -exponent_value : exponent_value;
+      cursor = exponent_cursor;
+    }
+  }
 
-    // Face information
-    if (strncmp(line, "f ", 2) == 0) {
-      int vertex_indices[3];
-      int texture_indices[3];
-      int normal_indices[3];
+  // One multiply or divide by an exact power of ten rounds correctly, the
+  // rare numbers beyond the table are scaled one power at a time
+  double result = (double)mantissa;
+  if (exponent >= -22 && exponent <= 22) {
+    result = exponent < 0 ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+  } else {
+    for (; exponent > 0 && result < 1e39; exponent--) {
+      result *= 10.0;
+    }
+    for (; exponent < 0 && result > 0.0; exponent++) {
+      result /= 10.0;
+    }
+  }
 
-      sscanf(
-        line,
-        "f %d/%d/%d %d/%d/%d %d/%d/%d",
-        &vertex_indices[0], &texture_indices[0], &normal_indices[0],
-        &vertex_indices[1], &texture_indices[1], &normal_indices[1],
-        &vertex_indices[2], &texture_indices[2], &normal_indices[2]
-      );
+  *value = (float)(is_negative ? -result : result);
+  return cursor;
+}
 
-      face_t face = {
-        .a = vertex_indices[0] - 1,
-        .b = vertex_indices[1] - 1,
-        .c = vertex_indices[2] - 1,
-        .a_uv = texcoords[texture_indices[0] - 1],
-        .b_uv = texcoords[texture_indices[1] - 1],
-        .c_uv = texcoords[texture_indices[2] - 1],        
-        .color = 0xFFFFFFFF
-      };
+// Numbers too large for an int are rejected rather than wrapped, so an index
+// can not wrap around into range
+static const char* parse_int(const char* cursor, const char* end, int* value) {
+  bool is_negative = false;
+  if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+    is_negative = *cursor == '-';
+    cursor++;
+  }
+  if (cursor >= end || !is_digit(*cursor)) {
+    return NULL;
+  }
 
-      array_push(mesh->faces, face);
+  int result = 0;
+  for (; cursor < end && is_digit(*cursor); cursor++) {
+    int digit = *cursor - '0';
+    if (result > (INT_MAX - digit) / 10) {
+      return NULL;
     }
+    result = result * 10 + digit;
   }
+  *value = is_negative ? -result : result;
+  return cursor;
+}
+
+// Parse the floats of a "v" or "vt" line, missing ones are left at zero
+static void parse_floats(const char* cursor, const char* end, float* values, int count) {
+  for (int i = 0; i < count; i++) {
+    values[i] = 0;
+  }
+  for (int i = 0; i < count; i++) {
+    cursor = parse_float(skip_spaces(cursor, end), end, &values[i]);
+    if (cursor == NULL) {
+      return;
+    }
+  }
+}
+
+// Parse one v, v/vt, v//vn or v/vt/vn corner of a face. The indices start at
+// 1, negative ones count back from the last element read so far, and a
+// missing texture index is 0.
+static const char* parse_face_corner(const char* cursor, const char* end, int* vertex_index, int* texture_index) {
+  int normal_index;
+
+  *texture_index = 0;
+  cursor = parse_int(skip_spaces(cursor, end), end, vertex_index);
+  if (cursor == NULL || cursor >= end || *cursor != '/') {
+    return cursor;
+  }
+
+  cursor++;
+  if (cursor < end && *cursor != '/') {
+    cursor = parse_int(cursor, end, texture_index);
+    if (cursor == NULL) {
+      return NULL;
+    }
+  }
+  if (cursor < end && *cursor == '/') {
+    const char* normal_cursor = parse_int(cursor + 1, end, &normal_index);
+    cursor = normal_cursor != NULL ? normal_cursor : cursor + 1;
+  }
+  return cursor;
+}
+
+// The array index of an OBJ index given the count of elements read so far,
+// or -1 when it does not refer to one of them
+static int resolve_index(int index, int count) {
+  int resolved = index < 0 ? count + index : index - 1;
+  return resolved >= 0 && resolved < count ? resolved : -1;
+}
+
+enum OBJ_LINE {
+  OBJ_OTHER,
+  OBJ_VERTEX,
+  OBJ_TEXCOORD,
+  OBJ_FACE
+};
+
+static enum OBJ_LINE get_obj_line_type(const char* cursor, const char* end) {
+  size_t length = (size_t)(end - cursor);
+  if (length >= 2 && cursor[0] == 'v' && cursor[1] == ' ') {
+    return OBJ_VERTEX;
+  }
+  if (length >= 3 && cursor[0] == 'v' && cursor[1] == 't' && cursor[2] == ' ') {
+    return OBJ_TEXCOORD;
+  }
+  if (length >= 2 && cursor[0] == 'f' && cursor[1] == ' ') {
+    return OBJ_FACE;
+  }
+  return OBJ_OTHER;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Large files are split at line boundaries into chunks that are parsed in
+// parallel, each into its own arrays. Once every chunk is parsed, prefix
+// sums over the chunk sizes give the vertex counts the faces are resolved
+// against, faces with a vertex index out of range are dropped, and a prefix
+// sum over the faces left gives where each chunk lands in the mesh. Faces
+// are resolved and chunks joined in parallel too. The result is the same as
+// parsing the whole file in one go.
+///////////////////////////////////////////////////////////////////////////////
+#define MAX_OBJ_CHUNKS 32
+#define MIN_OBJ_CHUNK_SIZE (1 << 20)
+
+// A face as written in the file, along with how many vertices and texture
+// coordinates its chunk had read before it, which is what relative indices
+// and the range checks need once the chunk offsets are known. Resolving the
+// face turns its vertex indices into indices into the vertices of the file.
+typedef struct {
+  int vertex_indices[3];
+  int texture_indices[3];
+  int num_vertices;
+  int num_texcoords;
+} obj_face_t;
+
+typedef struct {
+  const char* start;
+  const char* end;
+  vec3_t* vertices;
+  tex2_t* texcoords;
+  obj_face_t* faces;
+  int first_vertex;             // offsets of the chunk elements in the file
+  int first_texcoord;
+  int first_face;
+  int num_valid_faces;          // faces left by resolve_obj_chunk
+  mesh_t* mesh;                 // filled in by join_obj_chunk
+  int mesh_first_vertex;        // vertices the mesh had before this file
+  const tex2_t* file_texcoords; // texture coordinates of the whole file
+} obj_chunk_t;
+
+static int parse_obj_chunk(void* data) {
+  obj_chunk_t* chunk = (obj_chunk_t*)data;
+  const char* end = chunk->end;
+
+  // Count the elements first, so every array is allocated once at its size
+  int num_vertices = 0;
+  int num_texcoords = 0;
+  int num_faces = 0;
+
+  for (const char* cursor = chunk->start; cursor < end; cursor = skip_line(cursor, end)) {
+    switch (get_obj_line_type(cursor, end)) {
+      case OBJ_VERTEX: num_vertices++; break;
+      case OBJ_TEXCOORD: num_texcoords++; break;
+      case OBJ_FACE: num_faces++; break;
+      default: break;
+    }
+  }
+
+  chunk->vertices = array_reserve(chunk->vertices, num_vertices, sizeof(vec3_t));
+  chunk->texcoords = array_reserve(chunk->texcoords, num_texcoords, sizeof(tex2_t));
+  chunk->faces = array_reserve(chunk->faces, num_faces, sizeof(obj_face_t));
+
+  for (const char* cursor = chunk->start; cursor < end; cursor = skip_line(cursor, end)) {
+    const char* line_end = skip_line(cursor, end);
+
+    switch (get_obj_line_type(cursor, end)) {
+      // Vertex information
+      case OBJ_VERTEX: {
+        vec3_t vertex;
+        parse_floats(cursor + 2, line_end, &vertex.x, 3);
+        array_push(chunk->vertices, vertex);
+        break;
+      }
+
+      // Texture coordinate information
+      case OBJ_TEXCOORD: {
+        tex2_t texcoord;
+        parse_floats(cursor + 3, line_end, &texcoord.u, 2);
+        array_push(chunk->texcoords, texcoord);
+        break;
+      }
+
+      // Face information, the first three corners of the face
+      case OBJ_FACE: {
+        obj_face_t face = {
+          .vertex_indices = { 0, 0, 0 },
+          .texture_indices = { 0, 0, 0 },
+          .num_vertices = array_length(chunk->vertices),
+          .num_texcoords = array_length(chunk->texcoords)
+        };
+        const char* corner = cursor + 2;
 
+        for (int i = 0; i < 3 && corner != NULL; i++) {
+          corner = parse_face_corner(corner, line_end, &face.vertex_indices[i], &face.texture_indices[i]);
+        }
+
+        array_push(chunk->faces, face);
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  return 0;
+}
+
+// Resolve the vertex indices of the chunk faces against the vertices of the
+// file read before each face, a face with any index out of range is marked
+// with a first index of -1 and left out of the mesh
+static int resolve_obj_chunk(void* data) {
+  obj_chunk_t* chunk = (obj_chunk_t*)data;
+
+  chunk->num_valid_faces = 0;
+  int num_faces = array_length(chunk->faces);
+  for (int i = 0; i < num_faces; i++) {
+    obj_face_t* face = &chunk->faces[i];
+    int vertex_count = chunk->first_vertex + face->num_vertices;
+    bool is_valid = true;
+
+    for (int j = 0; j < 3; j++) {
+      face->vertex_indices[j] = resolve_index(face->vertex_indices[j], vertex_count);
+      is_valid = is_valid && face->vertex_indices[j] >= 0;
+    }
+    if (!is_valid) {
+      face->vertex_indices[0] = -1;
+      continue;
+    }
+    chunk->num_valid_faces++;
+  }
+
+  return 0;
+}
+
+// Copy the chunk vertices and its resolved faces into the mesh, texture
+// indices out of range leave the coordinates of the corner at zero
+static int join_obj_chunk(void* data) {
+  obj_chunk_t* chunk = (obj_chunk_t*)data;
+  mesh_t* mesh = chunk->mesh;
+
+  int num_vertices = array_length(chunk->vertices);
+  if (num_vertices > 0) {
+    memcpy(
+      &mesh->vertices[chunk->mesh_first_vertex + chunk->first_vertex],
+      chunk->vertices, num_vertices * sizeof(vec3_t)
+    );
+  }
+
+  int num_faces = array_length(chunk->faces);
+  int next_face = chunk->first_face;
+  for (int i = 0; i < num_faces; i++) {
+    const obj_face_t* face = &chunk->faces[i];
+    int texcoord_count = chunk->first_texcoord + face->num_texcoords;
+    if (face->vertex_indices[0] < 0) {
+      continue;
+    }
+
+    tex2_t uvs[3] = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+    for (int j = 0; j < 3; j++) {
+      int index = resolve_index(face->texture_indices[j], texcoord_count);
+      if (index >= 0) {
+        uvs[j] = chunk->file_texcoords[index];
+      }
+    }
+
+    mesh->faces[next_face++] = (face_t) {
+      .a = chunk->mesh_first_vertex + face->vertex_indices[0],
+      .b = chunk->mesh_first_vertex + face->vertex_indices[1],
+      .c = chunk->mesh_first_vertex + face->vertex_indices[2],
+      .a_uv = uvs[0],
+      .b_uv = uvs[1],
+      .c_uv = uvs[2],
+      .color = 0xFFFFFFFF
+    };
+  }
+
+  return 0;
+}
+
+// Run the first chunk on the calling thread and the others on their own,
+// any chunk whose thread cannot be started runs on the calling thread too
+static void run_obj_chunks(obj_chunk_t* chunks, int num_chunks, SDL_ThreadFunction function) {
+  SDL_Thread* threads[MAX_OBJ_CHUNKS] = { NULL };
+
+  for (int i = 1; i < num_chunks; i++) {
+    threads[i] = SDL_CreateThread(function, "obj_loader", &chunks[i]);
+  }
+  function(&chunks[0]);
+  for (int i = 1; i < num_chunks; i++) {
+    if (threads[i] != NULL) {
+      SDL_WaitThread(threads[i], NULL);
+    } else {
+      function(&chunks[i]);
+    }
+  }
+}
+
+void load_mesh_obj_data(const char* obj_filepath, mesh_t* mesh) {
+  file_map_t file;
+  if (!map_file(obj_filepath, &file)) {
+    fprintf(stderr, "Error opening mesh %s. \n", obj_filepath);
+    return;
+  }
+
+  const char* start = (const char*)file.data;
+  const char* end = start + file.size;
+
+  // One chunk per core, but no chunk smaller than MIN_OBJ_CHUNK_SIZE, so
+  // small files are parsed on the calling thread alone
+  size_t num_chunks = file.size / MIN_OBJ_CHUNK_SIZE;
+  if (num_chunks > (size_t)SDL_GetCPUCount()) num_chunks = (size_t)SDL_GetCPUCount();
+  if (num_chunks > MAX_OBJ_CHUNKS) num_chunks = MAX_OBJ_CHUNKS;
+  if (num_chunks < 1) num_chunks = 1;
+
+  obj_chunk_t chunks[MAX_OBJ_CHUNKS];
+  memset(chunks, 0, sizeof(chunks));
+
+  const char* cursor = start;
+  for (size_t i = 0; i < num_chunks; i++) {
+    chunks[i].start = cursor;
+    if (i + 1 < num_chunks) {
+      const char* split = start + file.size / num_chunks * (i + 1);
+      cursor = skip_line(split > cursor ? split : cursor, end);
+    } else {
+      cursor = end;
+    }
+    chunks[i].end = cursor;
+  }
+
+  run_obj_chunks(chunks, (int)num_chunks, parse_obj_chunk);
+
+  // Prefix sums of the chunk sizes place every chunk in the mesh
+  int num_vertices = 0;
+  int num_texcoords = 0;
+  int num_faces = 0;
+  int num_file_faces = 0;
+
+  for (size_t i = 0; i < num_chunks; i++) {
+    chunks[i].first_vertex = num_vertices;
+    chunks[i].first_texcoord = num_texcoords;
+    num_vertices += array_length(chunks[i].vertices);
+    num_texcoords += array_length(chunks[i].texcoords);
+    num_file_faces += array_length(chunks[i].faces);
+  }
+
+  run_obj_chunks(chunks, (int)num_chunks, resolve_obj_chunk);
+
+  for (size_t i = 0; i < num_chunks; i++) {
+    chunks[i].first_face = num_faces;
+    num_faces += chunks[i].num_valid_faces;
+  }
+  if (num_faces < num_file_faces) {
+    fprintf(
+      stderr, "Error in mesh %s, skipped %d faces with vertex indices out of range. \n",
+      obj_filepath, num_file_faces - num_faces
+    );
+  }
+
+  // Faces of any chunk may use texture coordinates of any earlier chunk, so
+  // those are joined before the chunks are
+  tex2_t* texcoords = NULL;
+  texcoords = array_reserve(texcoords, num_texcoords, sizeof(tex2_t));
+  texcoords = array_hold(texcoords, num_texcoords, sizeof(tex2_t));
+  for (size_t i = 0; i < num_chunks; i++) {
+    if (array_length(chunks[i].texcoords) > 0) {
+      memcpy(
+        &texcoords[chunks[i].first_texcoord],
+        chunks[i].texcoords, array_length(chunks[i].texcoords) * sizeof(tex2_t)
+      );
+    }
+  }
+
+  int mesh_first_vertex = array_length(mesh->vertices);
+  int mesh_first_face = array_length(mesh->faces);
+  mesh->vertices = array_reserve(mesh->vertices, num_vertices, sizeof(vec3_t));
+  mesh->vertices = array_hold(mesh->vertices, num_vertices, sizeof(vec3_t));
+  mesh->faces = array_reserve(mesh->faces, num_faces, sizeof(face_t));
+  mesh->faces = array_hold(mesh->faces, num_faces, sizeof(face_t));
+
+  for (size_t i = 0; i < num_chunks; i++) {
+    chunks[i].mesh = mesh;
+    chunks[i].mesh_first_vertex = mesh_first_vertex;
+    chunks[i].first_face += mesh_first_face;
+    chunks[i].file_texcoords = texcoords;
+  }
+
+  run_obj_chunks(chunks, (int)num_chunks, join_obj_chunk);
+
+  for (size_t i = 0; i < num_chunks; i++) {
+    array_free(chunks[i].vertices);
+    array_free(chunks[i].texcoords);
+    array_free(chunks[i].faces);
+  }
   array_free(texcoords);
-  fclose(file);
+  unmap_file(&file);
+}
+
+void load_mesh_png_data(const char* png_filepath, mesh_t* mesh) {
+  mesh->texture = load_png_texture(png_filepath);
 }
 
-void load_mesh_png_data(char *png_filepath, mesh_t* mesh) {
-  upng_t* png_image = upng_new_from_file(png_filepath);
-  if (png_image != NULL) {
-    upng_decode(png_image);
-    if (upng_get_error(png_image) == UPNG_EOK) {
-      mesh->texture = png_image;
+///////////////////////////////////////////////////////////////////////////////
+// Face normals and the bounding box, in model space. The normal of a face is
+// the cross product of its normalized edges from A to B and from A to C, and
+// is what the renderer culls and shades the face with.
+///////////////////////////////////////////////////////////////////////////////
+void compute_mesh_normals_and_bounds(mesh_t* mesh) {
+  int num_vertices = array_length(mesh->vertices);
+  int num_faces = array_length(mesh->faces);
+
+  mesh->bounds_min = vec3_new(0, 0, 0);
+  mesh->bounds_max = vec3_new(0, 0, 0);
+  for (int i = 0; i < num_vertices; i++) {
+    vec3_t vertex = mesh->vertices[i];
+    if (i == 0) {
+      mesh->bounds_min = vertex;
+      mesh->bounds_max = vertex;
+      continue;
     }
+    if (vertex.x < mesh->bounds_min.x) mesh->bounds_min.x = vertex.x;
+    if (vertex.y < mesh->bounds_min.y) mesh->bounds_min.y = vertex.y;
+    if (vertex.z < mesh->bounds_min.z) mesh->bounds_min.z = vertex.z;
+    if (vertex.x > mesh->bounds_max.x) mesh->bounds_max.x = vertex.x;
+    if (vertex.y > mesh->bounds_max.y) mesh->bounds_max.y = vertex.y;
+    if (vertex.z > mesh->bounds_max.z) mesh->bounds_max.z = vertex.z;
+  }
+
+  array_free(mesh->normals);
+  mesh->normals = NULL;
+  mesh->normals = array_reserve(mesh->normals, num_faces, sizeof(vec3_t));
+  for (int i = 0; i < num_faces; i++) {
+    vec3_t vector_a = mesh->vertices[mesh->faces[i].a];
+    vec3_t vector_ab = vec3_sub(mesh->vertices[mesh->faces[i].b], vector_a);
+    vec3_normalize(&vector_ab);
+    vec3_t vector_ac = vec3_sub(mesh->vertices[mesh->faces[i].c], vector_a);
+    vec3_normalize(&vector_ac);
+
+    vec3_t normal = vec3_cross(vector_ab, vector_ac);
+    vec3_normalize(&normal);
+    array_push(mesh->normals, normal);
   }
 }
 
+// Give shared geometry and textures back to the asset registry, and release
+// what the mesh owns, baked meshes only own their mapping
+void free_mesh(mesh_t* mesh) {
+  close_mesh_stream(mesh);
+  release_mesh_assets(mesh);
+  free_texture(mesh->texture);
+  if (mesh->cache.data != NULL) {
+    unmap_file(&mesh->cache);
+  } else {
+    array_free(mesh->faces);
+    array_free(mesh->vertices);
+    array_free(mesh->normals);
+  }
+  mesh->texture = NULL;
+  mesh->faces = NULL;
+  mesh->vertices = NULL;
+  mesh->normals = NULL;
+}
+
 void free_meshes(void) {
   for (int i = 0; i < mesh_count; i++) {
-    upng_free(meshes[i].texture);
-    array_free(meshes[i].faces);
-    array_free(meshes[mesh_count].vertices);
+    free_mesh(&meshes[i]);
   }
-}
\ No newline at end of file
+}
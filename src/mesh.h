@@ -1,16 +1,50 @@
 #pragma once
 
+#include <stdbool.h>
+
+#include "file_map.h"
 #include "triangle.h"
 #include "vector.h"
-#include "upng.h"
+#include "texture.h"
+
+#define MAX_NUM_MESHES 10
+
+// A spatially coherent run of faces of a baked mesh, along with the run of
+// vertices only those faces use, which are paged in and out together
+typedef struct {
+  vec3_t center;        // bounding sphere of the cluster in model space
+  float radius;
+  int first_face;
+  int num_faces;
+  int first_vertex;
+  int num_vertices;
+} mesh_cluster_t;
+
+// Streaming state of a cluster, kept by the stream of the mapping and shared
+// by every mesh on that mapping
+typedef struct {
+  int last_used_frame;  // last frame the cluster was in view
+  float distance;       // distance to the camera when it was last in view
+  bool is_resident;
+  bool is_checked;      // faces were checked against the cluster vertices
+  bool is_corrupt;      // some face uses a vertex outside the cluster
+} mesh_cluster_state_t;
 
 typedef struct {
   face_t* faces;        // mesh dynamic array of faces
   vec3_t* vertices;     // mesh dynamic array of vertices
-  upng_t* texture;      // mesh PNG texture pointer 
+  vec3_t* normals;      // mesh dynamic array of face normals in model space
+  vec3_t bounds_min;    // model space bounding box of the vertices
+  vec3_t bounds_max;
+  texture_t* texture;   // mesh texture with its mipmaps
   vec3_t scale;         // mesh scale with x, y, & z axis
   vec3_t rotation;      // mesh rotation of x, y & z axis
   vec3_t translation;   // mesh translation with x, y & z axis
+  mesh_cluster_t* clusters;               // clusters of a baked mesh, else NULL
+  mesh_cluster_state_t* cluster_states;   // streaming state of each cluster, shared
+  file_map_t cache;     // baked asset the arrays and texture point into, if any
+  struct asset* geometry_asset;   // shared asset the geometry belongs to, if any
+  struct asset* texture_asset;    // shared asset the texture belongs to, if any
 } mesh_t;
 
 void load_mesh(
@@ -21,10 +55,15 @@ void load_mesh(
   vec3_t rotation
 );
 
+int add_mesh(vec3_t scale, vec3_t translation, vec3_t rotation);
+
 int get_num_meshes(void);
 mesh_t* get_mesh(int i);
 
-void load_mesh_obj_data(char *obj_filepath, mesh_t* mesh);
-void load_mesh_png_data(char *png_filepath, mesh_t* mesh);
+void load_mesh_obj_data(const char* obj_filepath, mesh_t* mesh);
+void load_mesh_png_data(const char* png_filepath, mesh_t* mesh);
+void compute_mesh_normals_and_bounds(mesh_t* mesh);
+
+void free_mesh(mesh_t* mesh);
 
 void free_meshes(void);
\ No newline at end of file
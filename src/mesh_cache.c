@@ -0,0 +1,492 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh_cache.h"
+#include "array.h"
+#include "file_map.h"
+#include "mesh_stream.h"
+#include "texture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// A baked mesh file is a header followed by the cluster, texture, vertex,
+// face and normal sections, each starting on a cache line. The array
+// sections start with the capacity and length ints array.h keeps in front
+// of the items, so the mesh arrays point straight into the mapping. The
+// texture section is the tiled mipmap chain of texture_t. The vertices,
+// faces and normals are the geometry, which is checked and paged in whole
+// only when it fits the memory budget, else cluster by cluster as they come
+// into view. Numbers are stored in the byte order and struct layout of the
+// machine that baked the file, which the header records so a file from
+// another machine is rejected instead of misread.
+///////////////////////////////////////////////////////////////////////////////
+
+// The cache of "assets/drone.obj" is "assets/drone.t3d"
+void get_mesh_cache_filepath(const char* obj_filepath, char* cache_filepath, size_t size) {
+  const char* extension = strrchr(obj_filepath, '.');
+  const char* separator = strrchr(obj_filepath, '/');
+  int length = (extension != NULL && (separator == NULL || extension > separator))
+    ? (int)(extension - obj_filepath)
+    : (int)strlen(obj_filepath);
+  snprintf(cache_filepath, size, "%.*s%s", length, obj_filepath, MESH_CACHE_EXTENSION);
+}
+
+static size_t align_offset(size_t offset) {
+  return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(size_t)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+// A source that changed since the bake makes the file stale, one that is
+// missing does not, so baked assets can ship without their sources
+static bool is_source_changed(const char* filepath, int64_t baked_size, int64_t baked_mtime) {
+  int64_t size;
+  int64_t mtime;
+  return get_file_stamp(filepath, &size, &mtime) && (size != baked_size || mtime != baked_mtime);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Meshes larger than one cluster are split into clusters of faces that are
+// close together, by sorting the faces along a Morton curve through their
+// centroids. Every cluster gets its own copy of the vertices it uses, so
+// the geometry of a cluster is one run of faces and one run of vertices.
+///////////////////////////////////////////////////////////////////////////////
+#define MESH_CLUSTER_FACES 4096
+
+typedef struct {
+  vec3_t* vertices;
+  face_t* faces;
+  vec3_t* normals;
+  mesh_cluster_t* clusters;
+} clustered_mesh_t;
+
+typedef struct {
+  uint32_t code;
+  int face;
+} face_key_t;
+
+// Spread the low 10 bits of x out to every third bit
+static uint32_t spread_bits(uint32_t x) {
+  x &= 0x3FF;
+  x = (x | (x << 16)) & 0x030000FF;
+  x = (x | (x << 8)) & 0x0300F00F;
+  x = (x | (x << 4)) & 0x030C30C3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+static uint32_t quantize(float value, float min, float max) {
+  float t = max > min ? (value - min) / (max - min) : 0;
+  return t <= 0 ? 0 : t >= 1 ? 1023 : (uint32_t)(t * 1023);
+}
+
+static int compare_face_keys(const void* a, const void* b) {
+  const face_key_t* key_a = (const face_key_t*)a;
+  const face_key_t* key_b = (const face_key_t*)b;
+  if (key_a->code != key_b->code) {
+    return key_a->code < key_b->code ? -1 : 1;
+  }
+  return key_a->face - key_b->face;
+}
+
+// Bounding sphere around the center of the box of the cluster vertices
+static void bound_cluster(mesh_cluster_t* cluster, const vec3_t* vertices) {
+  vec3_t min = vertices[cluster->first_vertex];
+  vec3_t max = min;
+  for (int i = 1; i < cluster->num_vertices; i++) {
+    vec3_t vertex = vertices[cluster->first_vertex + i];
+    if (vertex.x < min.x) min.x = vertex.x;
+    if (vertex.y < min.y) min.y = vertex.y;
+    if (vertex.z < min.z) min.z = vertex.z;
+    if (vertex.x > max.x) max.x = vertex.x;
+    if (vertex.y > max.y) max.y = vertex.y;
+    if (vertex.z > max.z) max.z = vertex.z;
+  }
+
+  cluster->center = vec3_mul(vec3_add(min, max), 0.5f);
+  cluster->radius = 0;
+  for (int i = 0; i < cluster->num_vertices; i++) {
+    vec3_t offset = vec3_sub(vertices[cluster->first_vertex + i], cluster->center);
+    float radius = vec3_length(&offset);
+    if (radius > cluster->radius) {
+      cluster->radius = radius;
+    }
+  }
+}
+
+static bool build_clusters(const mesh_t* mesh, clustered_mesh_t* result) {
+  int num_vertices = array_length(mesh->vertices);
+  int num_faces = array_length(mesh->faces);
+
+  memset(result, 0, sizeof(*result));
+  for (int i = 0; i < num_faces; i++) {
+    const face_t* face = &mesh->faces[i];
+    if (
+      face->a < 0 || face->a >= num_vertices ||
+      face->b < 0 || face->b >= num_vertices ||
+      face->c < 0 || face->c >= num_vertices
+    ) {
+      return false;
+    }
+  }
+
+  // A small mesh is a single cluster in the order of its file
+  if (num_faces <= MESH_CLUSTER_FACES) {
+    mesh_cluster_t cluster = { { 0, 0, 0 }, 0, 0, num_faces, 0, num_vertices };
+    if (num_vertices > 0) {
+      bound_cluster(&cluster, mesh->vertices);
+    }
+    result->vertices = array_hold(result->vertices, num_vertices, sizeof(vec3_t));
+    result->faces = array_hold(result->faces, num_faces, sizeof(face_t));
+    result->normals = array_hold(result->normals, num_faces, sizeof(vec3_t));
+    memcpy(result->vertices, mesh->vertices, (size_t)num_vertices * sizeof(vec3_t));
+    memcpy(result->faces, mesh->faces, (size_t)num_faces * sizeof(face_t));
+    memcpy(result->normals, mesh->normals, (size_t)num_faces * sizeof(vec3_t));
+    array_push(result->clusters, cluster);
+    return true;
+  }
+
+  face_key_t* keys = (face_key_t*)malloc(sizeof(face_key_t) * num_faces);
+  int* vertex_cluster = (int*)malloc(sizeof(int) * num_vertices);
+  int* vertex_index = (int*)malloc(sizeof(int) * num_vertices);
+  if (keys == NULL || vertex_cluster == NULL || vertex_index == NULL) {
+    free(keys);
+    free(vertex_cluster);
+    free(vertex_index);
+    return false;
+  }
+
+  for (int i = 0; i < num_faces; i++) {
+    const face_t* face = &mesh->faces[i];
+    vec3_t centroid = vec3_div(
+      vec3_add(vec3_add(mesh->vertices[face->a], mesh->vertices[face->b]), mesh->vertices[face->c]), 3
+    );
+    keys[i].code =
+      (spread_bits(quantize(centroid.x, mesh->bounds_min.x, mesh->bounds_max.x)) << 2) |
+      (spread_bits(quantize(centroid.y, mesh->bounds_min.y, mesh->bounds_max.y)) << 1) |
+      spread_bits(quantize(centroid.z, mesh->bounds_min.z, mesh->bounds_max.z));
+    keys[i].face = i;
+  }
+  qsort(keys, num_faces, sizeof(face_key_t), compare_face_keys);
+
+  for (int i = 0; i < num_vertices; i++) {
+    vertex_cluster[i] = -1;
+  }
+
+  int num_clusters = (num_faces + MESH_CLUSTER_FACES - 1) / MESH_CLUSTER_FACES;
+  result->faces = array_reserve(result->faces, num_faces, sizeof(face_t));
+  result->normals = array_reserve(result->normals, num_faces, sizeof(vec3_t));
+  result->clusters = array_reserve(result->clusters, num_clusters, sizeof(mesh_cluster_t));
+
+  for (int c = 0; c < num_clusters; c++) {
+    mesh_cluster_t cluster;
+    cluster.first_face = c * MESH_CLUSTER_FACES;
+    cluster.num_faces = num_faces - cluster.first_face < MESH_CLUSTER_FACES
+      ? num_faces - cluster.first_face
+      : MESH_CLUSTER_FACES;
+    cluster.first_vertex = array_length(result->vertices);
+
+    for (int i = cluster.first_face; i < cluster.first_face + cluster.num_faces; i++) {
+      face_t face = mesh->faces[keys[i].face];
+      int* corners[3] = { &face.a, &face.b, &face.c };
+
+      for (int j = 0; j < 3; j++) {
+        int vertex = *corners[j];
+        if (vertex_cluster[vertex] != c) {
+          vertex_cluster[vertex] = c;
+          vertex_index[vertex] = array_length(result->vertices);
+          array_push(result->vertices, mesh->vertices[vertex]);
+        }
+        *corners[j] = vertex_index[vertex];
+      }
+      array_push(result->faces, face);
+      array_push(result->normals, mesh->normals[keys[i].face]);
+    }
+
+    cluster.num_vertices = array_length(result->vertices) - cluster.first_vertex;
+    bound_cluster(&cluster, result->vertices);
+    array_push(result->clusters, cluster);
+  }
+
+  free(keys);
+  free(vertex_cluster);
+  free(vertex_index);
+  return true;
+}
+
+static void free_clusters(clustered_mesh_t* clustered) {
+  array_free(clustered->vertices);
+  array_free(clustered->faces);
+  array_free(clustered->normals);
+  array_free(clustered->clusters);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bake a mesh from its OBJ and PNG files. The file is written next to its
+// final path and renamed over it once complete, so a running loader never
+// maps a half written file.
+///////////////////////////////////////////////////////////////////////////////
+static size_t write_array_section(unsigned char* data, uint64_t offset, const void* items, int count, int item_size) {
+  int counts[2] = { count, count };
+  memcpy(&data[offset], counts, sizeof(counts));
+  if (count > 0) {
+    memcpy(&data[offset + sizeof(counts)], items, (size_t)count * item_size);
+  }
+  return sizeof(counts) + (size_t)count * item_size;
+}
+
+static size_t get_array_section_size(int count, int item_size) {
+  return sizeof(int) * 2 + (size_t)count * item_size;
+}
+
+bool bake_mesh(char* obj_filepath, char* png_filepath, const char* cache_filepath) {
+  mesh_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+
+  if (
+    !get_file_stamp(obj_filepath, &header.obj_size, &header.obj_mtime) ||
+    !get_file_stamp(png_filepath, &header.png_size, &header.png_mtime)
+  ) {
+    fprintf(stderr, "Error baking mesh %s, its sources cannot be read. \n", cache_filepath);
+    return false;
+  }
+
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+  load_mesh_obj_data(obj_filepath, &mesh);
+  load_mesh_png_data(png_filepath, &mesh);
+  if (mesh.faces == NULL || mesh.texture == NULL) {
+    fprintf(stderr, "Error baking mesh %s, its sources cannot be loaded. \n", cache_filepath);
+    free_mesh(&mesh);
+    return false;
+  }
+  compute_mesh_normals_and_bounds(&mesh);
+
+  clustered_mesh_t clustered;
+  if (!build_clusters(&mesh, &clustered)) {
+    fprintf(stderr, "Error baking mesh %s, its faces use vertices that do not exist. \n", cache_filepath);
+    free_clusters(&clustered);
+    free_mesh(&mesh);
+    return false;
+  }
+
+  memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+  header.version = MESH_CACHE_VERSION;
+  header.byte_order = MESH_CACHE_BYTE_ORDER;
+  header.face_size = sizeof(face_t);
+  header.bounds_min = mesh.bounds_min;
+  header.bounds_max = mesh.bounds_max;
+  header.num_vertices = array_length(clustered.vertices);
+  header.num_faces = array_length(clustered.faces);
+  header.num_clusters = array_length(clustered.clusters);
+  header.texture_width = mesh.texture->levels[0].width;
+  header.texture_height = mesh.texture->levels[0].height;
+  header.num_levels = mesh.texture->num_levels;
+
+  size_t texture_size = get_texture_pixel_count(mesh.texture) * sizeof(uint32_t);
+  size_t offset = align_offset(sizeof(header));
+  header.clusters_offset = offset;
+  offset = align_offset(offset + get_array_section_size(header.num_clusters, sizeof(mesh_cluster_t)));
+  header.texture_offset = offset;
+  offset = align_offset(offset + texture_size);
+  header.vertices_offset = offset;
+  offset = align_offset(offset + get_array_section_size(header.num_vertices, sizeof(vec3_t)));
+  header.faces_offset = offset;
+  offset = align_offset(offset + get_array_section_size(header.num_faces, sizeof(face_t)));
+  header.normals_offset = offset;
+  header.file_size = offset + get_array_section_size(header.num_faces, sizeof(vec3_t));
+
+  unsigned char* data = (unsigned char*)calloc(1, header.file_size);
+  if (data == NULL) {
+    fprintf(stderr, "Error baking mesh %s, out of memory. \n", cache_filepath);
+    free_clusters(&clustered);
+    free_mesh(&mesh);
+    return false;
+  }
+
+  write_array_section(data, header.clusters_offset, clustered.clusters, header.num_clusters, sizeof(mesh_cluster_t));
+  memcpy(&data[header.texture_offset], mesh.texture->memory, texture_size);
+  write_array_section(data, header.vertices_offset, clustered.vertices, header.num_vertices, sizeof(vec3_t));
+  write_array_section(data, header.faces_offset, clustered.faces, header.num_faces, sizeof(face_t));
+  write_array_section(data, header.normals_offset, clustered.normals, header.num_faces, sizeof(vec3_t));
+  free_clusters(&clustered);
+  free_mesh(&mesh);
+
+  header.checksum = get_data_checksum(&data[sizeof(header)], header.vertices_offset - sizeof(header));
+  header.geometry_checksum = get_data_checksum(&data[header.vertices_offset], header.file_size - header.vertices_offset);
+  memcpy(data, &header, sizeof(header));
+
+  char temp_filepath[1024];
+  snprintf(temp_filepath, sizeof(temp_filepath), "%s.tmp", cache_filepath);
+
+  FILE* file = fopen(temp_filepath, "wb");
+  bool is_written = file != NULL && fwrite(data, 1, header.file_size, file) == header.file_size;
+  if (file != NULL && fclose(file) != 0) {
+    is_written = false;
+  }
+  free(data);
+
+  if (!is_written || rename(temp_filepath, cache_filepath) != 0) {
+    fprintf(stderr, "Error writing baked mesh %s. \n", cache_filepath);
+    remove(temp_filepath);
+    return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load a baked mesh by mapping it and pointing the mesh arrays and texture
+// into the mapping. Returns false, leaving the mesh untouched, when the file
+// is missing, stale, from another machine or corrupt. Geometry larger than
+// the memory budget is streamed, its cluster table is checked at load and
+// the faces of each cluster when the cluster is first paged in.
+///////////////////////////////////////////////////////////////////////////////
+static bool is_section_in_file(const mesh_cache_header_t* header, uint64_t offset, size_t size) {
+  return offset >= sizeof(*header) && offset <= header->file_size && size <= header->file_size - offset;
+}
+
+// The clusters cover the faces and vertices in order, each count is checked
+// against what is left before it is added, so no sum can overflow
+static bool are_clusters_valid(const mesh_cache_header_t* header, const mesh_cluster_t* clusters) {
+  int next_face = 0;
+  int next_vertex = 0;
+
+  for (int i = 0; i < header->num_clusters; i++) {
+    if (
+      clusters[i].first_face != next_face || clusters[i].num_faces < 0 ||
+      clusters[i].num_faces > header->num_faces - next_face ||
+      clusters[i].first_vertex != next_vertex || clusters[i].num_vertices < 0 ||
+      clusters[i].num_vertices > header->num_vertices - next_vertex
+    ) {
+      return false;
+    }
+    next_face += clusters[i].num_faces;
+    next_vertex += clusters[i].num_vertices;
+  }
+  return next_face == header->num_faces && next_vertex == header->num_vertices;
+}
+
+// The faces of a cluster only use the vertices of the cluster, a face that
+// does not would make the renderer read outside the mapping
+bool is_baked_cluster_valid(const mesh_t* mesh, int index) {
+  const mesh_cluster_t* cluster = &mesh->clusters[index];
+  int first_vertex = cluster->first_vertex;
+  int end_vertex = first_vertex + cluster->num_vertices;
+
+  for (int i = cluster->first_face; i < cluster->first_face + cluster->num_faces; i++) {
+    const face_t* face = &mesh->faces[i];
+    if (
+      face->a < first_vertex || face->a >= end_vertex ||
+      face->b < first_vertex || face->b >= end_vertex ||
+      face->c < first_vertex || face->c >= end_vertex
+    ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool load_baked_mesh(const char* cache_filepath, const char* obj_filepath, const char* png_filepath, mesh_t* mesh) {
+  file_map_t file;
+  if (!map_file_random(cache_filepath, &file)) {
+    return false;
+  }
+
+  mesh_cache_header_t header;
+  if (file.size < sizeof(header)) {
+    unmap_file(&file);
+    return false;
+  }
+  memcpy(&header, file.data, sizeof(header));
+
+  if (
+    memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+    header.version != MESH_CACHE_VERSION ||
+    header.byte_order != MESH_CACHE_BYTE_ORDER ||
+    header.face_size != sizeof(face_t)
+  ) {
+    fprintf(stderr, "Ignoring baked mesh %s, it is not a baked mesh of this version. \n", cache_filepath);
+    unmap_file(&file);
+    return false;
+  }
+
+  if (
+    is_source_changed(obj_filepath, header.obj_size, header.obj_mtime) ||
+    is_source_changed(png_filepath, header.png_size, header.png_mtime)
+  ) {
+    fprintf(stderr, "Ignoring baked mesh %s, its sources have changed. \n", cache_filepath);
+    unmap_file(&file);
+    return false;
+  }
+
+  // The same test as is_mesh_streamed, before the clusters can be read
+  size_t geometry_size =
+    (size_t)header.num_faces * (sizeof(face_t) + sizeof(vec3_t)) + (size_t)header.num_vertices * sizeof(vec3_t);
+  bool is_resident = geometry_size <= get_mesh_memory_budget();
+
+  // Everything but the geometry is needed right away
+  texture_t* texture = NULL;
+  bool is_valid =
+    header.file_size == file.size &&
+    header.num_vertices >= 0 && header.num_faces >= 0 && header.num_clusters >= 0 &&
+    header.texture_width > 0 && header.texture_height > 0 &&
+    header.num_levels > 0 && header.num_levels <= MAX_MIPMAP_LEVELS &&
+    header.clusters_offset < header.vertices_offset &&
+    is_section_in_file(&header, header.vertices_offset, 0) &&
+    is_section_in_file(&header, header.clusters_offset, get_array_section_size(header.num_clusters, sizeof(mesh_cluster_t))) &&
+    is_section_in_file(&header, header.vertices_offset, get_array_section_size(header.num_vertices, sizeof(vec3_t))) &&
+    is_section_in_file(&header, header.faces_offset, get_array_section_size(header.num_faces, sizeof(face_t))) &&
+    is_section_in_file(&header, header.normals_offset, get_array_section_size(header.num_faces, sizeof(vec3_t)));
+
+  if (is_valid) {
+    prefetch_file_range(&file, 0, header.vertices_offset);
+    is_valid =
+      get_data_checksum(&file.data[sizeof(header)], header.vertices_offset - sizeof(header)) == header.checksum &&
+      are_clusters_valid(&header, (const mesh_cluster_t*)&file.data[header.clusters_offset + sizeof(int) * 2]);
+  }
+  if (is_valid && is_resident) {
+    prefetch_file_range(&file, header.vertices_offset, file.size - header.vertices_offset);
+    is_valid =
+      get_data_checksum(&file.data[header.vertices_offset], file.size - header.vertices_offset) == header.geometry_checksum;
+  }
+  if (is_valid) {
+    texture = create_texture_view(
+      (uint32_t*)&file.data[header.texture_offset],
+      header.texture_width, header.texture_height, header.num_levels
+    );
+  }
+  if (
+    texture == NULL ||
+    !is_section_in_file(&header, header.texture_offset, get_texture_pixel_count(texture) * sizeof(uint32_t))
+  ) {
+    fprintf(stderr, "Ignoring baked mesh %s, it is corrupt. \n", cache_filepath);
+    free_texture(texture);
+    unmap_file(&file);
+    return false;
+  }
+
+  // The mapping is read only, which the renderer never writes to anyway
+  unsigned char* data = (unsigned char*)file.data;
+  mesh_t baked = *mesh;
+  baked.clusters = (mesh_cluster_t*)&data[header.clusters_offset + sizeof(int) * 2];
+  baked.vertices = (vec3_t*)&data[header.vertices_offset + sizeof(int) * 2];
+  baked.faces = (face_t*)&data[header.faces_offset + sizeof(int) * 2];
+  baked.normals = (vec3_t*)&data[header.normals_offset + sizeof(int) * 2];
+  baked.bounds_min = header.bounds_min;
+  baked.bounds_max = header.bounds_max;
+  baked.texture = texture;
+  baked.cache = file;
+
+  // The geometry of a resident mesh is read whole already, so its faces are
+  // checked now instead of cluster by cluster
+  for (int i = 0; is_resident && i < header.num_clusters; i++) {
+    if (!is_baked_cluster_valid(&baked, i)) {
+      fprintf(stderr, "Ignoring baked mesh %s, it is corrupt. \n", cache_filepath);
+      free_texture(texture);
+      unmap_file(&file);
+      return false;
+    }
+  }
+
+  *mesh = baked;
+  return true;
+}
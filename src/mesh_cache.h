@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mesh.h"
+
+#define MESH_CACHE_MAGIC "T3D"
+#define MESH_CACHE_VERSION 2
+#define MESH_CACHE_BYTE_ORDER 0x01020304
+#define MESH_CACHE_ALIGNMENT 64
+#define MESH_CACHE_EXTENSION ".t3d"
+
+// The header every baked file starts with, the sections after it are laid
+// out as mesh_cache.c describes
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t face_size;
+  uint64_t file_size;
+  uint64_t checksum;        // of the sections before the geometry
+  uint64_t geometry_checksum;
+  int64_t obj_size;         // size and modification time of the sources,
+  int64_t obj_mtime;        // to tell when the file is stale
+  int64_t png_size;
+  int64_t png_mtime;
+  vec3_t bounds_min;
+  vec3_t bounds_max;
+  int32_t num_vertices;
+  int32_t num_faces;
+  int32_t texture_width;
+  int32_t texture_height;
+  int32_t num_levels;
+  int32_t num_clusters;
+  uint64_t clusters_offset;
+  uint64_t vertices_offset; // where the geometry starts
+  uint64_t faces_offset;
+  uint64_t normals_offset;
+  uint64_t texture_offset;
+} mesh_cache_header_t;
+
+// Baked meshes hold the vertices, faces, face normals, bounds and mipmapped
+// texture of a mesh in the layout the renderer uses, so loading one only
+// maps the file and points the mesh into it
+void get_mesh_cache_filepath(const char* obj_filepath, char* cache_filepath, size_t size);
+
+bool bake_mesh(char* obj_filepath, char* png_filepath, const char* cache_filepath);
+bool load_baked_mesh(const char* cache_filepath, const char* obj_filepath, const char* png_filepath, mesh_t* mesh);
+bool is_baked_cluster_valid(const mesh_t* mesh, int index);
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mesh_stream.h"
+#include "array.h"
+#include "file_map.h"
+#include "mesh_cache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The faces, face normals and vertices of a cluster are its geometry, which
+// is paged in and out together
+///////////////////////////////////////////////////////////////////////////////
+static size_t memory_budget = DEFAULT_MESH_MEMORY_BUDGET;
+static int stream_frame = 0;
+static mesh_stream_stats_t stats;
+
+// Meshes that share a baked asset share its mapping, and with it one stream.
+// The stream keeps the residency of the clusters of the mapping and counts
+// the meshes using it, so a cluster is counted against the budget and paged
+// in and out once, whichever of those meshes has it in view.
+typedef struct mesh_stream {
+  mesh_t geometry;                // the arrays the meshes point into
+  bool is_streamed;               // too large for the budget when opened
+  int num_users;
+  struct mesh_stream* next;
+} mesh_stream_t;
+
+static mesh_stream_t* streams = NULL;
+
+size_t get_mesh_memory_budget(void) {
+  return memory_budget;
+}
+
+void set_mesh_memory_budget(size_t bytes) {
+  memory_budget = bytes;
+}
+
+static size_t get_cluster_size(const mesh_cluster_t* cluster) {
+  return
+    (size_t)cluster->num_faces * (sizeof(face_t) + sizeof(vec3_t)) +
+    (size_t)cluster->num_vertices * sizeof(vec3_t);
+}
+
+size_t get_mesh_geometry_size(const mesh_t* mesh) {
+  size_t size = 0;
+  for (int i = 0; i < array_length(mesh->clusters); i++) {
+    size += get_cluster_size(&mesh->clusters[i]);
+  }
+  return size;
+}
+
+static size_t get_offset_in_cache(const mesh_t* mesh, const void* pointer) {
+  return (size_t)((const unsigned char*)pointer - mesh->cache.data);
+}
+
+static void page_cluster(mesh_t* mesh, int index, bool is_needed) {
+  const mesh_cluster_t* cluster = &mesh->clusters[index];
+  size_t faces_offset = get_offset_in_cache(mesh, &mesh->faces[cluster->first_face]);
+  size_t normals_offset = get_offset_in_cache(mesh, &mesh->normals[cluster->first_face]);
+  size_t vertices_offset = get_offset_in_cache(mesh, &mesh->vertices[cluster->first_vertex]);
+  size_t faces_size = (size_t)cluster->num_faces * sizeof(face_t);
+  size_t normals_size = (size_t)cluster->num_faces * sizeof(vec3_t);
+  size_t vertices_size = (size_t)cluster->num_vertices * sizeof(vec3_t);
+
+  if (is_needed) {
+    prefetch_file_range(&mesh->cache, faces_offset, faces_size);
+    prefetch_file_range(&mesh->cache, normals_offset, normals_size);
+    prefetch_file_range(&mesh->cache, vertices_offset, vertices_size);
+  } else {
+    release_file_range(&mesh->cache, faces_offset, faces_size);
+    release_file_range(&mesh->cache, normals_offset, normals_size);
+    release_file_range(&mesh->cache, vertices_offset, vertices_size);
+  }
+}
+
+static void set_cluster_resident(mesh_t* mesh, int index, bool is_resident) {
+  mesh_cluster_state_t* state = &mesh->cluster_states[index];
+  if (state->is_resident == is_resident) {
+    return;
+  }
+
+  size_t size = get_cluster_size(&mesh->clusters[index]);
+  state->is_resident = is_resident;
+  if (is_resident) {
+    stats.resident_clusters++;
+    stats.resident_bytes += size;
+  } else {
+    stats.resident_clusters--;
+    stats.resident_bytes -= size;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A baked mesh whose geometry fits the budget is loaded whole and kept
+// resident until the budget runs out, a larger one starts with no cluster
+// resident. Streams are opened and used on the main thread only.
+///////////////////////////////////////////////////////////////////////////////
+bool is_mesh_streamed(const mesh_t* mesh) {
+  return get_mesh_geometry_size(mesh) > memory_budget;
+}
+
+static mesh_stream_t* find_stream(const mesh_t* mesh) {
+  for (mesh_stream_t* stream = streams; stream != NULL; stream = stream->next) {
+    if (stream->geometry.cache.data == mesh->cache.data) {
+      return stream;
+    }
+  }
+  return NULL;
+}
+
+static mesh_stream_t* create_stream(const mesh_t* mesh) {
+  int num_clusters = array_length(mesh->clusters);
+  bool is_resident = !is_mesh_streamed(mesh);
+
+  mesh_stream_t* stream = (mesh_stream_t*)calloc(1, sizeof(mesh_stream_t));
+  if (stream == NULL) {
+    return NULL;
+  }
+  stream->geometry.faces = mesh->faces;
+  stream->geometry.vertices = mesh->vertices;
+  stream->geometry.normals = mesh->normals;
+  stream->geometry.clusters = mesh->clusters;
+  stream->geometry.cache = mesh->cache;
+  stream->geometry.cluster_states = array_hold(NULL, num_clusters, sizeof(mesh_cluster_state_t));
+  if (stream->geometry.cluster_states == NULL) {
+    free(stream);
+    return NULL;
+  }
+  stream->is_streamed = !is_resident;
+  stream->next = streams;
+  streams = stream;
+
+  stats.total_clusters += num_clusters;
+  if (stream->is_streamed) {
+    stats.streamed_meshes++;
+  }
+
+  for (int i = 0; i < num_clusters; i++) {
+    mesh_cluster_state_t* state = &stream->geometry.cluster_states[i];
+    state->last_used_frame = -1;
+    state->distance = 0;
+    state->is_resident = false;
+    state->is_checked = is_resident;
+    state->is_corrupt = false;
+    if (is_resident) {
+      set_cluster_resident(&stream->geometry, i, true);
+    }
+  }
+  return stream;
+}
+
+static void destroy_stream(mesh_stream_t* stream) {
+  int num_clusters = array_length(stream->geometry.clusters);
+  for (int i = 0; i < num_clusters; i++) {
+    set_cluster_resident(&stream->geometry, i, false);
+  }
+  stats.total_clusters -= num_clusters;
+  if (stream->is_streamed) {
+    stats.streamed_meshes--;
+  }
+
+  for (mesh_stream_t** link = &streams; *link != NULL; link = &(*link)->next) {
+    if (*link == stream) {
+      *link = stream->next;
+      break;
+    }
+  }
+  array_free(stream->geometry.cluster_states);
+  free(stream);
+}
+
+// Point a baked mesh at the stream of its mapping, starting one for the
+// first mesh on the mapping. When the stream can not be started, a resident
+// mesh, whose faces were all checked at load, is left without clusters and
+// drawn whole. A streamed mesh was not checked, so false is returned and
+// the caller must release its geometry.
+bool open_mesh_stream(mesh_t* mesh) {
+  if (mesh->clusters == NULL) {
+    return true;
+  }
+
+  mesh_stream_t* stream = find_stream(mesh);
+  if (stream == NULL) {
+    stream = create_stream(mesh);
+  }
+  if (stream == NULL) {
+    fprintf(stderr, "Error opening the stream of a baked mesh. \n");
+    if (is_mesh_streamed(mesh)) {
+      return false;
+    }
+    mesh->clusters = NULL;
+    return true;
+  }
+  stream->num_users++;
+  mesh->cluster_states = stream->geometry.cluster_states;
+  return true;
+}
+
+// Drop the stream of the mapping along with the last mesh that uses it
+void close_mesh_stream(mesh_t* mesh) {
+  if (mesh->cluster_states == NULL) {
+    return;
+  }
+
+  mesh_stream_t* stream = find_stream(mesh);
+  if (stream != NULL && --stream->num_users == 0) {
+    destroy_stream(stream);
+  }
+  mesh->cluster_states = NULL;
+}
+
+void begin_mesh_stream_frame(void) {
+  stream_frame++;
+}
+
+// Mark a cluster in view in this frame, paging it in when it is not
+// resident. The faces of a streamed cluster are checked the first time it
+// is paged in, and false is returned for a corrupt cluster, which must not
+// be drawn.
+bool use_mesh_cluster(mesh_t* mesh, int index, float distance) {
+  mesh_cluster_state_t* state = &mesh->cluster_states[index];
+  state->last_used_frame = stream_frame;
+  state->distance = distance;
+
+  if (!state->is_resident) {
+    page_cluster(mesh, index, true);
+    set_cluster_resident(mesh, index, true);
+    stats.paged_in++;
+  }
+  if (!state->is_checked) {
+    state->is_checked = true;
+    state->is_corrupt = !is_baked_cluster_valid(mesh, index);
+    if (state->is_corrupt) {
+      fprintf(stderr, "Skipping cluster %d of a baked mesh, it is corrupt. \n", index);
+    }
+  }
+  return !state->is_corrupt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Drop resident clusters that were not in view in this frame until the
+// budget is met, the least recently used first and among those the farthest
+// from the camera. Clusters in view are never dropped, so the budget can be
+// exceeded by a frame that sees more than it.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+  mesh_t* geometry;
+  int index;
+} cluster_ref_t;
+
+static int compare_eviction_order(const void* a, const void* b) {
+  const mesh_cluster_state_t* state_a = &((const cluster_ref_t*)a)->geometry->cluster_states[((const cluster_ref_t*)a)->index];
+  const mesh_cluster_state_t* state_b = &((const cluster_ref_t*)b)->geometry->cluster_states[((const cluster_ref_t*)b)->index];
+
+  if (state_a->last_used_frame != state_b->last_used_frame) {
+    return state_a->last_used_frame < state_b->last_used_frame ? -1 : 1;
+  }
+  if (state_a->distance != state_b->distance) {
+    return state_a->distance > state_b->distance ? -1 : 1;
+  }
+  return 0;
+}
+
+void trim_mesh_streams(void) {
+  if (stats.resident_bytes <= memory_budget) {
+    return;
+  }
+
+  cluster_ref_t* candidates = (cluster_ref_t*)malloc(sizeof(cluster_ref_t) * (stats.resident_clusters + 1));
+  if (candidates == NULL) {
+    return;
+  }
+
+  int num_candidates = 0;
+  for (mesh_stream_t* stream = streams; stream != NULL; stream = stream->next) {
+    mesh_t* geometry = &stream->geometry;
+    for (int j = 0; j < array_length(geometry->cluster_states); j++) {
+      const mesh_cluster_state_t* state = &geometry->cluster_states[j];
+      if (state->is_resident && state->last_used_frame != stream_frame) {
+        candidates[num_candidates].geometry = geometry;
+        candidates[num_candidates].index = j;
+        num_candidates++;
+      }
+    }
+  }
+  qsort(candidates, num_candidates, sizeof(cluster_ref_t), compare_eviction_order);
+
+  for (int i = 0; i < num_candidates && stats.resident_bytes > memory_budget; i++) {
+    page_cluster(candidates[i].geometry, candidates[i].index, false);
+    set_cluster_resident(candidates[i].geometry, candidates[i].index, false);
+    stats.evicted++;
+  }
+
+  free(candidates);
+}
+
+mesh_stream_stats_t get_mesh_stream_stats(void) {
+  mesh_stream_stats_t result = stats;
+  result.budget_bytes = memory_budget;
+  return result;
+}
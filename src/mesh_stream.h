@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mesh.h"
+
+// Geometry of baked meshes stays in the mapped file, and the clusters in
+// view are paged in as the frame needs them. Once the resident clusters
+// exceed the memory budget, the least recently used ones are dropped.
+#define DEFAULT_MESH_MEMORY_BUDGET ((size_t)512 << 20)
+
+typedef struct {
+  int streamed_meshes;      // baked meshes whose geometry did not fit the budget,
+                            // counted once however many meshes share them
+  int total_clusters;
+  int resident_clusters;
+  size_t resident_bytes;
+  size_t budget_bytes;
+  int paged_in;             // clusters paged in since the start
+  int evicted;              // clusters dropped to stay under the budget
+} mesh_stream_stats_t;
+
+size_t get_mesh_memory_budget(void);
+void set_mesh_memory_budget(size_t bytes);
+
+bool is_mesh_streamed(const mesh_t* mesh);
+bool open_mesh_stream(mesh_t* mesh);
+void close_mesh_stream(mesh_t* mesh);
+
+void begin_mesh_stream_frame(void);
+bool use_mesh_cluster(mesh_t* mesh, int index, float distance);
+void trim_mesh_streams(void);
+
+size_t get_mesh_geometry_size(const mesh_t* mesh);
+mesh_stream_stats_t get_mesh_stream_stats(void);
@@ -0,0 +1,126 @@
+#include <SDL2/SDL.h>
+
+#include "display.h"
+#include "pacing.h"
+
+// Below this much time left before the deadline we spin instead of sleeping
+#define MIN_SPIN_TIME 0.002
+
+// A vsync frame slower than this many refresh periods missed its vblank
+#define VSYNC_MISS_FACTOR 1.5
+
+// After falling back from vsync, this many frames in a row must finish with
+// headroom before presentation is locked to vsync again
+#define VSYNC_RECOVERY_FRAMES 120
+#define VSYNC_RECOVERY_HEADROOM 0.75
+
+static double counter_frequency = 0;
+static double frame_period = 1.0 / FPS;
+
+static double frame_deadline = 0;     // when the next frame should start
+static double frame_start_time = 0;   // when the current frame started
+
+// Estimated time SDL_Delay oversleeps, learned from previous waits
+static double sleep_overshoot = 0.001;
+
+static bool is_vsync_requested = false;
+static bool is_vsync_active = false;
+static int on_time_frames = 0;
+
+double get_time_seconds(void) {
+  return SDL_GetPerformanceCounter() / counter_frequency;
+}
+
+void init_frame_pacing(double period, bool use_vsync) {
+  counter_frequency = (double)SDL_GetPerformanceFrequency();
+  frame_period = period;
+  is_vsync_requested = use_vsync;
+  is_vsync_active = use_vsync;
+  reset_frame_pacing();
+}
+
+// Start pacing from now, e.g. after the loop was blocked waiting for input
+void reset_frame_pacing(void) {
+  frame_start_time = get_time_seconds();
+  frame_deadline = frame_start_time + frame_period;
+  on_time_frames = 0;
+}
+
+// Time since the current frame started, in seconds
+double get_frame_elapsed_time(void) {
+  return get_time_seconds() - frame_start_time;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sleep most of the remaining time, then spin for the last part, since
+// SDL_Delay only has millisecond granularity and often oversleeps
+///////////////////////////////////////////////////////////////////////////////
+static void wait_until(double deadline) {
+  for (;;) {
+    double remaining = deadline - get_time_seconds();
+
+    if (remaining <= 0) {
+      return;
+    }
+
+    if (remaining > MIN_SPIN_TIME + sleep_overshoot) {
+      Uint32 sleep_ms = (Uint32)((remaining - sleep_overshoot) * 1000.0);
+      double sleep_start = get_time_seconds();
+
+      SDL_Delay(sleep_ms);
+
+      // Keep a running estimate of how much longer than asked the sleep took
+      double overshoot = (get_time_seconds() - sleep_start) - sleep_ms / 1000.0;
+      if (overshoot < 0) {
+        overshoot = 0;
+      }
+      sleep_overshoot = sleep_overshoot * 0.9 + overshoot * 0.1;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Wait until the next frame should start and return the time since the last
+// frame started, in seconds
+///////////////////////////////////////////////////////////////////////////////
+double wait_for_next_frame(void) {
+  double now = get_time_seconds();
+  double work_time = now - frame_start_time;
+
+  if (is_vsync_active) {
+    // Presenting already blocked until the vblank. A frame that took more
+    // than one refresh period waited a whole extra vblank, so stop waiting
+    // for vsync rather than halving the frame rate.
+    if (work_time > frame_period * VSYNC_MISS_FACTOR) {
+      is_vsync_active = false;
+      on_time_frames = 0;
+      set_vsync_active(false);
+    }
+    frame_deadline = now + frame_period;
+  } else {
+    if (is_vsync_requested) {
+      on_time_frames = work_time < frame_period * VSYNC_RECOVERY_HEADROOM ? on_time_frames + 1 : 0;
+      if (on_time_frames >= VSYNC_RECOVERY_FRAMES) {
+        is_vsync_active = true;
+        set_vsync_active(true);
+      }
+    }
+
+    // Missed the deadline by more than a whole frame, start over from now
+    if (now > frame_deadline + frame_period) {
+      frame_deadline = now;
+    }
+
+    wait_until(frame_deadline);
+
+    // Schedule from the previous deadline rather than from now, so the
+    // wake-up error does not accumulate into drift
+    frame_deadline += frame_period;
+  }
+
+  double previous_frame_start_time = frame_start_time;
+  frame_start_time = get_time_seconds();
+
+  double frame_time = frame_start_time - previous_frame_start_time;
+  return frame_time > MAX_FRAME_TIME ? MAX_FRAME_TIME : frame_time;
+}
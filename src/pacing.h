@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "display.h"
+
+// Simulation runs at a fixed rate, independent of how often frames are drawn
+#define FIXED_TIME_STEP (1.0 / FPS)
+
+// Longest frame time fed to the simulation, so a stall does not explode it
+#define MAX_FRAME_TIME 0.25
+
+void init_frame_pacing(double frame_period, bool use_vsync);
+void reset_frame_pacing(void);
+
+double get_time_seconds(void);
+double wait_for_next_frame(void);
+double get_frame_elapsed_time(void);
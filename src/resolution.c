@@ -0,0 +1,94 @@
+#include <math.h>
+
+#include "display.h"
+#include "resolution.h"
+
+// The render scale is lowered when the average frame takes longer than this
+// fraction of the budget, and raised when it takes less than the lower one
+#define UPPER_BUDGET_FRACTION 0.9
+#define LOWER_BUDGET_FRACTION 0.7
+
+// Frames to wait after a scale change, so the average reflects the new scale
+// before deciding again
+#define SCALE_CHANGE_COOLDOWN 15
+
+// Scale added per step when there is headroom, growing back slowly avoids
+// oscillating around the budget
+#define SCALE_UP_STEP 0.05f
+
+// Weight of the newest frame in the moving average of the frame work time
+#define WORK_TIME_SMOOTHING 0.2
+
+static bool is_enabled = false;
+static float min_render_scale = DEFAULT_MIN_RENDER_SCALE;
+static float render_scale = 1.0f;
+static double frame_budget = 0;
+
+static double average_work_time = 0;
+static int cooldown_frames = 0;
+
+void init_dynamic_resolution(float min_scale, double budget) {
+  is_enabled = true;
+  min_render_scale = min_scale;
+  frame_budget = budget;
+  render_scale = 1.0f;
+  average_work_time = 0;
+  cooldown_frames = 0;
+  set_render_scale(render_scale);
+}
+
+static void change_render_scale(float scale) {
+  scale = scale < min_render_scale ? min_render_scale : (scale > 1.0f ? 1.0f : scale);
+
+  if (scale != render_scale) {
+    render_scale = scale;
+    set_render_scale(render_scale);
+    cooldown_frames = SCALE_CHANGE_COOLDOWN;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Feed the time spent drawing the last frame, without waiting for the display,
+// and pick the render scale for the next one
+///////////////////////////////////////////////////////////////////////////////
+void update_dynamic_resolution(double work_time) {
+  if (!is_enabled) {
+    return;
+  }
+
+  if (average_work_time == 0) {
+    average_work_time = work_time;
+  } else {
+    average_work_time += (work_time - average_work_time) * WORK_TIME_SMOOTHING;
+  }
+
+  if (cooldown_frames > 0) {
+    cooldown_frames--;
+    return;
+  }
+
+  if (average_work_time > frame_budget * UPPER_BUDGET_FRACTION) {
+    // Rasterization cost grows with the pixel count, the square of the scale,
+    // so jump straight to the scale that is expected to fit the budget
+    float fit = (float)sqrt(frame_budget * LOWER_BUDGET_FRACTION / average_work_time);
+    change_render_scale(render_scale * fit);
+  } else if (average_work_time < frame_budget * LOWER_BUDGET_FRACTION) {
+    change_render_scale(render_scale + SCALE_UP_STEP);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Go back to the full resolution, e.g. for a still image that is only drawn
+// once. Returns whether the scale was lowered before.
+///////////////////////////////////////////////////////////////////////////////
+bool restore_full_resolution(void) {
+  if (!is_enabled || render_scale == 1.0f) {
+    return false;
+  }
+
+  render_scale = 1.0f;
+  set_render_scale(render_scale);
+  average_work_time = 0;
+  cooldown_frames = SCALE_CHANGE_COOLDOWN;
+  return true;
+}
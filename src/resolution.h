@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Lowest render scale used when no minimum is given
+#define DEFAULT_MIN_RENDER_SCALE 0.5f
+
+void init_dynamic_resolution(float min_scale, double frame_budget);
+void update_dynamic_resolution(double work_time);
+bool restore_full_resolution(void);
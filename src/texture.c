@@ -1,6 +1,19 @@
+#include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "file_map.h"
 #include "texture.h"
+#include "upng.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static enum TEXTURE_FILTER texture_filter = FILTER_NEAREST_MIPMAP;
+static enum TEXTURE_WRAP texture_wrap = WRAP_REPEAT;
 
 tex2_t tex2_clone(tex2_t* t) {
     tex2_t result = {
@@ -8,4 +21,641 @@ tex2_t tex2_clone(tex2_t* t) {
         t->v
     };
     return result;
-}
\ No newline at end of file
+}
+
+int get_texture_filter(void) {
+    return texture_filter;
+}
+
+void set_texture_filter(int filter) {
+    texture_filter = filter;
+}
+
+int get_texture_wrap(void) {
+    return texture_wrap;
+}
+
+void set_texture_wrap(int wrap) {
+    texture_wrap = wrap;
+}
+
+// Average of each 8 bit channel of four colors
+static uint32_t average_color4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t even = ((a & 0x00FF00FF) + (b & 0x00FF00FF) + (c & 0x00FF00FF) + (d & 0x00FF00FF) + 0x00020002) >> 2;
+    uint32_t odd = (((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF) + ((c >> 8) & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF) + 0x00020002) >> 2;
+    return (even & 0x00FF00FF) | ((odd & 0x00FF00FF) << 8);
+}
+
+// Blend each 8 bit channel of two colors, with a weight from 0 to 256 for b
+static uint32_t blend_color(uint32_t a, uint32_t b, uint32_t weight) {
+    uint32_t even = ((a & 0x00FF00FF) * (256 - weight) + (b & 0x00FF00FF) * weight) >> 8;
+    uint32_t odd = (((a >> 8) & 0x00FF00FF) * (256 - weight) + ((b >> 8) & 0x00FF00FF) * weight) >> 8;
+    return (even & 0x00FF00FF) | ((odd & 0x00FF00FF) << 8);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bilinear blend of four texels in 8.8 fixed point, where fx and fy from 0
+// to 255 are the weights of the right and the bottom texels. The SSE2 path
+// blends the four channels of two texels per instruction and gives the same
+// result as blending the channels in pairs with blend_color.
+///////////////////////////////////////////////////////////////////////////////
+static inline uint32_t blend_bilinear(
+    uint32_t top_left, uint32_t top_right,
+    uint32_t bottom_left, uint32_t bottom_right,
+    uint32_t fx, uint32_t fy
+) {
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+
+    // Interleave the 16 bit channels of the left and right texels of each
+    // row, so one multiply-add blends a channel horizontally into 32 bits
+    __m128i top = _mm_unpacklo_epi8(_mm_cvtsi32_si128(top_left), _mm_cvtsi32_si128(top_right));
+    __m128i bottom = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bottom_left), _mm_cvtsi32_si128(bottom_right));
+    __m128i weights_x = _mm_set1_epi32((fx << 16) | (256 - fx));
+    top = _mm_srli_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(top, zero), weights_x), 8);
+    bottom = _mm_srli_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(bottom, zero), weights_x), 8);
+
+    // Pair each channel of the top row with the one of the bottom row and blend them
+    __m128i weights_y = _mm_set1_epi32((fy << 16) | (256 - fy));
+    __m128i color = _mm_srli_epi32(_mm_madd_epi16(_mm_or_si128(top, _mm_slli_epi32(bottom, 16)), weights_y), 8);
+
+    color = _mm_packs_epi32(color, zero);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(color, zero));
+#else
+    return blend_color(
+        blend_color(top_left, top_right, fx),
+        blend_color(bottom_left, bottom_right, fx),
+        fy
+    );
+#endif
+}
+
+// The index of the texel (x,y) of a level stored in tiles is the sum of an
+// offset that only depends on y and one that only depends on x
+static inline int get_tiled_row_offset(int y, int pitch) {
+    return ((y >> TEXTURE_TILE_SIZE_LOG2) * pitch) + ((y & (TEXTURE_TILE_SIZE - 1)) << TEXTURE_TILE_SIZE_LOG2);
+}
+
+static inline int get_tiled_column_offset(int x) {
+    return ((x >> TEXTURE_TILE_SIZE_LOG2) << (TEXTURE_TILE_SIZE_LOG2 * 2)) + (x & (TEXTURE_TILE_SIZE - 1));
+}
+
+// Copy a row of pixels into row y of a mipmap level stored in tiles
+static void tile_row(const uint32_t* row, mipmap_t* level, int y) {
+    uint32_t* tiled_row = &level->pixels[get_tiled_row_offset(y, level->pitch)];
+    for (int x = 0; x < level->width; x++) {
+        tiled_row[get_tiled_column_offset(x)] = row[x];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fill a mipmap level with the 2x2 box filtered texels of the level above,
+// both stored in tiles. Odd sizes repeat the last row or column of the
+// larger level.
+///////////////////////////////////////////////////////////////////////////////
+static void downsample_level(const mipmap_t* source, mipmap_t* target) {
+    for (int y = 0; y < target->height; y++) {
+        int y0 = y * 2;
+        int y1 = y0 + 1 < source->height ? y0 + 1 : y0;
+        const uint32_t* row0 = &source->pixels[get_tiled_row_offset(y0, source->pitch)];
+        const uint32_t* row1 = &source->pixels[get_tiled_row_offset(y1, source->pitch)];
+        uint32_t* target_row = &target->pixels[get_tiled_row_offset(y, target->pitch)];
+
+        for (int x = 0; x < target->width; x++) {
+            int x0 = get_tiled_column_offset(x * 2);
+            int x1 = x * 2 + 1 < source->width ? get_tiled_column_offset(x * 2 + 1) : x0;
+            target_row[get_tiled_column_offset(x)] = average_color4(row0[x0], row0[x1], row1[x0], row1[x1]);
+        }
+    }
+}
+
+static size_t get_level_pixel_count(const mipmap_t* level) {
+    return (size_t)level->pitch * ((level->height + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SIZE_LOG2);
+}
+
+// Lay out every level one after the other, with the levels smaller than a
+// tile padded to whole tiles, and point them into the given pixels
+static void layout_levels(texture_t* texture, int width, int height, int max_levels, uint32_t* pixels) {
+    int level_width = width;
+    int level_height = height;
+
+    texture->num_levels = 0;
+    while (texture->num_levels < max_levels) {
+        mipmap_t* level = &texture->levels[texture->num_levels++];
+        int tiles_x = (level_width + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SIZE_LOG2;
+
+        level->width = level_width;
+        level->height = level_height;
+        level->pitch = tiles_x * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+        level->pixels = pixels;
+        if (pixels != NULL) {
+            pixels += get_level_pixel_count(level);
+        }
+
+        if (level_width == 1 && level_height == 1) {
+            break;
+        }
+        level_width = level_width > 1 ? level_width / 2 : 1;
+        level_height = level_height > 1 ? level_height / 2 : 1;
+    }
+}
+
+size_t get_texture_pixel_count(const texture_t* texture) {
+    size_t total_pixels = 0;
+    for (int i = 0; i < texture->num_levels; i++) {
+        total_pixels += get_level_pixel_count(&texture->levels[i]);
+    }
+    return total_pixels;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocate a texture with room for its whole chain of mipmaps, for level 0
+// to be filled in and the smaller levels to be built from it
+///////////////////////////////////////////////////////////////////////////////
+static texture_t* allocate_texture(int width, int height) {
+    texture_t* texture = (texture_t*)calloc(1, sizeof(texture_t));
+
+    if (texture == NULL) {
+        return NULL;
+    }
+
+    layout_levels(texture, width, height, MAX_MIPMAP_LEVELS, NULL);
+
+    texture->memory = (uint32_t*)calloc(get_texture_pixel_count(texture), sizeof(uint32_t));
+    if (texture->memory == NULL) {
+        free(texture);
+        return NULL;
+    }
+
+    layout_levels(texture, width, height, MAX_MIPMAP_LEVELS, texture->memory);
+
+    return texture;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Wrap the first num_levels levels of a mipmap chain that is already laid
+// out in memory, such as a baked asset, without copying or owning them
+///////////////////////////////////////////////////////////////////////////////
+texture_t* create_texture_view(uint32_t* pixels, int width, int height, int num_levels) {
+    texture_t* texture = (texture_t*)calloc(1, sizeof(texture_t));
+
+    if (texture == NULL) {
+        return NULL;
+    }
+
+    layout_levels(texture, width, height, num_levels, pixels);
+
+    return texture;
+}
+
+static void build_mipmaps(texture_t* texture) {
+    for (int i = 1; i < texture->num_levels; i++) {
+        downsample_level(&texture->levels[i - 1], &texture->levels[i]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy the pixels into a new texture and build its chain of mipmaps
+///////////////////////////////////////////////////////////////////////////////
+texture_t* create_texture(const uint32_t* pixels, int width, int height) {
+    texture_t* texture = allocate_texture(width, height);
+
+    if (texture == NULL) {
+        return NULL;
+    }
+
+    for (int y = 0; y < height; y++) {
+        tile_row(&pixels[(size_t)width * y], &texture->levels[0], y);
+    }
+    build_mipmaps(texture);
+
+    return texture;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PNG images are converted at load into 0xAARRGGBB colors, the format of the
+// color buffer, so sampling never has to care about the format of the file
+///////////////////////////////////////////////////////////////////////////////
+static inline uint32_t pack_color(uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// Swap R, G, B, A bytes into colors, four pixels at a time with SSE2
+static void convert_rgba8(uint32_t* pixels, const uint8_t* data, size_t count) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // x86 is little endian, so the bytes read as 0xAABBGGRR
+    const __m128i alpha_green = _mm_set1_epi32(0xFF00FF00);
+    const __m128i blue = _mm_set1_epi32(0x000000FF);
+    for (; i + 4 <= count; i += 4) {
+        __m128i abgr = _mm_loadu_si128((const __m128i*)&data[i * 4]);
+        __m128i argb = _mm_or_si128(
+            _mm_and_si128(abgr, alpha_green),
+            _mm_or_si128(
+                _mm_and_si128(_mm_srli_epi32(abgr, 16), blue),
+                _mm_slli_epi32(_mm_and_si128(abgr, blue), 16)
+            )
+        );
+        _mm_storeu_si128((__m128i*)&pixels[i], argb);
+    }
+#endif
+    for (; i < count; i++) {
+        pixels[i] = pack_color(data[i * 4], data[i * 4 + 1], data[i * 4 + 2], data[i * 4 + 3]);
+    }
+}
+
+static void convert_rgb8(uint32_t* pixels, const uint8_t* data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        pixels[i] = pack_color(data[i * 3], data[i * 3 + 1], data[i * 3 + 2], 255);
+    }
+}
+
+static void convert_luminance8(uint32_t* pixels, const uint8_t* data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        pixels[i] = pack_color(data[i], data[i], data[i], 255);
+    }
+}
+
+// Read the sample at the given index of packed samples of any bit depth,
+// scaled to 8 bits. 16 bit samples are big endian and keep their high byte.
+static uint32_t read_sample(const uint8_t* data, size_t index, int depth) {
+    switch (depth) {
+        case 8:
+            return data[index];
+        case 16:
+            return data[index * 2];
+        default: {
+            size_t bit = index * depth;
+            uint32_t max = (1u << depth) - 1;
+            uint32_t value = (data[bit >> 3] >> (8 - depth - (bit & 7))) & max;
+            return value * 255 / max;
+        }
+    }
+}
+
+// Any other format, one sample at a time
+static void convert_samples(uint32_t* pixels, const uint8_t* data, size_t count, int components, int depth) {
+    for (size_t i = 0; i < count; i++) {
+        size_t sample = i * components;
+        uint32_t r = read_sample(data, sample, depth);
+        uint32_t g = r;
+        uint32_t b = r;
+        uint32_t a = 255;
+
+        if (components >= 3) {
+            g = read_sample(data, sample + 1, depth);
+            b = read_sample(data, sample + 2, depth);
+        }
+        if (components == 2 || components == 4) {
+            a = read_sample(data, sample + components - 1, depth);
+        }
+        pixels[i] = pack_color(r, g, b, a);
+    }
+}
+
+// upng hands every unfiltered row of the image over to be converted, in
+// the scratch row it decodes into, and stored in level 0 of the texture
+typedef struct {
+    upng_t* png_image;
+    mipmap_t* level;
+    int y;
+} png_rows_t;
+
+static void store_png_row(unsigned char* dest, const unsigned char* row, unsigned width, void* user) {
+    png_rows_t* rows = (png_rows_t*)user;
+    uint32_t* pixels = (uint32_t*)dest;
+
+    switch (upng_get_format(rows->png_image)) {
+        case UPNG_RGBA8:
+            convert_rgba8(pixels, row, width);
+            break;
+        case UPNG_RGB8:
+            convert_rgb8(pixels, row, width);
+            break;
+        case UPNG_LUMINANCE8:
+            convert_luminance8(pixels, row, width);
+            break;
+        default:
+            convert_samples(pixels, row, width, upng_get_components(rows->png_image), upng_get_bitdepth(rows->png_image));
+            break;
+    }
+    tile_row(pixels, rows->level, rows->y++);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A texture loader decodes PNG files with one decoder and converts them
+// through one row, which are kept from one texture to the next. Loading a
+// batch of textures only allocates the textures themselves once these have
+// grown to the largest image. A loader is used by one thread at a time,
+// load_png_texture uses a shared one for the main thread.
+///////////////////////////////////////////////////////////////////////////////
+struct texture_loader {
+    upng_t* decoder;
+    uint32_t* row;
+    int row_width;
+};
+
+static texture_loader_t* default_loader = NULL;
+
+texture_loader_t* create_texture_loader(void) {
+    texture_loader_t* loader = (texture_loader_t*)calloc(1, sizeof(texture_loader_t));
+
+    if (loader == NULL) {
+        return NULL;
+    }
+
+    loader->decoder = upng_new_with_allocator(NULL);
+    if (loader->decoder == NULL) {
+        free(loader);
+        return NULL;
+    }
+    return loader;
+}
+
+void free_texture_loader(texture_loader_t* loader) {
+    if (loader != NULL) {
+        upng_free(loader->decoder);
+        free(loader->row);
+        free(loader);
+    }
+}
+
+void destroy_texture_loader(void) {
+    free_texture_loader(default_loader);
+    default_loader = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode a PNG file into a new texture. The file is decoded straight from
+// its mapping, one scanline at a time, and every row goes into level 0 of
+// the texture as soon as it is unfiltered, so the image is never held in
+// memory outside of the texture. The mapping is released once the pixels
+// are decoded.
+///////////////////////////////////////////////////////////////////////////////
+texture_t* load_png_texture_with(texture_loader_t* loader, const char* filepath) {
+    upng_t* decoder = loader->decoder;
+
+    file_map_t file;
+    if (!map_file(filepath, &file)) {
+        fprintf(stderr, "Error opening texture %s. \n", filepath);
+        return NULL;
+    }
+
+    upng_set_source(decoder, file.data, file.size);
+
+    texture_t* texture = NULL;
+    if (upng_header(decoder) == UPNG_EOK) {
+        int width = upng_get_width(decoder);
+        if (width > loader->row_width) {
+            free(loader->row);
+            loader->row = (uint32_t*)malloc(sizeof(uint32_t) * width);
+            loader->row_width = loader->row != NULL ? width : 0;
+        }
+
+        texture = allocate_texture(width, upng_get_height(decoder));
+        if (texture == NULL || loader->row == NULL) {
+            free_texture(texture);
+            unmap_file(&file);
+            return NULL;
+        }
+
+        png_rows_t rows = { decoder, &texture->levels[0], 0 };
+        upng_decode_into(decoder, (unsigned char*)loader->row, 0, store_png_row, &rows);
+    }
+    unmap_file(&file);
+
+    if (upng_get_error(decoder) != UPNG_EOK) {
+        fprintf(stderr, "Error decoding texture %s, upng error %d. \n", filepath, upng_get_error(decoder));
+        free_texture(texture);
+        return NULL;
+    }
+
+    build_mipmaps(texture);
+
+    return texture;
+}
+
+texture_t* load_png_texture(const char* filepath) {
+    if (default_loader == NULL) {
+        default_loader = create_texture_loader();
+        if (default_loader == NULL) {
+            return NULL;
+        }
+    }
+    return load_png_texture_with(default_loader, filepath);
+}
+
+void free_texture(texture_t* texture) {
+    if (texture != NULL) {
+        free(texture->memory);
+        free(texture);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Texel addressing. Each sampling function is specialized for one way of
+// wrapping the texel coordinates, power of two textures wrap with a mask
+// instead of the integer divides of the general case.
+///////////////////////////////////////////////////////////////////////////////
+enum ADDRESS_MODE {
+    ADDRESS_REPEAT_POW2,
+    ADDRESS_REPEAT,
+    ADDRESS_CLAMP,
+    ADDRESS_MIRROR_POW2,
+    ADDRESS_MIRROR,
+    NUM_ADDRESS_MODES
+};
+
+// Round towards negative infinity so the texels keep their size across 0
+static inline int floor_to_int(float x) {
+    int i = (int)x;
+    return i - (x < i);
+}
+
+static inline int wrap_coordinate(int x, int size, enum ADDRESS_MODE mode) {
+    switch (mode) {
+        case ADDRESS_REPEAT_POW2:
+            return x & (size - 1);
+        case ADDRESS_REPEAT:
+            x %= size;
+            return x < 0 ? x + size : x;
+        case ADDRESS_CLAMP:
+            return x < 0 ? 0 : (x >= size ? size - 1 : x);
+        case ADDRESS_MIRROR_POW2:
+            x &= (size * 2) - 1;
+            return x < size ? x : (size * 2) - 1 - x;
+        default:
+            x %= size * 2;
+            x = x < 0 ? x + (size * 2) : x;
+            return x < size ? x : (size * 2) - 1 - x;
+    }
+}
+
+static inline int get_row_offset(const sampler_level_t* level, int y, enum ADDRESS_MODE mode) {
+    if (mode == ADDRESS_REPEAT_POW2 || mode == ADDRESS_MIRROR_POW2) {
+        return ((y >> TEXTURE_TILE_SIZE_LOG2) << level->pitch_log2) + ((y & (TEXTURE_TILE_SIZE - 1)) << TEXTURE_TILE_SIZE_LOG2);
+    }
+    return get_tiled_row_offset(y, level->pitch);
+}
+
+static inline uint32_t fetch_texel(const sampler_level_t* level, float u, float v, enum ADDRESS_MODE mode) {
+    int tex_x = wrap_coordinate(floor_to_int(u * level->width), level->width, mode);
+    int tex_y = wrap_coordinate(floor_to_int(v * level->height), level->height, mode);
+
+    return level->pixels[get_row_offset(level, tex_y, mode) + get_tiled_column_offset(tex_x)];
+}
+
+// Bring a coordinate into one period of the address mode before it goes to
+// fixed point, where large repeat coordinates would overflow. Clamping to
+// the edges gives the same texels as clamping them afterwards.
+static inline float wrap_bilinear_coordinate(float u, enum ADDRESS_MODE mode) {
+    switch (mode) {
+        case ADDRESS_REPEAT_POW2:
+        case ADDRESS_REPEAT:
+            return u - floorf(u);
+        case ADDRESS_CLAMP:
+            return u < 0 ? 0 : (u > 1 ? 1 : u);
+        default:
+            return u - 2.0f * floorf(u * 0.5f);
+    }
+}
+
+// Blend the four texels around (u,v), whose centers are half a texel in
+// from their corners. The texel coordinates are converted once to 24.8
+// fixed point, so the integer part and the weights are a shift and a mask.
+static inline uint32_t fetch_bilinear(const sampler_level_t* level, float u, float v, enum ADDRESS_MODE mode) {
+    int s = floor_to_int(wrap_bilinear_coordinate(u, mode) * (level->width * 256)) - 128;
+    int t = floor_to_int(wrap_bilinear_coordinate(v, mode) * (level->height * 256)) - 128;
+    int x = s >> 8;
+    int y = t >> 8;
+    uint32_t fx = s & 255;
+    uint32_t fy = t & 255;
+
+    int left = get_tiled_column_offset(wrap_coordinate(x, level->width, mode));
+    int right = get_tiled_column_offset(wrap_coordinate(x + 1, level->width, mode));
+    const uint32_t* top = &level->pixels[get_row_offset(level, wrap_coordinate(y, level->height, mode), mode)];
+    const uint32_t* bottom = &level->pixels[get_row_offset(level, wrap_coordinate(y + 1, level->height, mode), mode)];
+
+    return blend_bilinear(top[left], top[right], bottom[left], bottom[right], fx, fy);
+}
+
+// Define the sampling functions of one address mode: the nearest texel of
+// one level, the bilinear blend of one level, or the blend of the bilinear
+// samples of two levels. The levels are sampled in a loop so the bilinear
+// fetch is only inlined once.
+#define DEFINE_SAMPLE_FUNCTIONS(name, mode) \
+    static uint32_t sample_nearest_##name(const sampler_t* sampler, float u, float v) { \
+        return fetch_texel(&sampler->levels[0], u, v, mode); \
+    } \
+    static uint32_t sample_bilinear_##name(const sampler_t* sampler, float u, float v) { \
+        return fetch_bilinear(&sampler->levels[0], u, v, mode); \
+    } \
+    static uint32_t sample_trilinear_##name(const sampler_t* sampler, float u, float v) { \
+        uint32_t colors[2]; \
+        for (int i = 0; i < 2; i++) { \
+            colors[i] = fetch_bilinear(&sampler->levels[i], u, v, mode); \
+        } \
+        return blend_color(colors[0], colors[1], sampler->blend_weight); \
+    }
+
+DEFINE_SAMPLE_FUNCTIONS(repeat_pow2, ADDRESS_REPEAT_POW2)
+DEFINE_SAMPLE_FUNCTIONS(repeat, ADDRESS_REPEAT)
+DEFINE_SAMPLE_FUNCTIONS(clamp, ADDRESS_CLAMP)
+DEFINE_SAMPLE_FUNCTIONS(mirror_pow2, ADDRESS_MIRROR_POW2)
+DEFINE_SAMPLE_FUNCTIONS(mirror, ADDRESS_MIRROR)
+
+enum SAMPLE_KIND {
+    SAMPLE_NEAREST,
+    SAMPLE_BILINEAR,
+    SAMPLE_TRILINEAR,
+    NUM_SAMPLE_KINDS
+};
+
+static const sample_function_t sample_functions[NUM_ADDRESS_MODES][NUM_SAMPLE_KINDS] = {
+    { sample_nearest_repeat_pow2, sample_bilinear_repeat_pow2, sample_trilinear_repeat_pow2 },
+    { sample_nearest_repeat, sample_bilinear_repeat, sample_trilinear_repeat },
+    { sample_nearest_clamp, sample_bilinear_clamp, sample_trilinear_clamp },
+    { sample_nearest_mirror_pow2, sample_bilinear_mirror_pow2, sample_trilinear_mirror_pow2 },
+    { sample_nearest_mirror, sample_bilinear_mirror, sample_trilinear_mirror }
+};
+
+// Return the log2 of a power of two, or -1 for any other number
+static int get_log2(int size) {
+    if (size <= 0 || (size & (size - 1)) != 0) {
+        return -1;
+    }
+
+    int log2 = 0;
+    while ((1 << log2) < size) {
+        log2++;
+    }
+    return log2;
+}
+
+static void init_sampler_level(sampler_level_t* sampler_level, const mipmap_t* level) {
+    sampler_level->pixels = level->pixels;
+    sampler_level->width = level->width;
+    sampler_level->height = level->height;
+    sampler_level->pitch = level->pitch;
+    sampler_level->width_log2 = get_log2(level->width);
+    sampler_level->height_log2 = get_log2(level->height);
+    sampler_level->pitch_log2 = get_log2(level->pitch);
+}
+
+static bool is_power_of_two_level(const sampler_level_t* level) {
+    return level->width_log2 >= 0 && level->height_log2 >= 0 && level->pitch_log2 >= 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Resolve the levels and the sampling function for a triangle, where lod is
+// the log2 of how many level 0 texels are covered by one pixel along each side
+///////////////////////////////////////////////////////////////////////////////
+void init_sampler(sampler_t* sampler, const texture_t* texture, float lod) {
+    int last_level = texture->num_levels - 1;
+    int level = 0;
+    int next_level = 0;
+    uint32_t weight = 0;
+    bool is_bilinear = texture_filter == FILTER_BILINEAR || texture_filter == FILTER_TRILINEAR;
+
+    if (texture_filter == FILTER_NEAREST || lod <= 0) {
+        level = 0;
+    } else if (texture_filter != FILTER_TRILINEAR) {
+        level = (int)(lod + 0.5f);
+        level = level < last_level ? level : last_level;
+    } else {
+        level = (int)lod;
+        if (level >= last_level) {
+            level = last_level;
+        } else {
+            next_level = level + 1;
+            weight = (uint32_t)((lod - level) * 256);
+        }
+    }
+
+    init_sampler_level(&sampler->levels[0], &texture->levels[level]);
+    init_sampler_level(&sampler->levels[1], &texture->levels[next_level]);
+    sampler->blend_weight = weight;
+    sampler->wrap = texture_wrap;
+
+    bool is_power_of_two = is_power_of_two_level(&sampler->levels[0]) &&
+        (weight == 0 || is_power_of_two_level(&sampler->levels[1]));
+
+    enum ADDRESS_MODE mode;
+    switch (texture_wrap) {
+        case WRAP_CLAMP:
+            mode = ADDRESS_CLAMP;
+            break;
+        case WRAP_MIRROR:
+            mode = is_power_of_two ? ADDRESS_MIRROR_POW2 : ADDRESS_MIRROR;
+            break;
+        default:
+            mode = is_power_of_two ? ADDRESS_REPEAT_POW2 : ADDRESS_REPEAT;
+            break;
+    }
+
+    if (weight > 0) {
+        sampler->sample = sample_functions[mode][SAMPLE_TRILINEAR];
+    } else {
+        sampler->sample = sample_functions[mode][is_bilinear ? SAMPLE_BILINEAR : SAMPLE_NEAREST];
+    }
+}
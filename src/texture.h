@@ -1,8 +1,101 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct {
     float u;
     float v;
 } tex2_t;
 
-tex2_t tex2_clone(tex2_t* t);
\ No newline at end of file
+// Enough levels to halve a 32768 texel texture down to a single texel
+#define MAX_MIPMAP_LEVELS 16
+
+enum TEXTURE_FILTER {
+    FILTER_NEAREST,          // nearest texel of the full resolution level
+    FILTER_NEAREST_MIPMAP,   // nearest texel of the closest mipmap level
+    FILTER_BILINEAR,         // four nearest texels of the closest level, blended
+    FILTER_TRILINEAR         // bilinear samples of the two closest levels, blended
+};
+
+enum TEXTURE_WRAP {
+    WRAP_REPEAT,             // tile the texture
+    WRAP_CLAMP,              // stretch the edge texels
+    WRAP_MIRROR              // tile the texture, flipping every other copy
+};
+
+// Texels are stored in tiles of 4x4, 64 bytes or one cache line, so the
+// neighbours of a texel along any direction are mostly in the same line
+#define TEXTURE_TILE_SIZE_LOG2 2
+#define TEXTURE_TILE_SIZE (1 << TEXTURE_TILE_SIZE_LOG2)
+
+// A mipmap level in the tiled layout, where the tiles are laid out row by
+// row and the pitch is the number of texels in a row of tiles
+typedef struct {
+    int width;
+    int height;
+    int pitch;
+    uint32_t* pixels;
+} mipmap_t;
+
+// A texture owns its whole chain of mipmaps in one allocation, level 0 is
+// the full resolution image and every next level is half of the previous one
+typedef struct {
+    int num_levels;
+    mipmap_t levels[MAX_MIPMAP_LEVELS];
+    uint32_t* memory;    // NULL when the texture views levels it does not own
+} texture_t;
+
+// One mipmap level as seen by a sampler, with the log2 of its sizes and its
+// pitch when all of them are powers of two so texel addresses only need
+// shifts and masks
+typedef struct {
+    const uint32_t* pixels;
+    int width;
+    int height;
+    int pitch;
+    int width_log2;
+    int height_log2;
+    int pitch_log2;
+} sampler_level_t;
+
+typedef struct sampler sampler_t;
+
+typedef uint32_t (*sample_function_t)(const sampler_t* sampler, float u, float v);
+
+// A sampler is resolved once per triangle from the texture, the filter, the
+// wrap mode and the level of detail, and picks the sampling function that
+// only does the work this combination needs
+struct sampler {
+    sampler_level_t levels[2];
+    uint32_t blend_weight;
+    int wrap;
+    sample_function_t sample;
+};
+
+tex2_t tex2_clone(tex2_t* t);
+
+texture_t* create_texture(const uint32_t* pixels, int width, int height);
+texture_t* create_texture_view(uint32_t* pixels, int width, int height, int num_levels);
+size_t get_texture_pixel_count(const texture_t* texture);
+typedef struct texture_loader texture_loader_t;
+
+texture_loader_t* create_texture_loader(void);
+void free_texture_loader(texture_loader_t* loader);
+
+texture_t* load_png_texture(const char* filepath);
+texture_t* load_png_texture_with(texture_loader_t* loader, const char* filepath);
+void free_texture(texture_t* texture);
+void destroy_texture_loader(void);
+
+int get_texture_filter(void);
+void set_texture_filter(int filter);
+
+int get_texture_wrap(void);
+void set_texture_wrap(int wrap);
+
+void init_sampler(sampler_t* sampler, const texture_t* texture, float lod);
+
+static inline uint32_t sample_texture(const sampler_t* sampler, float u, float v) {
+    return sampler->sample(sampler, u, v);
+}
@@ -1,32 +1,10 @@
+#include <math.h>
+
 #include "swap.h"
 #include "display.h"
 #include "triangle.h"
 
 ///////////////////////////////////////////////////////////////////////////////
-// Return the normal vector of a triangle face
-///////////////////////////////////////////////////////////////////////////////
-vec3_t get_triangle_normal(vec4_t vertices[3]) {
-  // Get individual vectors from A, B, and C vertices to compute normal
-  vec3_t vector_a = vec3_from_vec4(vertices[0]); /*   A   */
-  vec3_t vector_b = vec3_from_vec4(vertices[1]); /*  / \  */
-  vec3_t vector_c = vec3_from_vec4(vertices[2]); /* C---B */
-
-  // Get the vector subtraction of B-A and C-A
-  vec3_t vector_ab = vec3_sub(vector_b, vector_a);
-  vec3_normalize(&vector_ab);
-
-  vec3_t vector_ac = vec3_sub(vector_c, vector_a);
-  vec3_normalize(&vector_ac);
-
-  // Compute the face normal using cross product to find penpendicular vector
-  vec3_t normal = vec3_cross(vector_ab, vector_ac);
-
-  // Normalize the face normal vector
-  vec3_normalize(&normal);
-
-  return normal;
-}
-
 ///////////////////////////////////////////////////////////////////////////////
 // Return the barycentric weights alpha, beta, and gamma for point p
 ///////////////////////////////////////////////////////////////////////////////
@@ -177,6 +155,9 @@ void draw_filled_triangle(
   vec4_t point_b = { x1, y1, z1, w1 };
   vec4_t point_c = { x2, y2, z2, w2 };
 
+  // Step between the pixels rasterized on a row
+  int x_step = get_rasterized_x_step();
+
   // Render the upper part of the triangle (flat-bottom)
   float inv_slope_1 = 0;
   float inv_slope_2 = 0;
@@ -191,6 +172,11 @@ void draw_filled_triangle(
 
   if (y1 - y0 != 0) {
     for (int y = y0; y <= y1; y++) {
+      // Interlaced frames skip every other row or every other pixel
+      if (!is_row_rasterized(y)) {
+        continue;
+      }
+
       int x_start = x1 + (y - y1) * inv_slope_1;
       int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -198,7 +184,7 @@ void draw_filled_triangle(
         int_swap(&x_start, &x_end);
       }
 
-      for (int x = x_start; x < x_end; x++) {
+      for (int x = get_first_rasterized_x(x_start, y); x < x_end; x += x_step) {
         draw_filled_pixel(
           x, y,
           point_a, point_b, point_c,
@@ -222,6 +208,11 @@ void draw_filled_triangle(
 
   if (y2 - y1 != 0) {
     for (int y = y1; y <= y2; y++) {
+      // Interlaced frames skip every other row or every other pixel
+      if (!is_row_rasterized(y)) {
+        continue;
+      }
+
       int x_start = x1 + (y - y1) * inv_slope_1;
       int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -229,7 +220,7 @@ void draw_filled_triangle(
         int_swap(&x_start, &x_end);
       }
 
-      for (int x = x_start; x < x_end; x++) {
+      for (int x = get_first_rasterized_x(x_start, y); x < x_end; x += x_step) {
         draw_filled_pixel(
           x, y,
           point_a, point_b, point_c,
@@ -241,21 +232,15 @@ void draw_filled_triangle(
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Function to draw the textured pixel at position (x,y) using depth interpolation
+// Return the texture color at the point with the given barycentric weights,
+// interpolating the texture coordinates with perspective correction
 ///////////////////////////////////////////////////////////////////////////////
-void draw_texel(
-  int x, int y,
+uint32_t get_texel_color(
+  vec3_t weights,
   vec4_t point_a, vec4_t point_b, vec4_t point_c,
   float u0, float v0, float u1, float v1, float u2, float v2,
-  upng_t* texture
+  const sampler_t* sampler
 ) {
-  vec2_t a = { point_a.x, point_a.y };
-  vec2_t b = { point_b.x, point_b.y };
-  vec2_t c = { point_c.x, point_c.y };
-  vec2_t p = { x, y };
-
-  vec3_t weights = barycentric_weights(a, b, c, p);
-
   float alpha = weights.x;
   float beta = weights.y;
   float gamma = weights.z;
@@ -272,28 +257,214 @@ void draw_texel(
   interpolated_u /= interpolated_reciprocal_w;
   interpolated_v /= interpolated_reciprocal_w;
 
-  // Get the mesh texture width and height dimensions
-  int texture_width = upng_get_width(texture);
-  int texture_height = upng_get_height(texture);
-  
-  int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-  int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
+  return sample_texture(sampler, interpolated_u, interpolated_v);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Function to draw the textured pixel at position (x,y) using depth interpolation
+///////////////////////////////////////////////////////////////////////////////
+void draw_texel(
+  int x, int y,
+  vec4_t point_a, vec4_t point_b, vec4_t point_c,
+  float u0, float v0, float u1, float v1, float u2, float v2,
+  const sampler_t* sampler
+) {
+  vec2_t a = { point_a.x, point_a.y };
+  vec2_t b = { point_b.x, point_b.y };
+  vec2_t c = { point_c.x, point_c.y };
+  vec2_t p = { x, y };
+
+  vec3_t weights = barycentric_weights(a, b, c, p);
+
+  // Interpolate the value of 1/w for the current pixel
+  float interpolated_reciprocal_w = (1 / point_a.w) * weights.x + (1 / point_b.w) * weights.y + (1 / point_c.w) * weights.z;
 
   // Adjust 1/w so the pixels that are closer to the camera have smaller values
   interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
 
   // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
   if(interpolated_reciprocal_w < get_zbuffer_at(x, y)) {
-    // Get the buffer of colors from texture
-    uint32_t* texture_buffer = (uint32_t*)upng_get_buffer(texture); 
+    uint32_t color = get_texel_color(
+      weights,
+      point_a, point_b, point_c,
+      u0, v0, u1, v1, u2, v2,
+      sampler
+    );
 
-    draw_pixel(x, y, texture_buffer[(texture_width * tex_y) + tex_x]);
+    draw_pixel(x, y, color);
 
     // Update the z-buffer value with 1/w of this current pixel
     set_zbuffer_at(x, y, interpolated_reciprocal_w);
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Return how many full resolution texels map to one pixel along each side,
+// treating the texture mapping as affine over the triangle
+///////////////////////////////////////////////////////////////////////////////
+static float get_triangle_texel_density(
+  vec4_t point_a, vec4_t point_b, vec4_t point_c,
+  float u0, float v0, float u1, float v1, float u2, float v2,
+  texture_t* texture
+) {
+  float screen_area = fabsf(
+    (point_b.x - point_a.x) * (point_c.y - point_a.y) -
+    (point_c.x - point_a.x) * (point_b.y - point_a.y)
+  );
+  float texel_area = fabsf((u1 - u0) * (v2 - v0) - (u2 - u0) * (v1 - v0)) *
+    texture->levels[0].width * texture->levels[0].height;
+
+  // Triangles smaller than a pixel still cover at least that pixel
+  if (screen_area < 1.0f) {
+    screen_area = 1.0f;
+  }
+
+  return sqrtf(texel_area / screen_area);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Coarse pixel shading: a textured triangle that stretches each texel over
+// several pixels only samples its texture once per block of rate x rate
+// pixels, while the depth test still runs for every pixel
+///////////////////////////////////////////////////////////////////////////////
+#define MAX_SHADING_BLOCKS 4096
+
+// Most texels a block may cover along one axis before it is shaded finer
+#define MAX_TEXELS_PER_BLOCK 1.0f
+
+static int shading_rate = SHADING_RATE_FULL;
+
+// Colors of the blocks in the current row of blocks. A block is only valid
+// when its tag matches, the tag changes for every new row and triangle.
+static uint32_t block_colors[MAX_SHADING_BLOCKS];
+static uint32_t block_tags[MAX_SHADING_BLOCKS];
+static uint32_t block_tag = 0;
+static int block_row = 0;
+
+int get_shading_rate(void) {
+  return shading_rate;
+}
+
+void set_shading_rate(int rate) {
+  shading_rate = rate;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pick the shading rate of a triangle from how many texels map to one pixel.
+// The ratio of the vertex depths accounts for the denser texels at the far end.
+///////////////////////////////////////////////////////////////////////////////
+static int get_triangle_shading_rate(
+  vec4_t point_a, vec4_t point_b, vec4_t point_c,
+  float texel_density
+) {
+  if (shading_rate != SHADING_RATE_AUTO) {
+    return shading_rate;
+  }
+
+  float w_min = fminf(point_a.w, fminf(point_b.w, point_c.w));
+  float w_max = fmaxf(point_a.w, fmaxf(point_b.w, point_c.w));
+  float texels_per_pixel = texel_density * (w_max / w_min);
+
+  if (texels_per_pixel * 4 <= MAX_TEXELS_PER_BLOCK) {
+    return 4;
+  }
+  if (texels_per_pixel * 2 <= MAX_TEXELS_PER_BLOCK) {
+    return 2;
+  }
+  return SHADING_RATE_FULL;
+}
+
+// Forget the block colors when the span moves to another row of blocks
+static void begin_shading_row(int y, int rate) {
+  if (y / rate != block_row) {
+    block_row = y / rate;
+    block_tag++;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 1/w is linear in screen space, so coarse shading can step it across the
+// spans instead of computing the barycentric weights of every pixel
+///////////////////////////////////////////////////////////////////////////////
+static void get_reciprocal_w_gradient(
+  vec4_t point_a, vec4_t point_b, vec4_t point_c,
+  float* dx, float* dy
+) {
+  float area = (point_b.x - point_a.x) * (point_c.y - point_a.y) - (point_c.x - point_a.x) * (point_b.y - point_a.y);
+
+  if (area == 0) {
+    *dx = 0;
+    *dy = 0;
+    return;
+  }
+
+  float delta_b = 1 / point_b.w - 1 / point_a.w;
+  float delta_c = 1 / point_c.w - 1 / point_a.w;
+
+  *dx = (delta_b * (point_c.y - point_a.y) - delta_c * (point_b.y - point_a.y)) / area;
+  *dy = (delta_c * (point_b.x - point_a.x) - delta_b * (point_c.x - point_a.x)) / area;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a textured pixel with the adjusted 1/w depth, sampling the texture at
+// the center of its block the first time a pixel of the block passes the
+// depth test
+///////////////////////////////////////////////////////////////////////////////
+void draw_coarse_texel(
+  int x, int y, float depth,
+  vec4_t point_a, vec4_t point_b, vec4_t point_c,
+  float u0, float v0, float u1, float v1, float u2, float v2,
+  const sampler_t* sampler,
+  int rate
+) {
+  if (depth >= get_zbuffer_at(x, y)) {
+    return;
+  }
+
+  vec2_t a = { point_a.x, point_a.y };
+  vec2_t b = { point_b.x, point_b.y };
+  vec2_t c = { point_c.x, point_c.y };
+
+  int block_x = x / rate;
+  uint32_t color;
+
+  if (x >= 0 && block_x < MAX_SHADING_BLOCKS) {
+    if (block_tags[block_x] != block_tag) {
+      // The block center may lie outside of the triangle, so clamp its
+      // weights to the triangle instead of extrapolating the texture
+      float center = rate * 0.5f - 0.5f;
+      vec2_t block_center = { block_x * rate + center, block_row * rate + center };
+      vec3_t block_weights = barycentric_weights(a, b, c, block_center);
+
+      block_weights.x = fmaxf(block_weights.x, 0);
+      block_weights.y = fmaxf(block_weights.y, 0);
+      block_weights.z = fmaxf(block_weights.z, 0);
+      block_weights = vec3_div(block_weights, block_weights.x + block_weights.y + block_weights.z);
+
+      block_colors[block_x] = get_texel_color(
+        block_weights,
+        point_a, point_b, point_c,
+        u0, v0, u1, v1, u2, v2,
+        sampler
+      );
+      block_tags[block_x] = block_tag;
+    }
+    color = block_colors[block_x];
+  } else {
+    // Outside of the block cache, shade the pixel on its own
+    vec2_t p = { x, y };
+    color = get_texel_color(
+      barycentric_weights(a, b, c, p),
+      point_a, point_b, point_c,
+      u0, v0, u1, v1, u2, v2,
+      sampler
+    );
+  }
+
+  draw_pixel(x, y, color);
+  set_zbuffer_at(x, y, depth);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Draw a textured triangle based on a texture array of colors.
 // We split the original triangle in two, half flat-bottom and half flat-top.
@@ -318,7 +489,7 @@ void draw_textured_triangle(
   int x0, int y0, float z0, float w0, float u0, float v0, 
   int x1, int y1, float z1, float w1, float u1, float v1, 
   int x2, int y2, float z2, float w2, float u2, float v2,
-  upng_t* texture
+  texture_t* texture
 ) {
   // We need to sort the vectices by y-coordinate ascending (y0 < y1 < y2)
   if (y0 > y1) {
@@ -364,6 +535,27 @@ void draw_textured_triangle(
   vec4_t point_b = { x1, y1, z1, w1 };
   vec4_t point_c = { x2, y2, z2, w2 };
 
+  // Step between the pixels rasterized on a row
+  int x_step = get_rasterized_x_step();
+
+  float texel_density = get_triangle_texel_density(
+    point_a, point_b, point_c,
+    u0, v0, u1, v1, u2, v2,
+    texture
+  );
+
+  // Sample the mipmap level where one texel is about the size of a pixel
+  sampler_t sampler;
+  init_sampler(&sampler, texture, log2f(texel_density));
+
+  // Sample the texture once per block of pixels when texels are large enough
+  int rate = get_triangle_shading_rate(point_a, point_b, point_c, texel_density);
+  block_tag++;
+
+  float reciprocal_w_dx;
+  float reciprocal_w_dy;
+  get_reciprocal_w_gradient(point_a, point_b, point_c, &reciprocal_w_dx, &reciprocal_w_dy);
+
   // Render the upper part of the triangle (flat-bottom)
   float inv_slope_1 = 0;
   float inv_slope_2 = 0;
@@ -378,6 +570,11 @@ void draw_textured_triangle(
 
   if (y1 - y0 != 0) {
     for (int y = y0; y <= y1; y++) {
+      // Interlaced frames skip every other row or every other pixel
+      if (!is_row_rasterized(y)) {
+        continue;
+      }
+
       int x_start = x1 + (y - y1) * inv_slope_1;
       int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -385,12 +582,32 @@ void draw_textured_triangle(
         int_swap(&x_start, &x_end);
       }
 
-      for (int x = x_start; x < x_end; x++) {
+      if (rate > SHADING_RATE_FULL) {
+        begin_shading_row(y, rate);
+
+        float reciprocal_w_row = 1 / point_a.w + (y - point_a.y) * reciprocal_w_dy;
+
+        for (int x = get_first_rasterized_x(x_start, y); x < x_end; x += x_step) {
+          float reciprocal_w = reciprocal_w_row + (x - point_a.x) * reciprocal_w_dx;
+
+          // Adjust 1/w so the pixels that are closer to the camera have smaller values
+          draw_coarse_texel(
+            x, y, 1.0 - reciprocal_w,
+            point_a, point_b, point_c,
+            u0, v0, u1, v1, u2, v2,
+            &sampler,
+            rate
+          );
+        }
+        continue;
+      }
+
+      for (int x = get_first_rasterized_x(x_start, y); x < x_end; x += x_step) {
         draw_texel(
           x, y,
           point_a, point_b, point_c, 
           u0, v0, u1, v1, u2, v2,
-          texture
+          &sampler
         );
       }
     }
@@ -410,6 +627,11 @@ void draw_textured_triangle(
 
   if (y2 - y1 != 0) {
     for (int y = y1; y <= y2; y++) {
+      // Interlaced frames skip every other row or every other pixel
+      if (!is_row_rasterized(y)) {
+        continue;
+      }
+
       int x_start = x1 + (y - y1) * inv_slope_1;
       int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -417,12 +639,32 @@ void draw_textured_triangle(
         int_swap(&x_start, &x_end);
       }
 
-      for (int x = x_start; x < x_end; x++) {
+      if (rate > SHADING_RATE_FULL) {
+        begin_shading_row(y, rate);
+
+        float reciprocal_w_row = 1 / point_a.w + (y - point_a.y) * reciprocal_w_dy;
+
+        for (int x = get_first_rasterized_x(x_start, y); x < x_end; x += x_step) {
+          float reciprocal_w = reciprocal_w_row + (x - point_a.x) * reciprocal_w_dx;
+
+          // Adjust 1/w so the pixels that are closer to the camera have smaller values
+          draw_coarse_texel(
+            x, y, 1.0 - reciprocal_w,
+            point_a, point_b, point_c,
+            u0, v0, u1, v1, u2, v2,
+            &sampler,
+            rate
+          );
+        }
+        continue;
+      }
+
+      for (int x = get_first_rasterized_x(x_start, y); x < x_end; x += x_step) {
         draw_texel(
           x, y, 
           point_a, point_b, point_c, 
           u0, v0, u1, v1, u2, v2, 
-          texture
+          &sampler
         );
       }
     }
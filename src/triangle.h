@@ -2,10 +2,14 @@
 
 #include <stdint.h>
 
-#include "upng.h"
 #include "vector.h"
 #include "texture.h"
 
+// Pixels along each side of a block that shares one texture sample, or
+// SHADING_RATE_AUTO to pick 1, 2 or 4 per triangle from its texel density
+#define SHADING_RATE_AUTO 0
+#define SHADING_RATE_FULL 1
+
 typedef struct {
   int a, b, c;
   tex2_t a_uv, b_uv, c_uv;
@@ -16,10 +20,11 @@ typedef struct {
   vec4_t points[3];
   tex2_t tex_coords[3];
   uint32_t color;
-  upng_t* texture;
+  texture_t* texture;
 } triangle_t;
 
-vec3_t get_triangle_normal(vec4_t vertices[3]);
+int get_shading_rate(void);
+void set_shading_rate(int rate);
 
 void draw_triangle(
   int x0, int y0,
@@ -39,5 +44,5 @@ void draw_textured_triangle(
   int x0, int y0, float z0, float w0, float u0, float v0, 
   int x1, int y1, float z1, float w1, float u1, float v1, 
   int x2, int y2, float z2, float w2, float u2, float v2,
-  upng_t* texture
+  texture_t* texture
 );
\ No newline at end of file
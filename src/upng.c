@@ -28,9 +28,14 @@ freely, subject to the following restrictions:
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 
 #include "upng.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define MAKE_BYTE(b) ((b) & 0xFF)
 #define MAKE_DWORD(a,b,c,d) ((MAKE_BYTE(a) << 24) | (MAKE_BYTE(b) << 16) | (MAKE_BYTE(c) << 8) | MAKE_BYTE(d))
 #define MAKE_DWORD_PTR(p) MAKE_DWORD((p)[0], (p)[1], (p)[2], (p)[3])
@@ -52,9 +57,30 @@ freely, subject to the following restrictions:
 #define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
+/* Huffman codes are decoded with a table indexed by the next HUFFMAN_FAST_BITS
+ * bits of the stream, codes that are longer than that continue in a secondary
+ * table of their prefix. The tables hold the primary entries plus the worst
+ * case of a full secondary table for every code. */
+#define HUFFMAN_FAST_BITS 10
+#define HUFFMAN_TABLE_SIZE(numcodes) ((1 << HUFFMAN_FAST_BITS) + (numcodes) * (1 << (MAX_BIT_LENGTH - HUFFMAN_FAST_BITS)))
+
+/* a back-reference reaches at most 32K bytes back and copies at most 258 bytes. copies may write up
+ * to 8 bytes past their end, so the window always has that much room before a symbol is decoded */
+#define INFLATE_WINDOW_SIZE 32768
+#define WINDOW_SLACK (258 + 8)
+
+#define DEFLATE_CODE_BUFFER_SIZE HUFFMAN_TABLE_SIZE(NUM_DEFLATE_CODE_SYMBOLS)
+#define DISTANCE_BUFFER_SIZE HUFFMAN_TABLE_SIZE(NUM_DISTANCE_SYMBOLS)
+#define CODE_LENGTH_BUFFER_SIZE HUFFMAN_TABLE_SIZE(NUM_CODE_LENGTH_CODES)
+
+/* a table entry holds the number of bits it consumes in its low 5 bits (0 for
+ * codes that are not in the tree), a flag telling whether it links to a
+ * secondary table, and the symbol or the offset of the secondary table */
+#define HUFFMAN_ENTRY(value, bits) (((value) << 16) | (bits))
+#define HUFFMAN_LINK(offset, bits) (((offset) << 16) | 0x20 | (bits))
+#define HUFFMAN_ENTRY_BITS(entry) ((entry) & 0x1F)
+#define HUFFMAN_ENTRY_IS_LINK(entry) (((entry) & 0x20) != 0)
+#define HUFFMAN_ENTRY_VALUE(entry) ((entry) >> 16)
 
 #define SET_ERROR(upng,code) do { (upng)->error = (code); (upng)->error_line = __LINE__; } while (0)
 
@@ -98,14 +124,74 @@ struct upng_t {
 
 	upng_state		state;
 	upng_source		source;
+
+	upng_allocator	allocator;
+	unsigned char*	scratch;	/*window and rows of upng_decode_rows, kept for the next image */
+	unsigned long	scratch_size;
 };
 
 typedef struct huffman_tree {
-	unsigned* tree2d;
+	unsigned* table;	/*lookup table of the codes, see HUFFMAN_ENTRY */
+	unsigned fastbits;	/*number of bits that index the primary table */
 	unsigned maxbitlen;	/*maximum number of bits a single code can get */
 	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
 } huffman_tree;
 
+/* the compressed image data, read in place across the payloads of the IDAT chunks */
+typedef struct idat_stream {
+	const unsigned char *data;	/*payload of the current IDAT chunk */
+	unsigned long size;	/*length of the payload */
+	unsigned long bp;	/*bit pointer in the payload, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
+	const unsigned char *end;	/*end of the source buffer */
+} idat_stream;
+
+/* the inflated data goes through a window that keeps the last 32K bytes the back-references can reach.
+ * complete scanlines are unfiltered out of it as soon as they arrive, against the row unfiltered before them */
+typedef struct inflate_output {
+	unsigned char *window;
+	unsigned long capacity;	/*size of the window */
+	unsigned long pos;	/*write position in the window */
+	unsigned long end;	/*position in the window where the image data ends */
+	unsigned long scanline;	/*start of the first scanline that is not unfiltered yet */
+
+	unsigned width;
+	unsigned height;
+	unsigned y;	/*next row to unfilter */
+	unsigned long bytewidth;	/*bytes per pixel used for filtering, 1 when bpp < 8 */
+	unsigned long linebytes;	/*bytes per row, without the filter type byte */
+	unsigned char *line;	/*spare row converted scanlines are unfiltered into */
+	unsigned char *prevline;	/*the last converted row */
+
+	unsigned char *buffer;	/*rows of the destination, pitch bytes apart */
+	unsigned long pitch;
+	upng_row_converter convert;
+	void *user;
+} inflate_output;
+
+static void* default_alloc(unsigned long size, void* user)
+{
+	(void)user;
+	return malloc(size);
+}
+
+static void default_free(void* ptr, void* user)
+{
+	(void)user;
+	free(ptr);
+}
+
+static void* upng_alloc(upng_t* upng, unsigned long size)
+{
+	return upng->allocator.alloc(size, upng->allocator.user);
+}
+
+static void upng_release(upng_t* upng, void* ptr)
+{
+	if (ptr != NULL) {
+		upng->allocator.free(ptr, upng->allocator.user);
+	}
+}
+
 static const unsigned LENGTH_BASE[29] = {	/*the base lengths represented by codes 257-285 */
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
 	67, 83, 99, 115, 131, 163, 195, 227, 258
@@ -129,173 +215,240 @@ static const unsigned DISTANCE_EXTRA[30] = {	/*the extra bits of backwards dista
 static const unsigned CLCL[NUM_CODE_LENGTH_CODES]	/*the order in which "code length alphabet code lengths" are stored, out of this the huffman tree of the dynamic huffman tree lengths is generated */
 = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-	289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-	2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-	13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-	19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-	28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-	37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-	340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-	54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-	363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-	367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-	403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-	85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-	389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-	397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-	419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-	118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-	127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-	134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-	143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-	146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-	155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-	160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-	169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-	176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-	185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-	487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-	497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-	502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-	512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-	517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-	231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-	532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-	247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-	547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-	263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-	562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-	572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
+/* return the first IDAT chunk at or after chunk, or NULL once IEND or the end of the source is reached.
+ * the chunks up to IEND have been checked by upng_check_chunks already. */
+static const unsigned char* find_idat(const unsigned char *chunk, const unsigned char *end)
+{
+	while (chunk < end && upng_chunk_type(chunk) != CHUNK_IEND) {
+		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
+			return chunk;
+		}
+		chunk += upng_chunk_length(chunk) + 12;
+	}
+	return NULL;
+}
 
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-	33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-	44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-	18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-	29, 30, 31, 0, 0
-};
+/* move the bit pointer on by nbits, going on to the following IDAT chunks once it is past the current payload */
+static void idat_stream_advance(idat_stream *stream, unsigned long nbits)
+{
+	stream->bp += nbits;
+	while (stream->bp >= stream->size * 8) {
+		const unsigned char *next = find_idat(stream->data + stream->size + 4, stream->end);
+		if (next == NULL) {
+			break;
+		}
+		stream->bp -= stream->size * 8;
+		stream->data = next + 8;
+		stream->size = upng_chunk_length(next);
+	}
+}
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+static void idat_stream_init(idat_stream *stream, const unsigned char *chunk, const unsigned char *end)
 {
-	unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
-	return result;
+	stream->data = chunk + 8;
+	stream->size = upng_chunk_length(chunk);
+	stream->bp = 0;
+	stream->end = end;
+
+	/* skip empty chunks */
+	idat_stream_advance(stream, 0);
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream, unsigned long nbits)
+/* true once the bit pointer went past the end of the last IDAT chunk */
+static int idat_stream_overrun(const idat_stream *stream)
 {
-	unsigned result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
+	return stream->bp > stream->size * 8;
+}
+
+/* return the next 57 bits or more of the stream at the bit pointer, reading
+ * whole bytes at once instead of one bit at a time. past the end of the input
+ * the bits are zero. */
+static uint64_t idat_stream_peek(const idat_stream *stream)
+{
+	const unsigned char *data = stream->data;
+	unsigned long size = stream->size;
+	unsigned long p = stream->bp >> 3;
+	uint64_t window = 0;
+	unsigned i;
+
+	if (p + 8 <= size) {
+		/* compilers merge this into a single load on little endian hosts */
+		window = (uint64_t)data[p] | ((uint64_t)data[p + 1] << 8) | ((uint64_t)data[p + 2] << 16) | ((uint64_t)data[p + 3] << 24) |
+			((uint64_t)data[p + 4] << 32) | ((uint64_t)data[p + 5] << 40) | ((uint64_t)data[p + 6] << 48) | ((uint64_t)data[p + 7] << 56);
+	} else {
+		/* the window runs on into the next IDAT chunks */
+		for (i = 0; i < 8;) {
+			if (p < size) {
+				window |= (uint64_t)data[p++] << (8 * i);
+				i++;
+			} else {
+				const unsigned char *next = find_idat(data + size + 4, stream->end);
+				if (next == NULL) {
+					break;
+				}
+				data = next + 8;
+				size = upng_chunk_length(next);
+				p = 0;
+			}
+		}
+	}
+
+	return window >> (stream->bp & 0x7);
+}
+
+static unsigned read_bits(idat_stream *stream, unsigned nbits)
+{
+	unsigned result = (unsigned)(idat_stream_peek(stream) & ((1u << nbits) - 1));
+	idat_stream_advance(stream, nbits);
 	return result;
 }
 
-/* the buffer must be numcodes*2 in size! */
+/* the buffer must be HUFFMAN_TABLE_SIZE(numcodes) in size! */
 static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
 {
-	tree->tree2d = buffer;
+	tree->table = buffer;
+	tree->fastbits = 0;
 
 	tree->numcodes = numcodes;
 	tree->maxbitlen = maxbitlen;
 }
 
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
+/* reverse the order of the lowest bits of a code, deflate stores codes starting at their highest bit */
+static unsigned reverse_bits(unsigned code, unsigned bits)
+{
+	unsigned result = 0, i;
+	for (i = 0; i < bits; i++) {
+		result = (result << 1) | ((code >> i) & 1);
+	}
+	return result;
+}
+
+/*given the code lengths (as stored in the PNG file), generate the lookup table of the codes as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
 static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned *bitlen)
 {
 	unsigned tree1d[MAX_SYMBOLS];
-	unsigned blcount[MAX_BIT_LENGTH];
-	unsigned nextcode[MAX_BIT_LENGTH+1];
+	unsigned blcount[MAX_BIT_LENGTH + 1];
+	unsigned nextcode[MAX_BIT_LENGTH + 1];
+	unsigned subbits[1 << HUFFMAN_FAST_BITS];	/*longest code past the primary bits, for each primary index */
 	unsigned bits, n, i;
-	unsigned nodefilled = 0;	/*up to which node it is filled */
-	unsigned treepos = 0;	/*position in the tree (1 of the numcodes columns) */
+	unsigned longest = 0;
+	unsigned fastmask, tablesize;
+	long left = 1;
 
 	/* initialize local vectors */
 	memset(blcount, 0, sizeof(blcount));
 	memset(nextcode, 0, sizeof(nextcode));
 
 	/*step 1: count number of instances of each code length */
-	for (bits = 0; bits < tree->numcodes; bits++) {
-		blcount[bitlen[bits]]++;
+	for (n = 0; n < tree->numcodes; n++) {
+		blcount[bitlen[n]]++;
+		if (bitlen[n] > longest) {
+			longest = bitlen[n];
+		}
+	}
+
+	/* more codes of some length than there is room for means the lengths are corrupt */
+	for (bits = 1; bits <= tree->maxbitlen; bits++) {
+		left = (left << 1) - blcount[bits];
+		if (left < 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
 	}
 
 	/*step 2: generate the nextcode values */
+	blcount[0] = 0;
 	for (bits = 1; bits <= tree->maxbitlen; bits++) {
 		nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
 	}
 
-	/*step 3: generate all the codes */
+	/*step 3: generate all the codes, bit reversed to the order they are read in */
 	for (n = 0; n < tree->numcodes; n++) {
 		if (bitlen[n] != 0) {
-			tree1d[n] = nextcode[bitlen[n]]++;
+			tree1d[n] = reverse_bits(nextcode[bitlen[n]]++, bitlen[n]);
 		}
 	}
 
-	/*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means uninited, a value >= numcodes is an address to another bit, a value < numcodes is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as many columns as codes - 1
-	   a good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes. Here, the internal nodes are stored (what their 0 and 1 option point to). There is only memory for such good tree currently, if there are more nodes (due to too long length codes), error 55 will happen */
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		tree->tree2d[n] = 32767;	/*32767 here means the tree2d isn't filled there yet */
-	}
+	/*step 4: size the primary table to the longest code and find which of
+	   its entries need a secondary table for the longer codes */
+	tree->fastbits = longest < HUFFMAN_FAST_BITS ? (longest > 0 ? longest : 1) : HUFFMAN_FAST_BITS;
+	fastmask = (1u << tree->fastbits) - 1;
+	tablesize = 1u << tree->fastbits;
 
-	for (n = 0; n < tree->numcodes; n++) {	/*the codes */
-		for (i = 0; i < bitlen[n]; i++) {	/*the bits for this code */
-			unsigned char bit = (unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-			/* check if oversubscribed */
-			if (treepos > tree->numcodes - 2) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
+	memset(subbits, 0, sizeof(unsigned) * tablesize);
+	for (n = 0; n < tree->numcodes; n++) {
+		if (bitlen[n] > tree->fastbits && bitlen[n] - tree->fastbits > subbits[tree1d[n] & fastmask]) {
+			subbits[tree1d[n] & fastmask] = bitlen[n] - tree->fastbits;
+		}
+	}
 
-			if (tree->tree2d[2 * treepos + bit] == 32767) {	/*not yet filled in */
-				if (i + 1 == bitlen[n]) {	/*last bit */
-					tree->tree2d[2 * treepos + bit] = n;	/*put the current code in it */
-					treepos = 0;
-				} else {	/*put address of the next step in here, first that address has to be found of course (it's just nodefilled + 1)... */
-					nodefilled++;
-					tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;	/*addresses encoded with numcodes added to it */
-					treepos = nodefilled;
-				}
-			} else {
-				treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
-			}
+	memset(tree->table, 0, sizeof(unsigned) * tablesize);
+	for (i = 0; i < (1u << tree->fastbits); i++) {
+		if (subbits[i] != 0) {
+			tree->table[i] = HUFFMAN_LINK(tablesize, subbits[i]);
+			memset(&tree->table[tablesize], 0, sizeof(unsigned) << subbits[i]);
+			tablesize += 1u << subbits[i];
 		}
 	}
 
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		if (tree->tree2d[n] == 32767) {
-			tree->tree2d[n] = 0;	/*remove possible remaining 32767's */
+	/*step 5: fill in every entry whose bits start with a code */
+	for (n = 0; n < tree->numcodes; n++) {
+		if (bitlen[n] == 0) {
+			continue;
+		}
+
+		if (bitlen[n] <= tree->fastbits) {
+			for (i = tree1d[n]; i < (1u << tree->fastbits); i += 1u << bitlen[n]) {
+				tree->table[i] = HUFFMAN_ENTRY(n, bitlen[n]);
+			}
+		} else {
+			unsigned link = tree->table[tree1d[n] & fastmask];
+			unsigned *subtable = &tree->table[HUFFMAN_ENTRY_VALUE(link)];
+			unsigned subbitlen = bitlen[n] - tree->fastbits;
+
+			for (i = tree1d[n] >> tree->fastbits; i < (1u << HUFFMAN_ENTRY_BITS(link)); i += 1u << subbitlen) {
+				subtable[i] = HUFFMAN_ENTRY(n, subbitlen);
+			}
 		}
 	}
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+/* decode the code at the start of the window, shifting its bits out of the
+ * window and adding their number to used. returns the table entry of the
+ * code, which consumes no bits for codes that are not in the tree */
+static unsigned huffman_decode_window(const huffman_tree* codetree, uint64_t *window, unsigned *used)
 {
-	unsigned treepos = 0, ct;
-	unsigned char bit;
-	for (;;) {
-		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	unsigned entry = codetree->table[*window & ((1u << codetree->fastbits) - 1)];
 
-		bit = read_bit(bp, in);
+	if (HUFFMAN_ENTRY_IS_LINK(entry)) {
+		*window >>= codetree->fastbits;
+		*used += codetree->fastbits;
+		entry = codetree->table[HUFFMAN_ENTRY_VALUE(entry) + (*window & ((1u << HUFFMAN_ENTRY_BITS(entry)) - 1))];
+	}
 
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
-		}
+	*window >>= HUFFMAN_ENTRY_BITS(entry);
+	*used += HUFFMAN_ENTRY_BITS(entry);
+	return entry;
+}
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+static unsigned huffman_decode_symbol(upng_t *upng, idat_stream *in, const huffman_tree* codetree)
+{
+	uint64_t window = idat_stream_peek(in);
+	unsigned used = 0;
+	unsigned entry = huffman_decode_window(codetree, &window, &used);
+
+	/* error: a code that is not in the tree, or the end of input memory reached without endcode */
+	idat_stream_advance(in, used);
+	if (HUFFMAN_ENTRY_BITS(entry) == 0 || idat_stream_overrun(in)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
 	}
+
+	return HUFFMAN_ENTRY_VALUE(entry);
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, idat_stream *in)
 {
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
 	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
@@ -304,7 +457,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 
 	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
 	/*C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
+	if ((in->bp >> 3) >= in->size) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
@@ -314,18 +467,24 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	memset(bitlenD, 0, sizeof(bitlenD));
 
 	/*the bit pointer is or will go past the memory */
-	hlit = read_bits(bp, in, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
+	hlit = read_bits(in, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
+	hdist = read_bits(in, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
+	hclen = read_bits(in, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
 
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+			codelengthcode[CLCL[i]] = read_bits(in, 3);
 		} else {
 			codelengthcode[CLCL[i]] = 0;	/*if not, it must stay 0 */
 		}
 	}
 
+	/*the bit pointer went past the memory */
+	if (idat_stream_overrun(in)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
 	huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
 
 	/* bail now if we encountered an error earlier */
@@ -336,7 +495,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	/*now we can use this tree to read the lengths for the tree that this function will return */
 	i = 0;
 	while (i < hlit + hdist) {	/*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-		unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+		unsigned code = huffman_decode_symbol(upng, in, codelengthcodetree);
 		if (upng->error != UPNG_EOK) {
 			break;
 		}
@@ -352,12 +511,12 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			unsigned replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
 			unsigned value;	/*set value to the previous code */
 
-			if ((*bp) >> 3 >= inlength) {
+			if ((in->bp >> 3) >= in->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
 			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
+			replength += read_bits(in, 2);
 
 			if ((i - 1) < hlit) {
 				value = bitlen[i - 1];
@@ -382,13 +541,13 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 			}
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
 			unsigned replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
+			if ((in->bp >> 3) >= in->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
 
 			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
+			replength += read_bits(in, 3);
 
 			/*repeat this value in the next lengths */
 			for (n = 0; n < replength; n++) {
@@ -408,12 +567,12 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 		} else if (code == 18) {	/*repeat "0" 11-138 times */
 			unsigned replength = 11;	/*read in the bits that indicate repeat length */
 			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
+			if ((in->bp >> 3) >= in->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
 
-			replength += read_bits(bp, in, 7);
+			replength += read_bits(in, 7);
 
 			/*repeat this value in the next lengths */
 			for (n = 0; n < replength; n++) {
@@ -449,8 +608,51 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	}
 }
 
+/* build the trees of a block with fixed Huffman codes, whose code lengths are given by the spec */
+static void get_tree_inflate_fixed(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD)
+{
+	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+	unsigned n;
+
+	for (n = 0; n < NUM_DEFLATE_CODE_SYMBOLS; n++) {
+		bitlen[n] = n <= 143 ? 8 : (n <= 255 ? 9 : (n <= 279 ? 7 : 8));
+	}
+	for (n = 0; n < NUM_DISTANCE_SYMBOLS; n++) {
+		bitlenD[n] = 5;
+	}
+
+	huffman_tree_create_lengths(upng, codetree, bitlen);
+	if (upng->error == UPNG_EOK) {
+		huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+	}
+}
+
+static void flush_scanlines(upng_t* upng, inflate_output *out);
+
+/* copy a back-reference of length bytes from distance bytes back. the caller
+ * makes sure there are 8 bytes of room past the end of the copy */
+static void copy_back_reference(unsigned char *out, unsigned long distance, unsigned long length)
+{
+	const unsigned char *from = out - distance;
+	unsigned long n;
+
+	if (distance >= 8) {
+		/* 8 byte chunks never overlap the bytes they are copied from */
+		for (n = 0; n < length; n += 8) {
+			memcpy(out + n, from + n, 8);
+		}
+	} else if (distance == 1) {
+		memset(out, from[0], length);
+	} else {
+		for (n = 0; n < length; n++) {
+			out[n] = from[n];
+		}
+	}
+}
+
 /*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+static void inflate_huffman(upng_t* upng, inflate_output *out, idat_stream *in, unsigned btype)
 {
 	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
 	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
@@ -459,24 +661,47 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 	huffman_tree codetree;
 	huffman_tree codetreeD;
 
+	huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
+	huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
+
 	if (btype == 1) {
 		/* fixed trees */
-		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
+		get_tree_inflate_fixed(upng, &codetree, &codetreeD);
 	} else if (btype == 2) {
 		/* dynamic trees */
 		unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
 		huffman_tree codelengthcodetree;
 
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
 		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in);
+	}
+
+	if (upng->error != UPNG_EOK) {
+		return;
 	}
 
 	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
-		if (upng->error != UPNG_EOK) {
+		uint64_t window;
+		unsigned used = 0;
+		unsigned entry, code;
+
+		/* make room for the longest back-reference */
+		if (out->capacity - out->pos < WINDOW_SLACK) {
+			flush_scanlines(upng, out);
+			if (upng->error != UPNG_EOK) {
+				return;
+			}
+		}
+
+		/* one window holds the longest length code, distance code and their
+		 * extra bits (15 + 5 + 15 + 13 bits) */
+		window = idat_stream_peek(in);
+		entry = huffman_decode_window(&codetree, &window, &used);
+		code = HUFFMAN_ENTRY_VALUE(entry);
+
+		/* error: a code that is not in the tree */
+		if (HUFFMAN_ENTRY_BITS(entry) == 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
 			return;
 		}
 
@@ -485,37 +710,31 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			done = 1;
 		} else if (code <= 255) {
 			/* literal symbol */
-			if ((*pos) >= outsize) {
+			if (out->pos >= out->end) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
 			/* store output */
-			out[(*pos)++] = (unsigned char)(code);
+			out->window[out->pos++] = (unsigned char)(code);
 		} else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
 			/* part 1: get length base */
 			unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
-			unsigned codeD, distance, numextrabitsD;
-			unsigned long start, forward, backward, numextrabits;
+			unsigned codeD, numextrabitsD;
+			unsigned long distance, numextrabits;
 
 			/* part 2: get extra bits and add the value of that to length */
 			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-			length += read_bits(bp, in, numextrabits);
+			length += (unsigned long)(window & ((1u << numextrabits) - 1));
+			window >>= numextrabits;
+			used += numextrabits;
 
 			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
-			if (upng->error != UPNG_EOK) {
-				return;
-			}
+			entry = huffman_decode_window(&codetreeD, &window, &used);
+			codeD = HUFFMAN_ENTRY_VALUE(entry);
 
 			/* invalid distance code (30-31 are never used) */
-			if (codeD > 29) {
+			if (HUFFMAN_ENTRY_BITS(entry) == 0 || codeD > 29) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
@@ -524,111 +743,108 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 
 			/*part 4: get extra bits from distance */
 			numextrabitsD = DISTANCE_EXTRA[codeD];
+			distance += (unsigned long)(window & ((1u << numextrabitsD) - 1));
+			used += numextrabitsD;
 
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
+			/*part 5: fill in all the out[n] values based on the length and dist.
+			  the window keeps at least the last 32K bytes, so any distance up to the position is there */
+			if (distance > out->pos || out->pos + length > out->end) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			distance += read_bits(bp, in, numextrabitsD);
-
-			/*part 5: fill in all the out[n] values based on the length and dist */
-			start = (*pos);
-			backward = start - distance;
-
-			if ((*pos) + length >= outsize) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-
-			for (forward = 0; forward < length; forward++) {
-				out[(*pos)++] = out[backward];
-				backward++;
+			copy_back_reference(&out->window[out->pos], distance, length);
+			out->pos += length;
+		}
 
-				if (backward >= start) {
-					backward = start - distance;
-				}
-			}
+		/* error: end of input memory reached without endcode */
+		idat_stream_advance(in, used);
+		if (idat_stream_overrun(in)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
 		}
 	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, inflate_output *out, idat_stream *in)
 {
-	unsigned long p;
-	unsigned len, nlen, n;
+	unsigned long len, nlen;
 
 	/* go to first boundary of byte */
-	while (((*bp) & 0x7) != 0) {
-		(*bp)++;
-	}
-	p = (*bp) / 8;		/*byte position */
+	idat_stream_advance(in, (8 - (in->bp & 0x7)) & 0x7);
 
 	/* read len (2 bytes) and nlen (2 bytes) */
-	if (p >= inlength - 4) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
-
-	len = in[p] + 256 * in[p + 1];
-	p += 2;
-	nlen = in[p] + 256 * in[p + 1];
-	p += 2;
+	len = read_bits(in, 16);
+	nlen = read_bits(in, 16);
 
 	/* check if 16-bit nlen is really the one's complement of len */
-	if (len + nlen != 65535) {
+	if (idat_stream_overrun(in) || len + nlen != 65535) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	if ((*pos) + len >= outsize) {
+	if (out->pos + len > out->end) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	/* read the literal data: len bytes are now stored in the out buffer */
-	if (p + len > inlength) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
+	/* read the literal data, as much of it at a time as the window and the current IDAT chunk allow */
+	while (len > 0) {
+		unsigned long n = len;
 
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
-	}
+		if (out->capacity - out->pos < WINDOW_SLACK) {
+			flush_scanlines(upng, out);
+			if (upng->error != UPNG_EOK) {
+				return;
+			}
+		}
+
+		/* error: reading outside of in buffer */
+		if ((in->bp >> 3) >= in->size) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+
+		if (n > in->size - (in->bp >> 3)) {
+			n = in->size - (in->bp >> 3);
+		}
+		if (n > out->capacity - out->pos) {
+			n = out->capacity - out->pos;
+		}
 
-	(*bp) = p * 8;
+		memcpy(&out->window[out->pos], &in->data[in->bp >> 3], n);
+		out->pos += n;
+		len -= n;
+		idat_stream_advance(in, n * 8);
+	}
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
-static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
+static upng_error uz_inflate_data(upng_t* upng, inflate_output *out, idat_stream *in)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
-	unsigned long pos = 0;	/*byte position in the out buffer */
-
 	unsigned done = 0;
 
 	while (done == 0) {
 		unsigned btype;
 
 		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		if ((in->bp >> 3) >= in->size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 
 		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
+		done = read_bits(in, 1);
+		btype = read_bits(in, 2);
 
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, out, in);	/*no compression */
 		} else {
-			inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	/*compression, btype 01 or 10 */
+			inflate_huffman(upng, out, in, btype);	/*compression, btype 01 or 10 */
 		}
 
 		/* stop if an error has occured */
@@ -640,34 +856,46 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 	return upng->error;
 }
 
-static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize, const unsigned char *in, unsigned long insize)
+static upng_error uz_inflate(upng_t* upng, inflate_output *out, idat_stream *in)
 {
+	unsigned cmf, flg;
+
 	/* we require two bytes for the zlib data header */
-	if (insize < 2) {
+	cmf = read_bits(in, 8);
+	flg = read_bits(in, 8);
+	if (idat_stream_overrun(in)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/* 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way */
-	if ((in[0] * 256 + in[1]) % 31 != 0) {
+	if ((cmf * 256 + flg) % 31 != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/*error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec */
-	if ((in[0] & 15) != 8 || ((in[0] >> 4) & 15) > 7) {
+	if ((cmf & 15) != 8 || ((cmf >> 4) & 15) > 7) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/* the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary." */
-	if (((in[1] >> 5) & 1) != 0) {
+	if (((flg >> 5) & 1) != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
-	/* create output buffer */
-	uz_inflate_data(upng, out, outsize, in, insize, 2);
+	uz_inflate_data(upng, out, in);
+	if (upng->error != UPNG_EOK) {
+		return upng->error;
+	}
+
+	/* unfilter the last scanlines, the stream must have held all of them */
+	flush_scanlines(upng, out);
+	if (upng->error == UPNG_EOK && out->y < out->height) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
 
 	return upng->error;
 }
@@ -688,6 +916,97 @@ static int paeth_predictor(int a, int b, int c)
 		return c;
 }
 
+#ifdef __SSE2__
+/* load one pixel of 3 or 4 bytes into the low lanes, the other lanes are zero */
+static inline __m128i load_pixel(const unsigned char *p, unsigned long bytewidth)
+{
+	int v = 0;
+	memcpy(&v, p, bytewidth);
+	return _mm_cvtsi32_si128(v);
+}
+
+static inline void store_pixel(unsigned char *p, __m128i v, unsigned long bytewidth)
+{
+	int x = _mm_cvtsi128_si32(v);
+	memcpy(p, &x, bytewidth);
+}
+
+/* Paeth predictor of all channels of a pixel at once, a, b and c hold 16 bit lanes */
+static __m128i paeth_predictor_sse2(__m128i a, __m128i b, __m128i c)
+{
+	__m128i pa = _mm_sub_epi16(b, c);	/* p - a */
+	__m128i pb = _mm_sub_epi16(a, c);	/* p - b */
+	__m128i pc = _mm_add_epi16(pa, pb);	/* p - c */
+	__m128i smallest;
+
+	pa = _mm_max_epi16(pa, _mm_sub_epi16(_mm_setzero_si128(), pa));
+	pb = _mm_max_epi16(pb, _mm_sub_epi16(_mm_setzero_si128(), pb));
+	pc = _mm_max_epi16(pc, _mm_sub_epi16(_mm_setzero_si128(), pc));
+	smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+	/* ties prefer a, then b, like the scalar predictor */
+	c = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi16(pb, smallest), b), _mm_andnot_si128(_mm_cmpeq_epi16(pb, smallest), c));
+	return _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi16(pa, smallest), a), _mm_andnot_si128(_mm_cmpeq_epi16(pa, smallest), c));
+}
+
+/*
+   unfilter the Sub, Avg and Paeth filters of a scanline with 3 or 4 bytes per pixel, one pixel per step.
+   a scanline always holds a whole number of pixels here. each pixel is read before it is written,
+   so recon may overlap scanline the same way as in unfilter_scanline. precon must not be NULL.
+ */
+static inline void unfilter_pixels_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero;	/* the pixel left of the current one, already unfiltered */
+	__m128i b, c = zero;	/* the pixels above and above left of the current one */
+	unsigned long i;
+
+	switch (filterType) {
+	case 1:
+		for (i = 0; i < length; i += bytewidth) {
+			a = _mm_add_epi8(load_pixel(&scanline[i], bytewidth), a);
+			store_pixel(&recon[i], a, bytewidth);
+		}
+		break;
+	case 3:
+		for (i = 0; i < length; i += bytewidth) {
+			/* pavgb rounds up, remove the carry to get the rounded down average */
+			b = load_pixel(&precon[i], bytewidth);
+			b = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			a = _mm_add_epi8(load_pixel(&scanline[i], bytewidth), b);
+			store_pixel(&recon[i], a, bytewidth);
+		}
+		break;
+	case 4:
+		for (i = 0; i < length; i += bytewidth) {
+			__m128i predictor;
+
+			b = _mm_unpacklo_epi8(load_pixel(&precon[i], bytewidth), zero);
+			predictor = paeth_predictor_sse2(a, b, c);
+			a = _mm_add_epi8(load_pixel(&scanline[i], bytewidth), _mm_packus_epi16(predictor, predictor));
+			store_pixel(&recon[i], a, bytewidth);
+			a = _mm_unpacklo_epi8(a, zero);
+			c = b;
+		}
+		break;
+	}
+}
+
+/* unfilter the Up filter 16 bytes at a time, which works for any pixel size */
+static void unfilter_up_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unsigned long i;
+
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)&scanline[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&precon[i]);
+		_mm_storeu_si128((__m128i *)&recon[i], _mm_add_epi8(x, b));
+	}
+	for (; i < length; i++)
+		recon[i] = scanline[i] + precon[i];
+}
+#endif
+
 static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
 {
 	/*
@@ -699,6 +1018,23 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	 */
 
 	unsigned long i;
+
+#ifdef __SSE2__
+	if (filterType == 2 && precon) {
+		unfilter_up_sse2(recon, scanline, precon, length);
+		return;
+	}
+	/* constant pixel sizes let the compiler specialize the loads and stores of each pixel */
+	if ((filterType == 1 || (precon && (filterType == 3 || filterType == 4))) && bytewidth == 4) {
+		unfilter_pixels_sse2(recon, scanline, precon, 4, filterType, length);
+		return;
+	}
+	if ((filterType == 1 || (precon && (filterType == 3 || filterType == 4))) && bytewidth == 3) {
+		unfilter_pixels_sse2(recon, scanline, precon, 3, filterType, length);
+		return;
+	}
+#endif
+
 	switch (filterType) {
 	case 0:
 		for (i = 0; i < length; i++)
@@ -750,83 +1086,69 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	}
 }
 
-static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w, unsigned h, unsigned bpp)
+/* unfilter every complete scanline in the window into the destination, then drop what neither the
+ * back-references nor the next scanline still need from the front of the window */
+static void flush_scanlines(upng_t* upng, inflate_output *out)
 {
-	/*
-	   For PNG filter method 0
-	   this function unfilters a single image (e.g. without interlacing this is called once, with Adam7 it's called 7 times)
-	   out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
-	   w and h are image dimensions or dimensions of reduced image, bpp is bpp per pixel
-	   in and out are allowed to be the same memory address!
-	 */
-
-	unsigned y;
-	unsigned char *prevline = 0;
+	unsigned long keep;
 
-	unsigned long bytewidth = (bpp + 7) / 8;	/*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise */
-	unsigned long linebytes = (w * bpp + 7) / 8;
+	while (out->y < out->height && out->pos - out->scanline >= out->linebytes + 1) {
+		unsigned char *dest = out->buffer + out->pitch * out->y;
+		unsigned char filterType = out->window[out->scanline];
 
-	for (y = 0; y < h; y++) {
-		unsigned long outindex = linebytes * y;
-		unsigned long inindex = (1 + linebytes) * y;	/*the extra filterbyte added to each row */
-		unsigned char filterType = in[inindex];
+		if (out->convert == NULL) {
+			/* unfilter straight into the destination, against the row above it */
+			const unsigned char *precon = out->y > 0 ? dest - out->pitch : NULL;
+			unfilter_scanline(upng, dest, &out->window[out->scanline + 1], precon, out->bytewidth, filterType, out->linebytes);
+		} else {
+			/* unfilter into the spare row, against the previous row, then convert it */
+			unsigned char *line = out->line;
 
-		unfilter_scanline(upng, &out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes);
+			unfilter_scanline(upng, line, &out->window[out->scanline + 1], out->y > 0 ? out->prevline : NULL, out->bytewidth, filterType, out->linebytes);
+			out->line = out->prevline;
+			out->prevline = line;
+			out->convert(dest, line, out->width, out->user);
+		}
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
 
-		prevline = &out[outindex];
+		out->scanline += out->linebytes + 1;
+		out->y++;
 	}
-}
 
-static void remove_padding_bits(unsigned char *out, const unsigned char *in, unsigned long olinebits, unsigned long ilinebits, unsigned h)
-{
-	/*
-	   After filtering there are still padding bpp if scanlines have non multiple of 8 bit amounts. They need to be removed (except at last scanline of (Adam7-reduced) image) before working with pure image buffers for the Adam7 code, the color convert code and the output to the user.
-	   in and out are allowed to be the same buffer, in may also be higher but still overlapping; in must have >= ilinebits*h bpp, out must have >= olinebits*h bpp, olinebits must be <= ilinebits
-	   also used to move bpp after earlier such operations happened, e.g. in a sequence of reduced images from Adam7
-	   only useful if (ilinebits - olinebits) is a value in the range 1..7
-	 */
-	unsigned y;
-	unsigned long diff = ilinebits - olinebits;
-	unsigned long obp = 0, ibp = 0;	/*bit pointers */
-	for (y = 0; y < h; y++) {
-		unsigned long x;
-		for (x = 0; x < olinebits; x++) {
-			unsigned char bit = (unsigned char)((in[(ibp) >> 3] >> (7 - ((ibp) & 0x7))) & 1);
-			ibp++;
-
-			if (bit == 0)
-				out[(obp) >> 3] &= (unsigned char)(~(1 << (7 - ((obp) & 0x7))));
-			else
-				out[(obp) >> 3] |= (1 << (7 - ((obp) & 0x7)));
-			++obp;
-		}
-		ibp += diff;
+	keep = out->pos > INFLATE_WINDOW_SIZE ? out->pos - INFLATE_WINDOW_SIZE : 0;
+	if (keep > out->scanline) {
+		keep = out->scanline;
 	}
+	memmove(out->window, out->window + keep, out->pos - keep);
+	out->pos -= keep;
+	out->end -= keep;
+	out->scanline -= keep;
 }
 
-/*out must be buffer big enough to contain full image, and in must contain the full decompressed data from the IDAT chunks*/
-static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned char *in, const upng_t* info_png)
+/* rows of images with less than 8 bits per pixel are packed without padding bits in upng->buffer */
+typedef struct packed_rows {
+	unsigned char *out;
+	unsigned long obp;	/*bit pointer in out */
+	unsigned long linebits;	/*bits per row, without the padding */
+} packed_rows;
+
+static void pack_row(unsigned char *dest, const unsigned char *row, unsigned width, void *user)
 {
-	unsigned bpp = upng_get_bpp(info_png);
-	unsigned w = info_png->width;
-	unsigned h = info_png->height;
+	packed_rows *rows = (packed_rows*)user;
+	unsigned long ibp;
+	(void)dest;
+	(void)width;
 
-	if (bpp == 0) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
+	for (ibp = 0; ibp < rows->linebits; ibp++) {
+		unsigned char bit = (unsigned char)((row[ibp >> 3] >> (7 - (ibp & 0x7))) & 1);
+		unsigned long obp = rows->obp++;
 
-	if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8) {
-		unfilter(upng, in, in, w, h, bpp);
-		if (upng->error != UPNG_EOK) {
-			return;
-		}
-		remove_padding_bits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
-	} else {
-		unfilter(upng, out, in, w, h, bpp);	/*we can immediatly filter into the out buffer, no other steps needed */
+		if (bit == 0)
+			rows->out[obp >> 3] &= (unsigned char)(~(1 << (7 - (obp & 0x7))));
+		else
+			rows->out[obp >> 3] |= (1 << (7 - (obp & 0x7)));
 	}
 }
 
@@ -884,7 +1206,7 @@ static upng_format determine_format(upng_t* upng) {
 static void upng_free_source(upng_t* upng)
 {
 	if (upng->source.owning != 0) {
-		free((void*)upng->source.buffer);
+		upng_release(upng, (void*)upng->source.buffer);
 	}
 
 	upng->source.buffer = NULL;
@@ -960,147 +1282,163 @@ upng_error upng_header(upng_t* upng)
 	return upng->error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-upng_error upng_decode(upng_t* upng)
+/* check the chunks up to IEND and return the first IDAT chunk */
+static const unsigned char* upng_check_chunks(upng_t* upng)
 {
 	const unsigned char *chunk;
-	unsigned char* compressed;
-	unsigned char* inflated;
-	unsigned long compressed_size = 0, compressed_index = 0;
-	unsigned long inflated_size;
-	upng_error error;
-
-	/* if we have an error state, bail now */
-	if (upng->error != UPNG_EOK) {
-		return upng->error;
-	}
-
-	/* parse the main header, if necessary */
-	upng_header(upng);
-	if (upng->error != UPNG_EOK) {
-		return upng->error;
-	}
-
-	/* if the state is not HEADER (meaning we are ready to decode the image), stop now */
-	if (upng->state != UPNG_HEADER) {
-		return upng->error;
-	}
-
-	/* release old result, if any */
-	if (upng->buffer != 0) {
-		free(upng->buffer);
-		upng->buffer = 0;
-		upng->size = 0;
-	}
 
 	/* first byte of the first chunk after the header */
 	chunk = upng->source.buffer + 33;
 
-	/* scan through the chunks, finding the size of all IDAT chunks, and also
-	 * verify general well-formed-ness */
+	/* scan through the chunks, verifying general well-formed-ness */
 	while (chunk < upng->source.buffer + upng->source.size) {
 		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
 
 		/* make sure chunk header is not larger than the total compressed */
 		if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return NULL;
 		}
 
 		/* get length; sanity check it */
 		length = upng_chunk_length(chunk);
 		if (length > INT_MAX) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return NULL;
 		}
 
 		/* make sure chunk header+paylaod is not larger than the total compressed */
 		if ((unsigned long)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return NULL;
 		}
 
-		/* get pointer to payload */
-		data = chunk + 8;
-
 		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			compressed_size += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
+		if (upng_chunk_type(chunk) == CHUNK_IEND) {
 			break;
-		} else if (upng_chunk_critical(chunk)) {
+		} else if (upng_chunk_type(chunk) != CHUNK_IDAT && upng_chunk_critical(chunk)) {
 			SET_ERROR(upng, UPNG_EUNSUPPORTED);
-			return upng->error;
+			return NULL;
 		}
 
-		chunk += upng_chunk_length(chunk) + 12;
+		chunk += length + 12;
 	}
 
-	/* allocate enough space for the (compressed and filtered) image data */
-	compressed = (unsigned char*)malloc(compressed_size);
-	if (compressed == NULL) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
+	/* there is no image without image data */
+	chunk = find_idat(upng->source.buffer + 33, upng->source.buffer + upng->source.size);
+	if (chunk == NULL) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
 	}
+	return chunk;
+}
 
-	/* scan through the chunks again, this time copying the values into
-	 * our compressed buffer.  there's no reason to validate anything a second time. */
-	chunk = upng->source.buffer + 33;
-	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
+/* inflate the IDAT chunks in place and unfilter them scanline by scanline into the rows of buffer */
+static upng_error upng_decode_rows(upng_t* upng, unsigned char *buffer, unsigned long pitch, upng_row_converter convert, void *user)
+{
+	const unsigned char *chunk;
+	inflate_output out;
+	idat_stream in;
+	unsigned bpp = upng_get_bpp(upng);
 
-		length = upng_chunk_length(chunk);
-		data = chunk + 8;
+	if (bpp == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return upng->error;
+	}
 
-		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			memcpy(compressed + compressed_index, data, length);
-			compressed_index += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
-			break;
+	chunk = upng_check_chunks(upng);
+	if (chunk == NULL) {
+		return upng->error;
+	}
+	idat_stream_init(&in, chunk, upng->source.buffer + upng->source.size);
+
+	out.width = upng->width;
+	out.height = upng->height;
+	out.y = 0;
+	out.bytewidth = (bpp + 7) / 8;	/*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise */
+	out.linebytes = ((unsigned long)upng->width * bpp + 7) / 8;
+	out.buffer = buffer;
+	out.pitch = pitch;
+	out.convert = convert;
+	out.user = user;
+
+	/* the window holds the 32K of history plus at least one scanline, with room to spare so it
+	 * is compacted rarely. the two rows for converted scanlines follow it. the memory is kept
+	 * for the next image, and only grows for larger rows. */
+	out.capacity = 3 * INFLATE_WINDOW_SIZE + out.linebytes + 1;
+	if (upng->scratch_size < out.capacity + 2 * out.linebytes) {
+		upng_release(upng, upng->scratch);
+		upng->scratch_size = out.capacity + 2 * out.linebytes;
+		upng->scratch = (unsigned char*)upng_alloc(upng, upng->scratch_size);
+		if (upng->scratch == NULL) {
+			upng->scratch_size = 0;
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return upng->error;
 		}
+	}
+	out.window = upng->scratch;
+	out.line = out.window + out.capacity;
+	out.prevline = out.line + out.linebytes;
+	out.pos = 0;
+	out.scanline = 0;
+	out.end = (out.linebytes + 1) * upng->height;
 
-		chunk += upng_chunk_length(chunk) + 12;
+	uz_inflate(upng, &out, &in);
+
+	return upng->error;
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+upng_error upng_decode(upng_t* upng)
+{
+	unsigned bpp;
+
+	/* if we have an error state, bail now */
+	if (upng->error != UPNG_EOK) {
+		return upng->error;
 	}
 
-	/* allocate space to store inflated (but still filtered) data */
-	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
-	inflated = (unsigned char*)malloc(inflated_size);
-	if (inflated == NULL) {
-		free(compressed);
-		SET_ERROR(upng, UPNG_ENOMEM);
+	/* parse the main header, if necessary */
+	upng_header(upng);
+	if (upng->error != UPNG_EOK) {
 		return upng->error;
 	}
 
-	/* decompress image data */
-	error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
-	if (error != UPNG_EOK) {
-		free(compressed);
-		free(inflated);
+	/* if the state is not HEADER (meaning we are ready to decode the image), stop now */
+	if (upng->state != UPNG_HEADER) {
 		return upng->error;
 	}
 
-	/* free the compressed compressed data */
-	free(compressed);
+	/* release old result, if any */
+	if (upng->buffer != 0) {
+		upng_release(upng, upng->buffer);
+		upng->buffer = 0;
+		upng->size = 0;
+	}
 
 	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
-	upng->buffer = (unsigned char*)malloc(upng->size);
+	bpp = upng_get_bpp(upng);
+	upng->size = (upng->height * upng->width * bpp + 7) / 8;
+	upng->buffer = (unsigned char*)upng_alloc(upng, upng->size);
 	if (upng->buffer == NULL) {
-		free(inflated);
 		upng->size = 0;
 		SET_ERROR(upng, UPNG_ENOMEM);
 		return upng->error;
 	}
 
 	/* unfilter scanlines */
-	post_process_scanlines(upng, upng->buffer, inflated, upng);
-	free(inflated);
+	if (bpp < 8 && upng->width * bpp != ((upng->width * bpp + 7) / 8) * 8) {
+		packed_rows rows;
+		rows.out = upng->buffer;
+		rows.obp = 0;
+		rows.linebits = upng->width * bpp;
+		upng->buffer[upng->size - 1] = 0;	/*the bits past the last row */
+		upng_decode_rows(upng, upng->buffer, 0, pack_row, &rows);
+	} else {
+		upng_decode_rows(upng, upng->buffer, ((unsigned long)upng->width * bpp + 7) / 8, NULL, NULL);	/*we can immediatly filter into the out buffer, no other steps needed */
+	}
 
 	if (upng->error != UPNG_EOK) {
-		free(upng->buffer);
+		upng_release(upng, upng->buffer);
 		upng->buffer = NULL;
 		upng->size = 0;
 	} else {
@@ -1113,15 +1451,45 @@ upng_error upng_decode(upng_t* upng)
 	return upng->error;
 }
 
-static upng_t* upng_new(void)
+/*read a PNG into the rows of a buffer of the caller, pitch bytes apart. each row is handed to convert,
+  or stored as it is in the PNG when convert is NULL (rows of less than 8 bpp then keep their padding bits)*/
+upng_error upng_decode_into(upng_t* upng, unsigned char* buffer, unsigned long pitch, upng_row_converter convert, void* user)
 {
-	upng_t* upng;
+	/* if we have an error state, bail now */
+	if (upng->error != UPNG_EOK) {
+		return upng->error;
+	}
 
-	upng = (upng_t*)malloc(sizeof(upng_t));
-	if (upng == NULL) {
-		return NULL;
+	/* parse the main header, if necessary */
+	upng_header(upng);
+	if (upng->error != UPNG_EOK) {
+		return upng->error;
 	}
 
+	/* if the state is not HEADER (meaning we are ready to decode the image), stop now */
+	if (upng->state != UPNG_HEADER) {
+		return upng->error;
+	}
+
+	upng_decode_rows(upng, buffer, pitch, convert, user);
+	if (upng->error == UPNG_EOK) {
+		upng->state = UPNG_DECODED;
+	}
+
+	/* we are done with our input buffer; free it if we own it */
+	upng_free_source(upng);
+
+	return upng->error;
+}
+
+/* start over on a new image, without a source */
+static void upng_reset(upng_t* upng)
+{
+	if (upng->buffer != NULL) {
+		upng_release(upng, upng->buffer);
+	}
+	upng_free_source(upng);
+
 	upng->buffer = NULL;
 	upng->size = 0;
 
@@ -1135,24 +1503,56 @@ static upng_t* upng_new(void)
 
 	upng->error = UPNG_EOK;
 	upng->error_line = 0;
+}
+
+upng_t* upng_new_with_allocator(const upng_allocator* allocator)
+{
+	upng_allocator memory;
+	upng_t* upng;
+
+	if (allocator != NULL) {
+		memory = *allocator;
+	} else {
+		memory.alloc = default_alloc;
+		memory.free = default_free;
+		memory.user = NULL;
+	}
+
+	upng = (upng_t*)memory.alloc(sizeof(upng_t), memory.user);
+	if (upng == NULL) {
+		return NULL;
+	}
+
+	upng->allocator = memory;
+	upng->scratch = NULL;
+	upng->scratch_size = 0;
 
+	upng->buffer = NULL;
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
 	upng->source.owning = 0;
+	upng_reset(upng);
 
 	return upng;
 }
 
+void upng_set_source(upng_t* upng, const unsigned char* buffer, unsigned long size)
+{
+	upng_reset(upng);
+
+	upng->source.buffer = buffer;
+	upng->source.size = size;
+	upng->source.owning = 0;
+}
+
 upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size)
 {
-	upng_t* upng = upng_new();
+	upng_t* upng = upng_new_with_allocator(NULL);
 	if (upng == NULL) {
 		return NULL;
 	}
 
-	upng->source.buffer = buffer;
-	upng->source.size = size;
-	upng->source.owning = 0;
+	upng_set_source(upng, buffer, size);
 
 	return upng;
 }
@@ -1164,7 +1564,7 @@ upng_t* upng_new_from_file(const char *filename)
 	FILE *file;
 	long size;
 
-	upng = upng_new();
+	upng = upng_new_with_allocator(NULL);
 	if (upng == NULL) {
 		return NULL;
 	}
@@ -1181,7 +1581,7 @@ upng_t* upng_new_from_file(const char *filename)
 	rewind(file);
 
 	/* read contents of the file into the vector */
-	buffer = (unsigned char *)malloc((unsigned long)size);
+	buffer = (unsigned char *)upng_alloc(upng, (unsigned long)size);
 	if (buffer == NULL) {
 		fclose(file);
 		SET_ERROR(upng, UPNG_ENOMEM);
@@ -1200,16 +1600,14 @@ upng_t* upng_new_from_file(const char *filename)
 
 void upng_free(upng_t* upng)
 {
-	/* deallocate image buffer */
-	if (upng->buffer != NULL) {
-		free(upng->buffer);
-	}
+	/* deallocate image buffer and source buffer, if necessary */
+	upng_reset(upng);
 
-	/* deallocate source buffer, if necessary */
-	upng_free_source(upng);
+	/* deallocate scratch memory */
+	upng_release(upng, upng->scratch);
 
 	/* deallocate struct itself */
-	free(upng);
+	upng->allocator.free(upng, upng->allocator.user);
 }
 
 upng_error upng_get_error(const upng_t* upng)
@@ -57,12 +57,30 @@ typedef enum upng_format {
 
 typedef struct upng_t upng_t;
 
+/* callbacks for all the memory upng allocates, such as an arena or a pool */
+typedef struct upng_allocator {
+	void*	(*alloc)	(unsigned long size, void* user);
+	void	(*free)		(void* ptr, void* user);
+	void*	user;
+} upng_allocator;
+
+/* called by upng_decode_into with each unfiltered row of the image, as stored in the PNG, to write
+ * it to its row of the destination in any format */
+typedef void (*upng_row_converter)(unsigned char* dest, const unsigned char* row, unsigned width, void* user);
+
 upng_t*		upng_new_from_bytes	(const unsigned char* buffer, unsigned long size);
 upng_t*		upng_new_from_file	(const char* path);
 void		upng_free			(upng_t* upng);
 
+/* a decoder without an image, which allocates through allocator (malloc and free when NULL).
+ * upng_set_source starts it over on a new image, keeping the scratch memory of earlier decodes,
+ * so decoding images one after another with upng_decode_into allocates nothing once warmed up. */
+upng_t*		upng_new_with_allocator	(const upng_allocator* allocator);
+void		upng_set_source		(upng_t* upng, const unsigned char* buffer, unsigned long size);
+
 upng_error	upng_header			(upng_t* upng);
 upng_error	upng_decode			(upng_t* upng);
+upng_error	upng_decode_into	(upng_t* upng, unsigned char* buffer, unsigned long pitch, upng_row_converter convert, void* user);
 
 upng_error	upng_get_error		(const upng_t* upng);
 unsigned	upng_get_error_line	(const upng_t* upng);
@@ -121,6 +121,15 @@ void vec3_normalize(vec3_t *v) {
   v->z /= length;
 }
 
+vec3_t vec3_lerp(vec3_t a, vec3_t b, float t) {
+  vec3_t result = {
+    .x = a.x + (b.x - a.x) * t,
+    .y = a.y + (b.y - a.y) * t,
+    .z = a.z + (b.z - a.z) * t,
+  };
+  return result;
+}
+
 void vec3_rotate_x(vec3_t *v, float angle) {
   float new_y = v->y * cos(angle) - v->z * sin(angle);
   float new_z = v->y * sin(angle) + v->z * cos(angle);
@@ -39,6 +39,8 @@ vec3_t vec3_cross(vec3_t v1, vec3_t v2);
 float vec3_length(vec3_t* v);
 void vec3_normalize(vec3_t* v);
 
+vec3_t vec3_lerp(vec3_t a, vec3_t b, float t);
+
 void vec3_rotate_x(vec3_t* v, float angle);
 void vec3_rotate_y(vec3_t* v, float angle);
 void vec3_rotate_z(vec3_t* v, float angle);
@@ -0,0 +1,166 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "array.h"
+#include "asset_loader.h"
+#include "asset_registry.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "texture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Load meshes on the worker threads: two meshes of the same files, a baked
+// one and one whose OBJ file is missing. Every mesh must end up published
+// with the state it loaded to, having gone through its states in order with
+// a callback for each, the first two sharing their assets, the baked one
+// streamed and the failed one holding nothing.
+///////////////////////////////////////////////////////////////////////////////
+#define PNG_PATH FIXTURE_DIR "/png/rgba8.png"
+#define OBJ_PATH FIXTURE_DIR "/obj/bad_indices.obj"
+#define BAKED_OBJ_PATH "asset_loader_test.obj"
+#define MISSING_OBJ_PATH "asset_loader_test_missing.obj"
+#define NUM_TEST_MESHES 4
+#define MAX_CALLBACKS 8
+
+static int num_failures = 0;
+
+#define CHECK(condition, ...) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      num_failures++; \
+    } \
+  } while (0)
+
+// The states passed to the callback of each mesh, in order
+typedef struct {
+  int mesh_index;
+  int states[MAX_CALLBACKS];
+  int num_states;
+  bool is_wrong_index;
+} callback_log_t;
+
+static void record_state(int mesh_index, int state, void* user_data) {
+  callback_log_t* log = (callback_log_t*)user_data;
+  if (mesh_index != log->mesh_index) {
+    log->is_wrong_index = true;
+  }
+  if (log->num_states < MAX_CALLBACKS) {
+    log->states[log->num_states] = state;
+  }
+  log->num_states++;
+}
+
+static bool write_square_obj(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+  fprintf(file, "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\nf 1 2 3\nf 2 4 3\n");
+  return fclose(file) == 0;
+}
+
+// Each callback moves the mesh to a later state, the last one it loaded to
+static void check_callbacks(const callback_log_t* log, int final_state) {
+  CHECK(!log->is_wrong_index, "mesh %d: a callback got another mesh", log->mesh_index);
+  CHECK(
+    log->num_states > 0 && log->num_states <= MAX_CALLBACKS && log->states[log->num_states - 1] == final_state,
+    "mesh %d: %d callbacks, not ending in state %d", log->mesh_index, log->num_states, final_state
+  );
+  for (int i = 1; i < log->num_states && i < MAX_CALLBACKS; i++) {
+    CHECK(
+      log->states[i] > log->states[i - 1],
+      "mesh %d: state %d after %d", log->mesh_index, log->states[i], log->states[i - 1]
+    );
+  }
+}
+
+int main(void) {
+  char cache_filepath[1024];
+  get_mesh_cache_filepath(BAKED_OBJ_PATH, cache_filepath, sizeof(cache_filepath));
+  if (!write_square_obj(BAKED_OBJ_PATH) || !bake_mesh(BAKED_OBJ_PATH, PNG_PATH, cache_filepath)) {
+    fprintf(stderr, "Error baking %s. \n", BAKED_OBJ_PATH);
+    return 1;
+  }
+  remove(MISSING_OBJ_PATH);
+
+  if (!init_asset_loader(2)) {
+    fprintf(stderr, "Error starting the asset loader. \n");
+    return 1;
+  }
+
+  const char* obj_filepaths[NUM_TEST_MESHES] = { OBJ_PATH, OBJ_PATH, BAKED_OBJ_PATH, MISSING_OBJ_PATH };
+  callback_log_t logs[NUM_TEST_MESHES];
+  int indices[NUM_TEST_MESHES];
+  vec3_t one = { 1, 1, 1 };
+  vec3_t zero = { 0, 0, 0 };
+  memset(logs, 0, sizeof(logs));
+
+  for (int i = 0; i < NUM_TEST_MESHES; i++) {
+    logs[i].mesh_index = get_num_meshes();
+    indices[i] = load_mesh_async(obj_filepaths[i], PNG_PATH, one, zero, zero, record_state, &logs[i]);
+    CHECK(indices[i] == logs[i].mesh_index, "mesh %d was added as %d", logs[i].mesh_index, indices[i]);
+  }
+  CHECK(get_mesh_load_state(MAX_NUM_MESHES - 1) == MESH_LOAD_DONE, "a mesh not loaded asynchronously is not done");
+
+  // Nothing is published before a poll, whatever the workers are up to
+  for (int i = 0; i < NUM_TEST_MESHES; i++) {
+    CHECK(get_mesh_load_state(indices[i]) == MESH_LOAD_PENDING, "mesh %d is published before a poll", indices[i]);
+  }
+
+  finish_asset_loading();
+  CHECK(!is_asset_loading(), "meshes are still loading");
+  CHECK(poll_asset_loader() == 0, "a mesh changed after the loading finished");
+
+  mesh_t* meshes[NUM_TEST_MESHES];
+  for (int i = 0; i < NUM_TEST_MESHES; i++) {
+    meshes[i] = get_mesh(indices[i]);
+  }
+
+  // The meshes of the same files share their geometry and texture
+  for (int i = 0; i < 2; i++) {
+    CHECK(get_mesh_load_state(indices[i]) == MESH_LOAD_DONE, "mesh %d: state %d", indices[i], get_mesh_load_state(indices[i]));
+    check_callbacks(&logs[i], MESH_LOAD_DONE);
+  }
+  CHECK(meshes[0]->faces != NULL && meshes[0]->texture != NULL, "mesh %d is not loaded", indices[0]);
+  CHECK(
+    meshes[0]->faces == meshes[1]->faces && meshes[0]->texture == meshes[1]->texture,
+    "meshes %d and %d do not share their assets", indices[0], indices[1]
+  );
+
+  // The baked mesh is loaded with its clusters and its stream opened
+  CHECK(get_mesh_load_state(indices[2]) == MESH_LOAD_DONE, "baked: state %d", get_mesh_load_state(indices[2]));
+  check_callbacks(&logs[2], MESH_LOAD_DONE);
+  CHECK(
+    meshes[2]->cache.data != NULL && meshes[2]->texture != NULL &&
+    meshes[2]->clusters != NULL && meshes[2]->cluster_states != NULL,
+    "baked: the mesh is not streamed from its cache"
+  );
+
+  // The failed mesh keeps nothing, not even the texture loaded for it
+  CHECK(get_mesh_load_state(indices[3]) == MESH_LOAD_FAILED, "missing: state %d", get_mesh_load_state(indices[3]));
+  check_callbacks(&logs[3], MESH_LOAD_FAILED);
+  CHECK(meshes[3]->faces == NULL && meshes[3]->texture == NULL, "missing: the mesh holds assets");
+
+  asset_registry_stats_t stats = get_asset_registry_stats();
+  CHECK(stats.used_assets == 3, "%d assets used instead of the OBJ, PNG and baked mesh", stats.used_assets);
+
+  destroy_asset_loader();
+  free_meshes();
+  stats = get_asset_registry_stats();
+  CHECK(stats.used_assets == 0, "%d assets still used after the meshes were freed", stats.used_assets);
+  destroy_asset_registry();
+  destroy_texture_loader();
+  remove(cache_filepath);
+  remove(BAKED_OBJ_PATH);
+
+  if (num_failures > 0) {
+    fprintf(stderr, "%d checks failed\n", num_failures);
+    return 1;
+  }
+  printf("All asset loader checks passed\n");
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "asset_registry.h"
+#include "mesh.h"
+#include "texture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Acquire the assets of a few meshes from the registry: the same files and a
+// byte-identical copy of a PNG under another name must be loaded once and
+// shared, releasing the meshes must drop every reference, and the assets no
+// mesh holds must stay cached until the budget goes below their size.
+///////////////////////////////////////////////////////////////////////////////
+#define PNG_PATH FIXTURE_DIR "/png/rgba8.png"
+#define OBJ_PATH FIXTURE_DIR "/obj/bad_indices.obj"
+#define COPY_PATH "asset_registry_test.png"
+
+static int num_failures = 0;
+
+#define CHECK(condition, ...) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      num_failures++; \
+    } \
+  } while (0)
+
+static bool copy_file(const char* from, const char* to) {
+  FILE* source = fopen(from, "rb");
+  if (source == NULL) {
+    return false;
+  }
+  FILE* target = fopen(to, "wb");
+  if (target == NULL) {
+    fclose(source);
+    return false;
+  }
+  char buffer[4096];
+  size_t size;
+  bool ok = true;
+  while ((size = fread(buffer, 1, sizeof(buffer), source)) > 0) {
+    ok = ok && fwrite(buffer, 1, size, target) == size;
+  }
+  fclose(source);
+  return fclose(target) == 0 && ok;
+}
+
+static void test_sharing(mesh_t* meshes) {
+  asset_registry_stats_t before = get_asset_registry_stats();
+
+  // The same PNG twice, and a copy of it under another name
+  bool is_acquired =
+    acquire_png_texture(PNG_PATH, NULL, &meshes[0]) &&
+    acquire_png_texture(PNG_PATH, NULL, &meshes[1]) &&
+    acquire_png_texture(COPY_PATH, NULL, &meshes[2]);
+  CHECK(is_acquired, "sharing: a texture was not acquired");
+  if (!is_acquired) {
+    return;
+  }
+
+  asset_registry_stats_t stats = get_asset_registry_stats();
+  CHECK(
+    meshes[0].texture_asset == meshes[1].texture_asset && meshes[0].texture == meshes[1].texture,
+    "sharing: the same path was loaded twice"
+  );
+  CHECK(
+    meshes[0].texture_asset == meshes[2].texture_asset && meshes[0].texture == meshes[2].texture,
+    "sharing: the copy was loaded again"
+  );
+  CHECK(stats.loaded - before.loaded == 1, "sharing: %d textures loaded", stats.loaded - before.loaded);
+  CHECK(stats.shared - before.shared == 2, "sharing: %d requests shared", stats.shared - before.shared);
+  CHECK(stats.num_assets == 1 && stats.used_assets == 1, "sharing: %d assets, %d used", stats.num_assets, stats.used_assets);
+  CHECK(
+    meshes[0].texture->levels[0].width == 37 && meshes[0].texture->levels[0].height == 23,
+    "sharing: the texture is %dx%d", meshes[0].texture->levels[0].width, meshes[0].texture->levels[0].height
+  );
+
+  // The geometry of an OBJ file twice
+  is_acquired = acquire_obj_mesh(OBJ_PATH, &meshes[0]) && acquire_obj_mesh(OBJ_PATH, &meshes[1]);
+  CHECK(is_acquired, "sharing: a mesh was not acquired");
+  if (is_acquired) {
+    CHECK(
+      meshes[0].geometry_asset == meshes[1].geometry_asset && meshes[0].faces == meshes[1].faces,
+      "sharing: the same OBJ file was loaded twice"
+    );
+    CHECK(array_length(meshes[0].faces) == 4, "sharing: %d faces", array_length(meshes[0].faces));
+  }
+}
+
+static void test_release(mesh_t* meshes, int num_meshes) {
+  for (int i = 0; i < num_meshes; i++) {
+    release_mesh_assets(&meshes[i]);
+    CHECK(
+      meshes[i].texture == NULL && meshes[i].texture_asset == NULL &&
+      meshes[i].faces == NULL && meshes[i].geometry_asset == NULL,
+      "release: mesh %d still points at its assets", i
+    );
+  }
+
+  asset_registry_stats_t stats = get_asset_registry_stats();
+  CHECK(stats.used_assets == 0, "release: %d assets still used", stats.used_assets);
+  CHECK(stats.num_assets == 2, "release: %d assets cached", stats.num_assets);
+  CHECK(stats.evicted == 0, "release: %d assets evicted", stats.evicted);
+}
+
+static void test_eviction(void) {
+  asset_registry_stats_t before = get_asset_registry_stats();
+
+  // One byte short of the cache drops only the least recently released asset
+  set_asset_cache_budget(before.total_bytes - 1);
+  asset_registry_stats_t stats = get_asset_registry_stats();
+  CHECK(stats.evicted == 1, "eviction: %d assets evicted", stats.evicted);
+  CHECK(stats.num_assets == 1, "eviction: %d assets cached", stats.num_assets);
+  CHECK(stats.total_bytes < before.total_bytes, "eviction: %zu bytes cached", stats.total_bytes);
+
+  set_asset_cache_budget(0);
+  stats = get_asset_registry_stats();
+  CHECK(stats.evicted == 2, "eviction: %d assets evicted", stats.evicted);
+  CHECK(stats.num_assets == 0 && stats.total_bytes == 0, "eviction: %d assets cached", stats.num_assets);
+
+  // Nothing is cached any more, so the texture is loaded again
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+  set_asset_cache_budget(before.budget_bytes);
+  if (acquire_png_texture(PNG_PATH, NULL, &mesh)) {
+    stats = get_asset_registry_stats();
+    CHECK(stats.loaded - before.loaded == 1, "eviction: the texture was not loaded again");
+    release_mesh_assets(&mesh);
+  } else {
+    CHECK(false, "eviction: the texture was not acquired");
+  }
+}
+
+int main(void) {
+  if (!copy_file(PNG_PATH, COPY_PATH)) {
+    fprintf(stderr, "Error copying %s. \n", PNG_PATH);
+    return 1;
+  }
+
+  mesh_t meshes[3];
+  memset(meshes, 0, sizeof(meshes));
+  test_sharing(meshes);
+  test_release(meshes, 3);
+  test_eviction();
+
+  destroy_asset_registry();
+  destroy_texture_loader();
+  remove(COPY_PATH);
+
+  if (num_failures > 0) {
+    fprintf(stderr, "%d checks failed\n", num_failures);
+    return 1;
+  }
+  printf("All asset registry checks passed\n");
+  return 0;
+}
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Write the PNG fixtures of png_decoder_test.c.
+
+Every image holds the samples of sample_value() below, which the test
+computes again to check the decoded pixels. Row y is filtered with filter
+type y % 5, so every image goes through all five filters, and the rows are
+compressed with zlib to exercise the dynamic, fixed and stored blocks of
+inflate.
+"""
+import os
+import struct
+import zlib
+
+WIDTH = 37
+HEIGHT = 23
+
+# name, PNG color type, bit depth, zlib level
+FIXTURES = [
+    ("gray1", 0, 1, 9),
+    ("gray2", 0, 2, 9),
+    ("gray4", 0, 4, 9),
+    ("gray8", 0, 8, 9),
+    ("gray_alpha8", 4, 8, 9),
+    ("rgb8", 2, 8, 9),
+    ("rgb16", 2, 16, 9),
+    ("rgba8", 6, 8, 9),
+    ("rgba16", 6, 16, 9),
+    ("rgba8_stored", 6, 8, 0),
+]
+
+COMPONENTS = {0: 1, 2: 3, 4: 2, 6: 4}
+
+
+def sample_value(x, y, c, depth):
+    """Must match sample_value in png_decoder_test.c.
+
+    The left columns are two gradients, where the Paeth predictor has ties
+    to break between a and b, then between b and c, the others are noise.
+    """
+    if x < 12:
+        if x < 6:
+            v = (x * 7 + y * 7 + c * 20) % 256
+        else:
+            v = (200 - x * 10 + y * 5 + c * 20) % 256
+        return v << 8 | v if depth == 16 else v >> (8 - depth)
+    v = (x * 37 + y * 91 + c * 53 + x * y * 7) * 2654435761
+    return (v >> 7) & ((1 << depth) - 1)
+
+
+def raw_row(y, components, depth):
+    if depth == 16:
+        out = bytearray()
+        for x in range(WIDTH):
+            for c in range(components):
+                out += struct.pack(">H", sample_value(x, y, c, 16))
+        return bytes(out)
+    bits = []
+    for x in range(WIDTH):
+        for c in range(components):
+            v = sample_value(x, y, c, depth)
+            bits += [(v >> (depth - 1 - i)) & 1 for i in range(depth)]
+    bits += [0] * (-len(bits) % 8)
+    return bytes(
+        sum(bits[i + j] << (7 - j) for j in range(8)) for i in range(0, len(bits), 8)
+    )
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def filter_row(kind, row, prior, bpp):
+    out = bytearray([kind])
+    for i, value in enumerate(row):
+        a = row[i - bpp] if i >= bpp else 0
+        b = prior[i]
+        c = prior[i - bpp] if i >= bpp else 0
+        predictor = [0, a, b, (a + b) // 2, paeth(a, b, c)][kind]
+        out.append((value - predictor) & 255)
+    return bytes(out)
+
+
+def chunk(kind, data):
+    body = kind + data
+    return struct.pack(">I", len(data)) + body + struct.pack(">I", zlib.crc32(body))
+
+
+def write_fixture(directory, name, color_type, depth, level):
+    components = COMPONENTS[color_type]
+    bpp = max(1, components * depth // 8)
+    prior = bytes(len(raw_row(0, components, depth)))
+    data = bytearray()
+    for y in range(HEIGHT):
+        row = raw_row(y, components, depth)
+        data += filter_row(y % 5, row, prior, bpp)
+        prior = row
+
+    header = struct.pack(">IIBBBBB", WIDTH, HEIGHT, depth, color_type, 0, 0, 0)
+    png = b"\x89PNG\r\n\x1a\n"
+    png += chunk(b"IHDR", header)
+    png += chunk(b"IDAT", zlib.compress(bytes(data), level))
+    png += chunk(b"IEND", b"")
+    with open(os.path.join(directory, name + ".png"), "wb") as file:
+        file.write(png)
+
+
+if __name__ == "__main__":
+    directory = os.path.dirname(os.path.abspath(__file__))
+    for fixture in FIXTURES:
+        write_fixture(directory, *fixture)
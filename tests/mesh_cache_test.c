@@ -0,0 +1,285 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "file_map.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_stream.h"
+#include "texture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Bake a generated grid mesh with a fixture texture and load it back, then
+// damage copies of the baked file in the ways load_baked_mesh must catch:
+// cut short, a checksum byte flipped, cluster ranges that do not add up
+// (with checksums that do), and sources changed since the bake. The grid
+// has enough faces for three clusters.
+///////////////////////////////////////////////////////////////////////////////
+#define GRID_WIDTH 65
+#define GRID_HEIGHT 81
+#define OBJ_PATH "mesh_cache_test.obj"
+#define CACHE_PATH "mesh_cache_test.t3d"
+#define DAMAGED_PATH "mesh_cache_test_damaged.t3d"
+#define PNG_PATH FIXTURE_DIR "/png/rgba8.png"
+
+static int num_failures = 0;
+
+#define CHECK(condition, ...) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      num_failures++; \
+    } \
+  } while (0)
+
+// A grid of quads in the xy plane, each split into two triangles, with
+// texture coordinates across the whole grid
+static bool write_grid_obj(const char* path, const char* comment) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+  fprintf(file, "# %s\n", comment);
+  for (int y = 0; y < GRID_HEIGHT; y++) {
+    for (int x = 0; x < GRID_WIDTH; x++) {
+      fprintf(file, "v %d %d %d\n", x, y, (x * y) % 3);
+      fprintf(file, "vt %g %g\n", x / (GRID_WIDTH - 1.0), y / (GRID_HEIGHT - 1.0));
+    }
+  }
+  for (int y = 0; y + 1 < GRID_HEIGHT; y++) {
+    for (int x = 0; x + 1 < GRID_WIDTH; x++) {
+      int a = y * GRID_WIDTH + x + 1;
+      int b = a + 1;
+      int c = a + GRID_WIDTH;
+      int d = c + 1;
+      fprintf(file, "f %d/%d %d/%d %d/%d\n", a, a, b, b, c, c);
+      fprintf(file, "f %d/%d %d/%d %d/%d\n", b, b, d, d, c, c);
+    }
+  }
+  return fclose(file) == 0;
+}
+
+static unsigned char* read_file(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  *size = (size_t)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  unsigned char* data = (unsigned char*)malloc(*size);
+  if (data != NULL && fread(data, 1, *size, file) != *size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+static bool write_file(const char* path, const unsigned char* data, size_t size) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    return false;
+  }
+  bool ok = fwrite(data, 1, size, file) == size;
+  return fclose(file) == 0 && ok;
+}
+
+// FNV-1a of the corners of a face, summed over the faces, so the faces can
+// be in any order and use any copies of their vertices
+static uint64_t get_faces_hash(const mesh_t* mesh) {
+  uint64_t sum = 0;
+  for (int i = 0; i < array_length(mesh->faces); i++) {
+    const face_t* face = &mesh->faces[i];
+    float corners[15] = {
+      mesh->vertices[face->a].x, mesh->vertices[face->a].y, mesh->vertices[face->a].z,
+      mesh->vertices[face->b].x, mesh->vertices[face->b].y, mesh->vertices[face->b].z,
+      mesh->vertices[face->c].x, mesh->vertices[face->c].y, mesh->vertices[face->c].z,
+      face->a_uv.u, face->a_uv.v, face->b_uv.u, face->b_uv.v, face->c_uv.u, face->c_uv.v
+    };
+    const unsigned char* bytes = (const unsigned char*)corners;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t j = 0; j < sizeof(corners); j++) {
+      hash = (hash ^ bytes[j]) * 0x100000001B3ULL;
+    }
+    sum += hash;
+  }
+  return sum;
+}
+
+// Load the damaged copy, which must be rejected and leave the mesh alone
+static void check_rejected(const char* what, const unsigned char* data, size_t size) {
+  if (!write_file(DAMAGED_PATH, data, size)) {
+    CHECK(false, "%s: could not write %s", what, DAMAGED_PATH);
+    return;
+  }
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+  bool is_loaded = load_baked_mesh(DAMAGED_PATH, OBJ_PATH, PNG_PATH, &mesh);
+  CHECK(!is_loaded, "%s: the file was loaded", what);
+  CHECK(mesh.faces == NULL && mesh.cache.data == NULL, "%s: the mesh was changed", what);
+  if (is_loaded) {
+    free_mesh(&mesh);
+  }
+  remove(DAMAGED_PATH);
+}
+
+static void test_round_trip(void) {
+  mesh_t source;
+  memset(&source, 0, sizeof(source));
+  load_mesh_obj_data(OBJ_PATH, &source);
+  compute_mesh_normals_and_bounds(&source);
+  texture_t* texture = load_png_texture(PNG_PATH);
+
+  mesh_t baked;
+  memset(&baked, 0, sizeof(baked));
+  bool is_loaded = load_baked_mesh(CACHE_PATH, OBJ_PATH, PNG_PATH, &baked);
+  CHECK(is_loaded, "round trip: the baked mesh was not loaded");
+
+  if (is_loaded && texture != NULL) {
+    int num_faces = array_length(baked.faces);
+    CHECK(num_faces == array_length(source.faces), "round trip: %d faces", num_faces);
+    CHECK(array_length(baked.normals) == num_faces, "round trip: %d normals", array_length(baked.normals));
+    CHECK(array_length(baked.clusters) == 3, "round trip: %d clusters", array_length(baked.clusters));
+    CHECK(get_faces_hash(&baked) == get_faces_hash(&source), "round trip: the faces differ");
+    CHECK(
+      memcmp(&baked.bounds_min, &source.bounds_min, sizeof(vec3_t)) == 0 &&
+      memcmp(&baked.bounds_max, &source.bounds_max, sizeof(vec3_t)) == 0,
+      "round trip: the bounds differ"
+    );
+    for (int i = 0; i < array_length(baked.clusters); i++) {
+      CHECK(is_baked_cluster_valid(&baked, i), "round trip: cluster %d uses vertices of another", i);
+    }
+
+    CHECK(
+      baked.texture->num_levels == texture->num_levels &&
+      get_texture_pixel_count(baked.texture) == get_texture_pixel_count(texture) &&
+      memcmp(
+        baked.texture->levels[0].pixels, texture->levels[0].pixels,
+        get_texture_pixel_count(texture) * sizeof(uint32_t)
+      ) == 0,
+      "round trip: the texture differs"
+    );
+  }
+
+  if (is_loaded) {
+    free_mesh(&baked);
+  }
+  free_texture(texture);
+  array_free(source.faces);
+  array_free(source.vertices);
+  array_free(source.normals);
+}
+
+static void test_damaged_files(const unsigned char* data, size_t size) {
+  unsigned char* copy = (unsigned char*)malloc(size);
+  mesh_cache_header_t header;
+  memcpy(&header, data, sizeof(header));
+
+  // Cut short, by a little and down to the header
+  check_rejected("truncated", data, size - 100);
+  check_rejected("truncated to the header", data, sizeof(header));
+
+  // A flipped byte of either checksum, or of the geometry it covers
+  memcpy(copy, data, size);
+  copy[offsetof(mesh_cache_header_t, checksum)] ^= 0x40;
+  check_rejected("flipped checksum", copy, size);
+
+  memcpy(copy, data, size);
+  copy[offsetof(mesh_cache_header_t, geometry_checksum) + 3] ^= 0x01;
+  check_rejected("flipped geometry checksum", copy, size);
+
+  memcpy(copy, data, size);
+  copy[header.faces_offset + 2 * sizeof(int) + 5] ^= 0x10;
+  check_rejected("flipped face byte", copy, size);
+
+  // Cluster ranges that do not cover the mesh, with the checksum of the
+  // sections before the geometry made to match so only the ranges are wrong.
+  // The geometry is streamed, so the faces of the clusters are not checked
+  // at load and only the cluster table can reject the file
+  size_t budget = get_mesh_memory_budget();
+  set_mesh_memory_budget(1);
+  mesh_cluster_t* clusters = (mesh_cluster_t*)&copy[header.clusters_offset + 2 * sizeof(int)];
+  size_t checked_size = header.vertices_offset - sizeof(header);
+  mesh_cache_header_t* copy_header = (mesh_cache_header_t*)copy;
+
+  memcpy(copy, data, size);
+  clusters[1].num_faces++;
+  copy_header->checksum = get_data_checksum(&copy[sizeof(header)], checked_size);
+  check_rejected("cluster past the faces", copy, size);
+
+  memcpy(copy, data, size);
+  clusters[2].first_vertex--;
+  copy_header->checksum = get_data_checksum(&copy[sizeof(header)], checked_size);
+  check_rejected("overlapping clusters", copy, size);
+
+  memcpy(copy, data, size);
+  clusters[0].num_vertices = -1;
+  copy_header->checksum = get_data_checksum(&copy[sizeof(header)], checked_size);
+  check_rejected("negative cluster", copy, size);
+
+  // Counts whose 32 bit sum wraps back around to the number of faces
+  memcpy(copy, data, size);
+  clusters[0].num_faces = INT_MAX;
+  clusters[1].first_face = INT_MAX;
+  clusters[1].num_faces = INT_MAX;
+  clusters[2].first_face = (int)(2u * (unsigned)INT_MAX);
+  clusters[2].num_faces = (int)((unsigned)header.num_faces - 2u * (unsigned)INT_MAX);
+  copy_header->checksum = get_data_checksum(&copy[sizeof(header)], checked_size);
+  check_rejected("cluster sizes that overflow", copy, size);
+
+  set_mesh_memory_budget(budget);
+  free(copy);
+}
+
+// A source changed since the bake makes the baked file stale
+static void test_stale_source(void) {
+  if (!write_grid_obj(OBJ_PATH, "changed since the bake")) {
+    CHECK(false, "could not rewrite %s", OBJ_PATH);
+    return;
+  }
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+  bool is_loaded = load_baked_mesh(CACHE_PATH, OBJ_PATH, PNG_PATH, &mesh);
+  CHECK(!is_loaded, "stale: the file was loaded");
+  if (is_loaded) {
+    free_mesh(&mesh);
+  }
+}
+
+int main(void) {
+  if (!write_grid_obj(OBJ_PATH, "grid") || !bake_mesh(OBJ_PATH, PNG_PATH, CACHE_PATH)) {
+    fprintf(stderr, "Error baking %s. \n", OBJ_PATH);
+    return 1;
+  }
+
+  size_t size = 0;
+  unsigned char* data = read_file(CACHE_PATH, &size);
+  if (data == NULL) {
+    fprintf(stderr, "Error reading %s. \n", CACHE_PATH);
+    return 1;
+  }
+
+  test_round_trip();
+  test_damaged_files(data, size);
+  test_stale_source();
+
+  free(data);
+  remove(CACHE_PATH);
+  remove(OBJ_PATH);
+  destroy_texture_loader();
+
+  if (num_failures > 0) {
+    fprintf(stderr, "%d checks failed\n", num_failures);
+    return 1;
+  }
+  printf("All mesh cache checks passed\n");
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "asset_registry.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_stream.h"
+#include "texture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Stream a baked grid of three clusters shared by two meshes under a budget
+// of two clusters: the meshes must share one stream, clusters in view must
+// stay resident even over the budget, the others must be dropped the least
+// recently used and farthest first, and a cluster with a face outside its
+// vertices must be skipped. The baked file is patched after the bake, which
+// a streamed mesh only finds out when the cluster is paged in.
+///////////////////////////////////////////////////////////////////////////////
+#define GRID_WIDTH 65
+#define GRID_HEIGHT 81
+#define OBJ_PATH "mesh_stream_test.obj"
+#define PNG_PATH FIXTURE_DIR "/png/rgba8.png"
+
+static int num_failures = 0;
+
+#define CHECK(condition, ...) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      num_failures++; \
+    } \
+  } while (0)
+
+// A grid of quads in the xy plane, each split into two triangles
+static bool write_grid_obj(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+  for (int y = 0; y < GRID_HEIGHT; y++) {
+    for (int x = 0; x < GRID_WIDTH; x++) {
+      fprintf(file, "v %d %d 0\n", x, y);
+    }
+  }
+  for (int y = 0; y + 1 < GRID_HEIGHT; y++) {
+    for (int x = 0; x + 1 < GRID_WIDTH; x++) {
+      int a = y * GRID_WIDTH + x + 1;
+      fprintf(file, "f %d %d %d\n", a, a + 1, a + GRID_WIDTH);
+      fprintf(file, "f %d %d %d\n", a + 1, a + GRID_WIDTH + 1, a + GRID_WIDTH);
+    }
+  }
+  return fclose(file) == 0;
+}
+
+// Point the first face of the last cluster at the first vertex of the mesh,
+// which belongs to the first cluster
+static bool corrupt_last_cluster(const char* cache_filepath) {
+  FILE* file = fopen(cache_filepath, "r+b");
+  if (file == NULL) {
+    return false;
+  }
+  mesh_cache_header_t header;
+  mesh_cluster_t cluster;
+  int vertex = 0;
+  bool ok =
+    fread(&header, sizeof(header), 1, file) == 1 &&
+    fseek(file, (long)(header.clusters_offset + sizeof(int) * 2 + (header.num_clusters - 1) * sizeof(mesh_cluster_t)), SEEK_SET) == 0 &&
+    fread(&cluster, sizeof(cluster), 1, file) == 1 &&
+    fseek(file, (long)(header.faces_offset + sizeof(int) * 2 + cluster.first_face * sizeof(face_t) + offsetof(face_t, a)), SEEK_SET) == 0 &&
+    fwrite(&vertex, sizeof(vertex), 1, file) == 1;
+  return fclose(file) == 0 && ok;
+}
+
+static size_t get_cluster_size(const mesh_t* mesh, int index) {
+  const mesh_cluster_t* cluster = &mesh->clusters[index];
+  return
+    (size_t)cluster->num_faces * (sizeof(face_t) + sizeof(vec3_t)) +
+    (size_t)cluster->num_vertices * sizeof(vec3_t);
+}
+
+static void test_streaming(mesh_t* meshes) {
+  // Every cluster in view of the frame is kept, over the budget or not
+  begin_mesh_stream_frame();
+  CHECK(use_mesh_cluster(&meshes[0], 0, 10), "frame 1: cluster 0 was skipped");
+  CHECK(use_mesh_cluster(&meshes[1], 1, 5), "frame 1: cluster 1 was skipped");
+  trim_mesh_streams();
+
+  mesh_stream_stats_t stats = get_mesh_stream_stats();
+  CHECK(stats.paged_in == 2, "frame 1: %d clusters paged in", stats.paged_in);
+  CHECK(stats.resident_clusters == 2, "frame 1: %d clusters resident", stats.resident_clusters);
+  CHECK(stats.resident_bytes > stats.budget_bytes, "frame 1: the clusters in view fit the budget");
+  CHECK(stats.evicted == 0, "frame 1: %d clusters evicted", stats.evicted);
+
+  // The corrupt cluster is paged in and skipped, and of the two clusters
+  // last used in the same frame the farther one is dropped
+  begin_mesh_stream_frame();
+  CHECK(!use_mesh_cluster(&meshes[0], 2, 20), "frame 2: the corrupt cluster was used");
+  trim_mesh_streams();
+
+  stats = get_mesh_stream_stats();
+  const mesh_cluster_state_t* states = meshes[0].cluster_states;
+  CHECK(stats.paged_in == 3, "frame 2: %d clusters paged in", stats.paged_in);
+  CHECK(stats.evicted == 1, "frame 2: %d clusters evicted", stats.evicted);
+  CHECK(
+    !states[0].is_resident && states[1].is_resident && states[2].is_resident,
+    "frame 2: clusters 0, 1 and 2 are %sresident, %sresident and %sresident",
+    states[0].is_resident ? "" : "not ", states[1].is_resident ? "" : "not ", states[2].is_resident ? "" : "not "
+  );
+  CHECK(stats.resident_bytes <= stats.budget_bytes, "frame 2: %zu bytes resident", stats.resident_bytes);
+
+  // A resident cluster is not paged in again, nor checked again, and the
+  // dropped one comes back while the one not in view goes
+  begin_mesh_stream_frame();
+  CHECK(!use_mesh_cluster(&meshes[1], 2, 20), "frame 3: the corrupt cluster was used");
+  CHECK(use_mesh_cluster(&meshes[1], 0, 1), "frame 3: cluster 0 was skipped");
+  trim_mesh_streams();
+
+  stats = get_mesh_stream_stats();
+  CHECK(stats.paged_in == 4, "frame 3: %d clusters paged in", stats.paged_in);
+  CHECK(stats.evicted == 2, "frame 3: %d clusters evicted", stats.evicted);
+  CHECK(
+    states[0].is_resident && !states[1].is_resident && states[2].is_resident,
+    "frame 3: cluster 1 was not the one dropped"
+  );
+}
+
+int main(void) {
+  char cache_filepath[1024];
+  get_mesh_cache_filepath(OBJ_PATH, cache_filepath, sizeof(cache_filepath));
+  if (!write_grid_obj(OBJ_PATH) || !bake_mesh(OBJ_PATH, PNG_PATH, cache_filepath) || !corrupt_last_cluster(cache_filepath)) {
+    fprintf(stderr, "Error baking %s. \n", OBJ_PATH);
+    return 1;
+  }
+
+  // Too large for the budget, so both meshes stream their geometry
+  set_mesh_memory_budget(1);
+  mesh_t meshes[2];
+  memset(meshes, 0, sizeof(meshes));
+  bool is_opened = true;
+  for (int i = 0; i < 2; i++) {
+    is_opened = is_opened && acquire_baked_mesh(OBJ_PATH, PNG_PATH, &meshes[i]) && open_mesh_stream(&meshes[i]);
+  }
+  CHECK(is_opened, "the baked mesh was not streamed");
+
+  if (is_opened) {
+    mesh_stream_stats_t stats = get_mesh_stream_stats();
+    CHECK(array_length(meshes[0].clusters) == 3, "%d clusters", array_length(meshes[0].clusters));
+    CHECK(meshes[0].cluster_states == meshes[1].cluster_states, "the meshes do not share a stream");
+    CHECK(stats.streamed_meshes == 1, "%d meshes streamed", stats.streamed_meshes);
+    CHECK(stats.total_clusters == 3, "%d clusters streamed", stats.total_clusters);
+    CHECK(stats.resident_clusters == 0, "%d clusters resident", stats.resident_clusters);
+
+    if (array_length(meshes[0].clusters) == 3) {
+      set_mesh_memory_budget(get_cluster_size(&meshes[0], 1) + get_cluster_size(&meshes[0], 2));
+      test_streaming(meshes);
+    }
+
+    // The stream goes with the last mesh on the mapping
+    close_mesh_stream(&meshes[0]);
+    stats = get_mesh_stream_stats();
+    CHECK(stats.total_clusters == 3, "close: the stream was dropped while in use");
+    close_mesh_stream(&meshes[1]);
+    stats = get_mesh_stream_stats();
+    CHECK(
+      stats.streamed_meshes == 0 && stats.total_clusters == 0 &&
+      stats.resident_clusters == 0 && stats.resident_bytes == 0,
+      "close: %d clusters and %zu bytes left", stats.total_clusters, stats.resident_bytes
+    );
+  }
+
+  for (int i = 0; i < 2; i++) {
+    release_mesh_assets(&meshes[i]);
+  }
+  destroy_asset_registry();
+  destroy_texture_loader();
+  remove(cache_filepath);
+  remove(OBJ_PATH);
+
+  if (num_failures > 0) {
+    fprintf(stderr, "%d checks failed\n", num_failures);
+    return 1;
+  }
+  printf("All mesh stream checks passed\n");
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "array.h"
+#include "mesh.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Load OBJ files with faces whose vertex indices are out of range, which the
+// loader must skip while keeping every other face and its texture
+// coordinates. The fixture is small enough to be parsed on one thread; the
+// generated file is large enough to be split into chunks on a machine with
+// more than one core.
+///////////////////////////////////////////////////////////////////////////////
+#define NUM_GENERATED_BLOCKS 40000
+#define GENERATED_PATH "obj_parser_test.obj"
+
+static int num_failures = 0;
+
+#define CHECK(condition, ...) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      num_failures++; \
+    } \
+  } while (0)
+
+static bool is_face(const face_t* face, int a, int b, int c) {
+  return face->a == a && face->b == b && face->c == c;
+}
+
+static bool is_uv(tex2_t uv, float u, float v) {
+  return uv.u == u && uv.v == v;
+}
+
+static void free_test_mesh(mesh_t* mesh) {
+  array_free(mesh->faces);
+  array_free(mesh->vertices);
+}
+
+// fixtures/obj/bad_indices.obj keeps four of its eight faces, one of those
+// dropped has an index that wraps to 3 in 32 bits
+static void test_fixture(void) {
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+  load_mesh_obj_data(FIXTURE_DIR "/obj/bad_indices.obj", &mesh);
+
+  CHECK(array_length(mesh.vertices) == 5, "fixture: %d vertices", array_length(mesh.vertices));
+  CHECK(array_length(mesh.faces) == 4, "fixture: %d faces", array_length(mesh.faces));
+  if (array_length(mesh.faces) == 4) {
+    CHECK(is_face(&mesh.faces[0], 0, 1, 2), "fixture: face 0 is wrong");
+    CHECK(
+      is_uv(mesh.faces[0].a_uv, 0, 0) && is_uv(mesh.faces[0].b_uv, 1, 0) && is_uv(mesh.faces[0].c_uv, 0, 1),
+      "fixture: texture coordinates of face 0 are wrong"
+    );
+    CHECK(is_face(&mesh.faces[1], 1, 3, 2), "fixture: face 1 is wrong");
+    CHECK(is_face(&mesh.faces[2], 0, 1, 3), "fixture: face 2 is wrong");
+    CHECK(
+      is_uv(mesh.faces[2].a_uv, 0, 0) && is_uv(mesh.faces[2].b_uv, 1, 0) && is_uv(mesh.faces[2].c_uv, 0, 1),
+      "fixture: texture coordinates of face 2 are wrong"
+    );
+    CHECK(is_face(&mesh.faces[3], 4, 3, 1), "fixture: face 3 is wrong");
+  }
+  free_test_mesh(&mesh);
+}
+
+// Every block of the generated file has four vertices, two faces relative
+// to them and two faces out of range
+static bool write_generated_file(void) {
+  FILE* file = fopen(GENERATED_PATH, "w");
+  if (file == NULL) {
+    return false;
+  }
+  for (int i = 0; i < NUM_GENERATED_BLOCKS; i++) {
+    fprintf(file, "v %d 0 0\nv %d 1 0\nv %d 0 1\nv %d 1 1\n", i, i, i, i);
+    fprintf(file, "f -4 -3 -2\nf 0 5 99\nf -1 -2 -3\nf 1 2 %d\n", NUM_GENERATED_BLOCKS * 4 + 1);
+  }
+  return fclose(file) == 0;
+}
+
+static void test_generated_file(void) {
+  if (!write_generated_file()) {
+    CHECK(false, "could not write %s", GENERATED_PATH);
+    return;
+  }
+
+  mesh_t mesh;
+  memset(&mesh, 0, sizeof(mesh));
+  load_mesh_obj_data(GENERATED_PATH, &mesh);
+  remove(GENERATED_PATH);
+
+  int num_faces = array_length(mesh.faces);
+  CHECK(array_length(mesh.vertices) == NUM_GENERATED_BLOCKS * 4, "generated: %d vertices", array_length(mesh.vertices));
+  CHECK(num_faces == NUM_GENERATED_BLOCKS * 2, "generated: %d faces", num_faces);
+
+  int mismatches = 0;
+  for (int i = 0; i < num_faces && num_faces == NUM_GENERATED_BLOCKS * 2; i++) {
+    int first = (i / 2) * 4;
+    mismatches += i % 2 == 0 ?
+      !is_face(&mesh.faces[i], first, first + 1, first + 2) :
+      !is_face(&mesh.faces[i], first + 3, first + 2, first + 1);
+  }
+  CHECK(mismatches == 0, "generated: %d faces are wrong", mismatches);
+  free_test_mesh(&mesh);
+}
+
+int main(void) {
+  test_fixture();
+  test_generated_file();
+
+  if (num_failures > 0) {
+    fprintf(stderr, "%d checks failed\n", num_failures);
+    return 1;
+  }
+  printf("All OBJ parser checks passed\n");
+  return 0;
+}
@@ -0,0 +1,265 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_map.h"
+#include "texture.h"
+#include "upng.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode the PNG fixtures written by fixtures/png/make_fixtures.py, which
+// cover the five filter types, the sub-byte gray depths, 16 bit samples and
+// stored, fixed and dynamic deflate blocks, and check every sample against
+// the formula they were written from. The rows upng_decode_into hands over,
+// the packed image of upng_decode, the texels load_png_texture converts them
+// to, and the allocations of a reused decoder are all checked.
+///////////////////////////////////////////////////////////////////////////////
+#define FIXTURE_WIDTH 37
+#define FIXTURE_HEIGHT 23
+
+typedef struct {
+  const char* name;
+  upng_format format;
+  int components;
+  int depth;
+} fixture_t;
+
+static const fixture_t fixtures[] = {
+  { "gray1", UPNG_LUMINANCE1, 1, 1 },
+  { "gray2", UPNG_LUMINANCE2, 1, 2 },
+  { "gray4", UPNG_LUMINANCE4, 1, 4 },
+  { "gray8", UPNG_LUMINANCE8, 1, 8 },
+  { "gray_alpha8", UPNG_LUMINANCE_ALPHA8, 2, 8 },
+  { "rgb8", UPNG_RGB8, 3, 8 },
+  { "rgb16", UPNG_RGB16, 3, 16 },
+  { "rgba8", UPNG_RGBA8, 4, 8 },
+  { "rgba16", UPNG_RGBA16, 4, 16 },
+  { "rgba8_stored", UPNG_RGBA8, 4, 8 }
+};
+
+#define NUM_FIXTURES ((int)(sizeof(fixtures) / sizeof(fixtures[0])))
+
+static int num_failures = 0;
+
+#define CHECK(condition, ...) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      num_failures++; \
+    } \
+  } while (0)
+
+// Must match sample_value in make_fixtures.py: two gradients, where the
+// Paeth predictor has ties to break, then noise
+static uint32_t sample_value(int x, int y, int c, int depth) {
+  if (x < 12) {
+    int value = x < 6 ? x * 7 + y * 7 + c * 20 : 200 - x * 10 + y * 5 + c * 20;
+    uint32_t gradient = (uint32_t)(((value % 256) + 256) % 256);
+    return depth == 16 ? (gradient << 8) | gradient : gradient >> (8 - depth);
+  }
+  uint64_t v = (uint64_t)(x * 37 + y * 91 + c * 53 + x * y * 7) * 2654435761u;
+  return (uint32_t)((v >> 7) & ((1u << depth) - 1));
+}
+
+static int get_row_size(const fixture_t* fixture) {
+  return (FIXTURE_WIDTH * fixture->components * fixture->depth + 7) / 8;
+}
+
+// Row y as it is stored in the PNG: samples big endian, sub-byte samples
+// packed from the high bits, and the last byte padded with zeros
+static void write_expected_row(const fixture_t* fixture, int y, unsigned char* row) {
+  memset(row, 0, get_row_size(fixture));
+  int bit = 0;
+  for (int x = 0; x < FIXTURE_WIDTH; x++) {
+    for (int c = 0; c < fixture->components; c++) {
+      uint32_t value = sample_value(x, y, c, fixture->depth);
+      for (int i = fixture->depth - 1; i >= 0; i--, bit++) {
+        row[bit >> 3] |= ((value >> i) & 1) << (7 - (bit & 7));
+      }
+    }
+  }
+}
+
+// The texel load_png_texture makes of a pixel: 8 bit channels, sub-byte
+// gray scaled up to 255, 16 bit samples cut to their high byte
+static uint32_t get_expected_texel(const fixture_t* fixture, int x, int y) {
+  uint32_t channels[4] = { 0 };
+  for (int c = 0; c < fixture->components; c++) {
+    uint32_t value = sample_value(x, y, c, fixture->depth);
+    if (fixture->depth == 16) {
+      value >>= 8;
+    } else if (fixture->depth < 8) {
+      value = value * 255 / ((1u << fixture->depth) - 1);
+    }
+    channels[c] = value;
+  }
+
+  uint32_t r = channels[0];
+  uint32_t g = fixture->components >= 3 ? channels[1] : r;
+  uint32_t b = fixture->components >= 3 ? channels[2] : r;
+  uint32_t a = fixture->components == 2 || fixture->components == 4 ? channels[fixture->components - 1] : 255;
+  return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static const uint32_t* get_texel(const mipmap_t* level, int x, int y) {
+  int row = ((y >> TEXTURE_TILE_SIZE_LOG2) * level->pitch) + ((y & (TEXTURE_TILE_SIZE - 1)) << TEXTURE_TILE_SIZE_LOG2);
+  int column = ((x >> TEXTURE_TILE_SIZE_LOG2) << (TEXTURE_TILE_SIZE_LOG2 * 2)) + (x & (TEXTURE_TILE_SIZE - 1));
+  return &level->pixels[row + column];
+}
+
+static void get_fixture_path(const fixture_t* fixture, char* path, size_t size) {
+  snprintf(path, size, "%s/png/%s.png", FIXTURE_DIR, fixture->name);
+}
+
+// upng_decode_into stores the rows as they are in the PNG without a converter
+static void test_decode_into(upng_t* decoder, const fixture_t* fixture, const file_map_t* file) {
+  int row_size = get_row_size(fixture);
+  unsigned char* image = (unsigned char*)malloc((size_t)row_size * FIXTURE_HEIGHT);
+  unsigned char* expected = (unsigned char*)malloc(row_size);
+
+  upng_set_source(decoder, file->data, file->size);
+  upng_error error = upng_decode_into(decoder, image, row_size, NULL, NULL);
+  CHECK(error == UPNG_EOK, "%s: upng_decode_into failed with error %d", fixture->name, error);
+  CHECK(upng_get_format(decoder) == fixture->format, "%s: format %d", fixture->name, upng_get_format(decoder));
+
+  for (int y = 0; error == UPNG_EOK && y < FIXTURE_HEIGHT; y++) {
+    write_expected_row(fixture, y, expected);
+    CHECK(memcmp(&image[y * row_size], expected, row_size) == 0, "%s: row %d (filter %d) differs", fixture->name, y, y % 5);
+  }
+  free(expected);
+  free(image);
+}
+
+// upng_decode packs the rows of sub-byte images without their padding bits
+static void test_decode(const fixture_t* fixture, const file_map_t* file) {
+  int row_bits = FIXTURE_WIDTH * fixture->components * fixture->depth;
+  int row_size = get_row_size(fixture);
+  unsigned char* expected = (unsigned char*)malloc(row_size);
+
+  upng_t* png = upng_new_from_bytes(file->data, file->size);
+  upng_error error = upng_decode(png);
+  CHECK(error == UPNG_EOK, "%s: upng_decode failed with error %d", fixture->name, error);
+  CHECK(
+    error != UPNG_EOK || upng_get_size(png) == (unsigned)((row_bits * FIXTURE_HEIGHT + 7) / 8),
+    "%s: decoded size %u", fixture->name, upng_get_size(png)
+  );
+
+  const unsigned char* image = upng_get_buffer(png);
+  for (int y = 0; error == UPNG_EOK && y < FIXTURE_HEIGHT; y++) {
+    write_expected_row(fixture, y, expected);
+    int mismatches = 0;
+    for (int i = 0; i < row_bits; i++) {
+      int bit = y * row_bits + i;
+      int decoded = (image[bit >> 3] >> (7 - (bit & 7))) & 1;
+      mismatches += decoded != ((expected[i >> 3] >> (7 - (i & 7))) & 1);
+    }
+    CHECK(mismatches == 0, "%s: packed row %d differs in %d bits", fixture->name, y, mismatches);
+  }
+  upng_free(png);
+  free(expected);
+}
+
+// load_png_texture converts every row into level 0 of the texture
+static void test_load_texture(const fixture_t* fixture, const char* path) {
+  texture_t* texture = load_png_texture(path);
+  CHECK(texture != NULL, "%s: load_png_texture failed", fixture->name);
+  if (texture == NULL) {
+    return;
+  }
+
+  const mipmap_t* level = &texture->levels[0];
+  CHECK(level->width == FIXTURE_WIDTH && level->height == FIXTURE_HEIGHT, "%s: texture is %dx%d", fixture->name, level->width, level->height);
+
+  int mismatches = 0;
+  for (int y = 0; y < FIXTURE_HEIGHT; y++) {
+    for (int x = 0; x < FIXTURE_WIDTH; x++) {
+      mismatches += *get_texel(level, x, y) != get_expected_texel(fixture, x, y);
+    }
+  }
+  CHECK(mismatches == 0, "%s: %d texels differ", fixture->name, mismatches);
+  free_texture(texture);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A decoder reused through upng_set_source keeps its scratch memory, so once
+// it has decoded every fixture, decoding them again allocates nothing, and
+// freeing it returns everything to the allocator
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+  int allocations;
+  int live;
+} allocation_counts_t;
+
+static void* counting_alloc(unsigned long size, void* user) {
+  allocation_counts_t* counts = (allocation_counts_t*)user;
+  counts->allocations++;
+  counts->live++;
+  return malloc(size);
+}
+
+static void counting_free(void* pointer, void* user) {
+  allocation_counts_t* counts = (allocation_counts_t*)user;
+  if (pointer != NULL) {
+    counts->live--;
+  }
+  free(pointer);
+}
+
+static void test_allocator(const file_map_t* files) {
+  allocation_counts_t counts = { 0, 0 };
+  upng_allocator allocator = { counting_alloc, counting_free, &counts };
+  upng_t* decoder = upng_new_with_allocator(&allocator);
+  CHECK(decoder != NULL, "upng_new_with_allocator failed");
+  if (decoder == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < NUM_FIXTURES; i++) {
+    test_decode_into(decoder, &fixtures[i], &files[i]);
+  }
+  int warm_allocations = counts.allocations;
+  CHECK(warm_allocations > 0, "the allocator hooks were never called");
+
+  for (int i = 0; i < NUM_FIXTURES; i++) {
+    test_decode_into(decoder, &fixtures[i], &files[i]);
+  }
+  CHECK(
+    counts.allocations == warm_allocations,
+    "a warm decoder allocated %d more times", counts.allocations - warm_allocations
+  );
+
+  upng_free(decoder);
+  CHECK(counts.live == 0, "%d allocations were not freed", counts.live);
+}
+
+int main(void) {
+  file_map_t files[NUM_FIXTURES];
+
+  for (int i = 0; i < NUM_FIXTURES; i++) {
+    char path[1024];
+    get_fixture_path(&fixtures[i], path, sizeof(path));
+    if (!map_file(path, &files[i])) {
+      fprintf(stderr, "Error opening fixture %s. \n", path);
+      return 1;
+    }
+    test_decode(&fixtures[i], &files[i]);
+    test_load_texture(&fixtures[i], path);
+  }
+  test_allocator(files);
+
+  for (int i = 0; i < NUM_FIXTURES; i++) {
+    unmap_file(&files[i]);
+  }
+  destroy_texture_loader();
+
+  if (num_failures > 0) {
+    fprintf(stderr, "%d checks failed\n", num_failures);
+    return 1;
+  }
+  printf("All PNG decoder checks passed for %d fixtures\n", NUM_FIXTURES);
+  return 0;
+}